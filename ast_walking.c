@@ -1,151 +1,366 @@
 #include "ast_walking.h"
+#include "bignum.h"
+#include "case.h"
+#include "closure.h"
+#include "effects.h"
+#include "eval.h"
+#include "future.h"
+#include "generator.h"
 #include "hashmap.h"
+#include "heap.h"
 #include "lex.h"
+#include "list.h"
+#include "memo.h"
 #include "parse.h"
+#include "pool.h"
+#include "profile.h"
+#include "search.h"
+#include "sort.h"
+#include "stream.h"
+#include "text.h"
+#include "vector.h"
 
 #include <assert.h>
 #include <math.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-bool any_double(struct ast_arr ast, hashmap *ctx) {
-  for (int i = 0; i < ast.size; i++) {
-    ast_node a = auto_ast_walk(ast.child_ast[i], ctx);
-    if (a.lit_t == floating_t) {
-      return true;
-    }
-  }
-  return false;
-}
-
 double to_double(ast_node a) {
   switch (a.lit_t) {
   case integer_t:
     return (double)a.value.integer;
   case floating_t:
     return a.value.floating;
+  case bignum_t:
+    return bignum_to_double(a.value.bignum);
   default:
-    exit(69);
+    eval_error("Expected a number");
   }
 }
 
-char *builtins[] = {"+",     "-", "*",  "/",    "var",     "const",
-                    "begin", "<", "if", "func", "average", "abs"};
+char *builtins[] = {"+",               "-",               "*",
+                    "/",               "var",             "const",
+                    "begin",           "<",               "if",
+                    "func",            "average",         "abs",
+                    "future",          "touch",           "pmap",
+                    "make-vector",     "vector",          "vector-length",
+                    "vector-ref",      "vector-set!",     "vector+",
+                    "vector-",         "vector*",         "vector/",
+                    "vector-sum",      "vector-dot",      "vector-min",
+                    "vector-max",      "vector-scale",    "sort!",
+                    "sort-by",         "binary-search",   "unique",
+                    "cons",            "car",             "cdr",
+                    "list",            "length",          "null?",
+                    "map",             "fold",            "string-append",
+                    "substring",       "string-length",   "string->number",
+                    "string-index",    "string-contains", "string-split",
+                    "string-count",    "while",           "do",
+                    "cond",            "case",            "lambda",
+                    "defmemo",         "memoize",         "memo-stats",
+                    "make-generator",  "yield",           "next",
+                    "generator-done?", "stream-range",    "stream-map",
+                    "stream-filter",   "stream-take",     "stream-fold"};
 
-ast_node plus(struct ast_arr ast, hashmap *ctx) {
-  assert(ast.child_ast[0].lit_t == ident_t);
-  // Ignore the first node in arr as it is the ident '+'
-  if (auto_ast_walk(ast.child_ast[1], ctx).lit_t == integer_t) {
-    int64_t accumulator = 0;
-    for (int i = 1; i < ast.size; i++) {
-      ast_node v = auto_ast_walk(ast.child_ast[i], ctx);
-      accumulator += v.value.integer;
-    }
-    ast_node a = {
-        .type = literal_t, .lit_t = integer_t, .value.integer = accumulator};
-    return a;
-  } else if (auto_ast_walk(ast.child_ast[1], ctx).lit_t == floating_t) {
-    double accumulator = 0;
-    for (int i = 1; i < ast.size; i++) {
-      ast_node v = auto_ast_walk(ast.child_ast[i], ctx);
-      accumulator += v.value.floating;
-    }
-    ast_node a = {
-        .type = literal_t, .lit_t = floating_t, .value.floating = accumulator};
-    return a;
+// Arithmetic and comparison sites record the operand types they have seen
+// in the site of their head node. A site whose operands have all been
+// integers, or all floats, evaluates each operand once and checks it
+// against that type before using it unboxed. The first operand that fails
+// the check makes the site general for good, and the call finishes in the
+// general path from that operand on, which dispatches on every type
+typedef enum numeric_site {
+  SITE_UNSEEN,
+  SITE_INTEGER,
+  SITE_FLOAT,
+  SITE_GENERAL,
+} numeric_site;
+
+// The state is kept in the site pointer itself, tagged as in parse.h, so
+// heads copied into calls built at runtime don't allocate. Bits 1 and 2
+// hold the state, bit 3 is set once the operands are planned, bits 4 to
+// 19 hold the plan and the rest the effects epoch it was made in
+#define SITE_PLANNED 8u
+#define SITE_PLAN_SHIFT 4
+#define SITE_EPOCH_SHIFT 20
+
+static uintptr_t site_word(struct ast_arr ast) {
+  return (uintptr_t)atomic_load_explicit(&ast.child_ast[0].child.site,
+                                         memory_order_relaxed);
+}
+
+// Replaces the bits outside `keep` with `set`, whatever other threads
+// evaluating the same site change meanwhile
+static void site_update(struct ast_arr ast, uintptr_t keep, uintptr_t set) {
+  void *old = atomic_load_explicit(&ast.child_ast[0].child.site,
+                                   memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(
+      &ast.child_ast[0].child.site, &old,
+      (void *)(((uintptr_t)old & keep) | set | 1), memory_order_relaxed,
+      memory_order_relaxed)) {
   }
-  printf("unsupported operation for ");
-  ast_print(ast.child_ast[1]);
-  printf("\n");
-  exit(1);
 }
 
-ast_node minus(struct ast_arr ast, hashmap *ctx) {
-  assert(ast.child_ast[0].lit_t == ident_t);
-  // Ignore the first node in arr as it is the ident '-'
-  if (auto_ast_walk(ast.child_ast[1], ctx).lit_t == integer_t) {
-    int64_t accumulator = auto_ast_walk(ast.child_ast[1], ctx).value.integer;
-    for (int i = 2; i < ast.size; i++) {
-      ast_node v = auto_ast_walk(ast.child_ast[i], ctx);
-      accumulator -= v.value.integer;
+static int site_state(struct ast_arr ast) { return site_word(ast) >> 1 & 3; }
+
+// The state a site moves to after seeing `a`. States only ever gain bits,
+// integer and float together make general
+static int observe(struct ast_arr ast, int state, ast_node a) {
+  int seen = a.lit_t == integer_t   ? SITE_INTEGER
+             : a.lit_t == floating_t ? SITE_FLOAT
+                                     : SITE_GENERAL;
+  if (state != seen && state != SITE_GENERAL) {
+    state = state == SITE_UNSEEN ? seen : SITE_GENERAL;
+    site_update(ast, ~(uintptr_t)0, (uintptr_t)state << 1);
+  }
+  return state;
+}
+
+// The operands of a call that are being evaluated as tasks, see effects.h
+typedef struct operands {
+  uint32_t spawned;
+  future **tasks; // by operand index, allocated once one is spawned
+} operands;
+
+__attribute__((noinline)) static void
+operands_spawn(operands *ops, struct ast_arr ast, hashmap *ctx,
+               uintptr_t word) {
+  uint64_t epoch = effects_epoch(ctx);
+  if (!(word & SITE_PLANNED) ||
+      word >> SITE_EPOCH_SHIFT !=
+          (uintptr_t)(epoch << SITE_EPOCH_SHIFT) >> SITE_EPOCH_SHIFT) {
+    uint32_t plan = effects_plan(ast, ctx);
+    site_update(ast, 7,
+                SITE_PLANNED | (uintptr_t)plan << SITE_PLAN_SHIFT |
+                    (uintptr_t)epoch << SITE_EPOCH_SHIFT);
+    word = site_word(ast);
+  }
+  uint32_t plan = word >> SITE_PLAN_SHIFT & 0xffff;
+  // Tasks waiting on fuel would hold up the green thread that made them
+  int idle;
+  if (!plan || eval_task_depth >= EFFECTS_MAX_TASK_DEPTH || eval_fuelled() ||
+      !(idle = pool_idle())) {
+    return;
+  }
+  // Operands calling no names hold in any frame
+  for (int i = 1; i < ast.size && plan & 1; i++) {
+    if (!effects_unshadowed(ast.child_ast[i], ctx)) {
+      return;
     }
-    ast_node a = {
-        .type = literal_t, .lit_t = integer_t, .value.integer = accumulator};
-    return a;
-  } else if (auto_ast_walk(ast.child_ast[1], ctx).lit_t == floating_t) {
-    double accumulator = auto_ast_walk(ast.child_ast[1], ctx).value.floating;
-    for (int i = 2; i < ast.size; i++) {
-      ast_node v = auto_ast_walk(ast.child_ast[i], ctx);
-      accumulator -= v.value.floating;
+  }
+  // The first costly operand is left to this thread
+  plan &= ~1u;
+  plan &= plan - 1;
+  ops->tasks = heap_alloc(ast.size * sizeof(future *), NULL);
+  for (int i = 1; i < ast.size && idle; i++) {
+    if (plan >> i & 1) {
+      ops->tasks[i] = future_spawn(ast.child_ast[i], ctx);
+      ops->spawned |= 1u << i;
+      idle--;
     }
-    ast_node a = {
-        .type = literal_t, .lit_t = floating_t, .value.floating = accumulator};
-    return a;
   }
+}
 
-  printf("unsupported operation for ");
-  ast_print(ast.child_ast[1]);
-  printf("\n");
-  exit(1);
+// Starts evaluating the operands planned to run in parallel, a site planned
+// to run in order only costs a load
+static inline void operands_start(operands *ops, struct ast_arr ast,
+                                  hashmap *ctx) {
+  ops->spawned = 0;
+  uintptr_t word = site_word(ast);
+  if (!(word & SITE_PLANNED) || word >> SITE_PLAN_SHIFT & 0xffff) {
+    operands_spawn(ops, ast, ctx, word);
+  }
 }
 
-ast_node mul(struct ast_arr ast, hashmap *ctx) {
-  assert(ast.child_ast[0].lit_t == ident_t);
-  // Ignore the first node in arr as it is the ident '*'
-  if (auto_ast_walk(ast.child_ast[1], ctx).lit_t == integer_t) {
-    int64_t accumulator = auto_ast_walk(ast.child_ast[1], ctx).value.integer;
-    for (int i = 2; i < ast.size; i++) {
-      ast_node v = auto_ast_walk(ast.child_ast[i], ctx);
-      accumulator *= v.value.integer;
+// Operand `i`, operands must be taken in order so errors are raised in the
+// order evaluating them in place would raise them
+static inline ast_node operand(operands *ops, struct ast_arr ast, int i,
+                               hashmap *ctx) {
+  if (ops->spawned >> i & 1) {
+    return future_wait(ops->tasks[i]);
+  }
+  if (!ops->spawned) {
+    return auto_ast_walk(ast.child_ast[i], ctx);
+  }
+  // Evaluated alongside the tasks, so as deep in them
+  eval_task_depth++;
+  ast_node a = auto_ast_walk(ast.child_ast[i], ctx);
+  eval_task_depth--;
+  return a;
+}
+
+typedef enum arith_op { ADD, SUB, MUL, DIV } arith_op;
+
+// True when the result doesn't fit, `r` then holds garbage
+static bool int_op(arith_op op, int64_t a, int64_t b, int64_t *r) {
+  switch (op) {
+  case ADD:
+    return __builtin_add_overflow(a, b, r);
+  case SUB:
+    return __builtin_sub_overflow(a, b, r);
+  case MUL:
+    return __builtin_mul_overflow(a, b, r);
+  default:
+    if (!b) {
+      eval_error("Division by zero");
     }
-    ast_node a = {
-        .type = literal_t, .lit_t = integer_t, .value.integer = accumulator};
-    return a;
-  } else if (auto_ast_walk(ast.child_ast[1], ctx).lit_t == floating_t) {
-    double accumulator = auto_ast_walk(ast.child_ast[1], ctx).value.floating;
-    for (int i = 2; i < ast.size; i++) {
-      ast_node v = auto_ast_walk(ast.child_ast[i], ctx);
-      accumulator *= v.value.floating;
+    if (a == INT64_MIN && b == -1) {
+      return true;
     }
-    ast_node a = {
-        .type = literal_t, .lit_t = floating_t, .value.floating = accumulator};
-    return a;
+    *r = a / b;
+    return false;
   }
+}
 
-  printf("unsupported operation for ");
-  ast_print(ast.child_ast[1]);
-  printf("\n");
-  exit(1);
+static ast_node bignum_op(arith_op op, ast_node a, ast_node b) {
+  switch (op) {
+  case ADD:
+    return bignum_add(a, b);
+  case SUB:
+    return bignum_sub(a, b);
+  case MUL:
+    return bignum_mul(a, b);
+  default:
+    return bignum_div(a, b);
+  }
 }
 
-ast_node division(struct ast_arr ast, hashmap *ctx) {
+static double float_op(arith_op op, double a, double b) {
+  switch (op) {
+  case ADD:
+    return a + b;
+  case SUB:
+    return a - b;
+  case MUL:
+    return a * b;
+  default:
+    return a / b;
+  }
+}
+
+static bool is_number(ast_node a) {
+  return a.lit_t == integer_t || a.lit_t == floating_t || a.lit_t == bignum_t;
+}
+
+// The operand as written, cut short if it doesn't fit
+static char *operand_text(ast_node a, char *buf, size_t size) {
+  buf[0] = '\0';
+  FILE *f = fmemopen(buf, size, "w");
+  if (f) {
+    ast_fprint(f, a);
+    fclose(f);
+  }
+  return buf;
+}
+
+static void unsupported(struct ast_arr ast, int i) {
+  char buf[256];
+  eval_error("unsupported operation for %s",
+             operand_text(ast.child_ast[i], buf, sizeof(buf)));
+}
+
+// acc op v, where v is operand `i`. Integers stay integers until a float
+// turns up, from then on it's doubles. Integers that overflow become
+// bignums, and bignums become integers again once they fit
+static ast_node arith_step(struct ast_arr ast, int i, arith_op op, ast_node acc,
+                           ast_node v) {
+  if (!is_number(v)) {
+    unsupported(ast, i);
+  }
+  int64_t r;
+  if (acc.lit_t == integer_t && v.lit_t == integer_t &&
+      !int_op(op, acc.value.integer, v.value.integer, &r)) {
+    acc.value.integer = r;
+    return acc;
+  }
+  if (acc.lit_t == floating_t || v.lit_t == floating_t) {
+    return (ast_node){
+        .type = literal_t,
+        .lit_t = floating_t,
+        .value.floating = float_op(op, to_double(acc), to_double(v))};
+  }
+  return bignum_op(op, acc, v);
+}
+
+static ast_node arith_general(struct ast_arr ast, hashmap *ctx, operands *ops,
+                              arith_op op, ast_node acc, int i) {
+  for (; i < ast.size; i++) {
+    acc = arith_step(ast, i, op, acc, operand(ops, ast, i, ctx));
+  }
+  return acc;
+}
+
+// Where the fast paths give up, `v` is operand `i`. Kept out of line so
+// they stay small
+__attribute__((noinline)) static ast_node
+arith_resume(struct ast_arr ast, hashmap *ctx, operands *ops, arith_op op,
+             ast_node acc, int i, ast_node v) {
+  return arith_general(ast, ctx, ops, op, arith_step(ast, i, op, acc, v),
+                       i + 1);
+}
+
+// (op a b c ...) is ((a op b) op c) ..., (op a) is a
+static ast_node arith(struct ast_arr ast, hashmap *ctx, arith_op op) {
   assert(ast.child_ast[0].lit_t == ident_t);
-  // Ignore the first node in arr as it is the ident '/'
-  if (auto_ast_walk(ast.child_ast[1], ctx).lit_t == integer_t) {
-    int64_t accumulator = auto_ast_walk(ast.child_ast[1], ctx).value.integer;
+  if (ast.size < 2) {
+    eval_error("%s expects at least one argument",
+               ast.child_ast[0].value.ident);
+  }
+  int state = site_state(ast);
+  operands ops;
+  operands_start(&ops, ast, ctx);
+  ast_node first = operand(&ops, ast, 1, ctx);
+  // A fresh node, `first` may be a const
+  ast_node acc = {.type = literal_t, .lit_t = first.lit_t, .value = first.value};
+  state = observe(ast, state, acc);
+  if (state == SITE_INTEGER) {
+    int64_t n = acc.value.integer;
     for (int i = 2; i < ast.size; i++) {
-      ast_node v = auto_ast_walk(ast.child_ast[i], ctx);
-      accumulator /= v.value.integer;
+      ast_node v = operand(&ops, ast, i, ctx);
+      int64_t r;
+      if (v.lit_t != integer_t) {
+        observe(ast, state, v);
+      } else if (!int_op(op, n, v.value.integer, &r)) {
+        n = r;
+        continue;
+      }
+      // An overflow leaves the site integer, it's rare
+      acc.value.integer = n;
+      return arith_resume(ast, ctx, &ops, op, acc, i, v);
     }
-    ast_node a = {
-        .type = literal_t, .lit_t = integer_t, .value.integer = accumulator};
-    return a;
-  } else if (auto_ast_walk(ast.child_ast[1], ctx).lit_t == floating_t) {
-    double accumulator = auto_ast_walk(ast.child_ast[1], ctx).value.floating;
+    acc.value.integer = n;
+    return acc;
+  }
+  if (state == SITE_FLOAT) {
+    double d = acc.value.floating;
     for (int i = 2; i < ast.size; i++) {
-      ast_node v = auto_ast_walk(ast.child_ast[i], ctx);
-      accumulator /= v.value.floating;
+      ast_node v = operand(&ops, ast, i, ctx);
+      if (v.lit_t != floating_t) {
+        observe(ast, state, v);
+        acc.value.floating = d;
+        return arith_resume(ast, ctx, &ops, op, acc, i, v);
+      }
+      d = float_op(op, d, v.value.floating);
     }
-    ast_node a = {
-        .type = literal_t, .lit_t = floating_t, .value.floating = accumulator};
-    return a;
+    acc.value.floating = d;
+    return acc;
   }
+  if (!is_number(acc)) {
+    unsupported(ast, 1);
+  }
+  return arith_general(ast, ctx, &ops, op, acc, 2);
+}
+
+ast_node plus(struct ast_arr ast, hashmap *ctx) { return arith(ast, ctx, ADD); }
 
-  printf("unsupported operation for ");
-  ast_print(ast.child_ast[1]);
-  printf("\n");
-  exit(1);
+ast_node minus(struct ast_arr ast, hashmap *ctx) {
+  return arith(ast, ctx, SUB);
+}
+
+ast_node mul(struct ast_arr ast, hashmap *ctx) { return arith(ast, ctx, MUL); }
+
+ast_node division(struct ast_arr ast, hashmap *ctx) {
+  return arith(ast, ctx, DIV);
 }
 
 ast_node var(struct ast_arr ast, hashmap *ctx) {
@@ -157,8 +372,7 @@ ast_node var(struct ast_arr ast, hashmap *ctx) {
   ast_node prev_value = hashmap_get(ctx, variable_name);
   // Look up if var exists and is const
   if (prev_value.type == const_t) {
-    fprintf(stderr, "Cannot reassign to const ident %s\n", variable_name);
-    exit(1);
+    eval_error("Cannot reassign to const ident %s", variable_name);
   }
   ast_node value = auto_ast_walk(ast.child_ast[2], ctx);
   return bind_ident(ctx, variable_name, value);
@@ -171,8 +385,7 @@ ast_node _const(struct ast_arr ast, hashmap *ctx) {
   ast_node prev_value = hashmap_get(ctx, variable_name);
   // Look up if var exists and is const
   if (prev_value.type == const_t) {
-    fprintf(stderr, "Cannot reassign to const ident %s\n", variable_name);
-    exit(1);
+    eval_error("Cannot reassign to const ident %s", variable_name);
   }
   ast_node value = auto_ast_walk(ast.child_ast[2], ctx);
   value.type = const_t;
@@ -190,18 +403,31 @@ ast_node begin(struct ast_arr ast, hashmap *ctx) {
 
 ast_node lt(struct ast_arr ast, hashmap *ctx) {
   assert(ast.child_ast[0].lit_t == ident_t);
-  ast_node left = auto_ast_walk(ast.child_ast[1], ctx);
-  ast_node right = auto_ast_walk(ast.child_ast[2], ctx);
-  printf("left is %f\n", to_double(left));
-  printf("right is %f\n", to_double(right));
+  // Integers compare as integers, as doubles if either is a float
+  int state = site_state(ast);
+  operands ops;
+  operands_start(&ops, ast, ctx);
+  ast_node left = operand(&ops, ast, 1, ctx);
+  ast_node right = operand(&ops, ast, 2, ctx);
   ast_node n = {.type = literal_t, .lit_t = bool_t};
-  struct ast_arr args = {.size = ast.size - 1, .child_ast = &ast.child_ast[1]};
-  if (any_double(args, ctx)) {
+  if (state == SITE_INTEGER && left.lit_t == integer_t &&
+      right.lit_t == integer_t) {
+    n.value.boolean = left.value.integer < right.value.integer;
+    return n;
+  }
+  if (state == SITE_FLOAT && left.lit_t == floating_t &&
+      right.lit_t == floating_t) {
+    n.value.boolean = left.value.floating < right.value.floating;
+    return n;
+  }
+  observe(ast, observe(ast, state, left), right);
+  if (left.lit_t == floating_t || right.lit_t == floating_t) {
     n.value.boolean = to_double(left) < to_double(right);
+  } else if (left.lit_t == bignum_t || right.lit_t == bignum_t) {
+    n.value.boolean = bignum_cmp(left, right) < 0;
   } else {
     n.value.boolean = left.value.integer < right.value.integer;
   }
-
   return n;
 }
 
@@ -218,9 +444,123 @@ ast_node if_expr(struct ast_arr ast, hashmap *ctx) {
     } else {
       return auto_ast_walk(ast.child_ast[3], ctx);
     }
-  } else {
-    assert("If expression condition must be of type bool" == false);
   }
+  eval_error("If expression condition must be of type bool");
+}
+
+ast_node cond(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  // (cond (test body...) ... (else body...))
+  // Tests run in order until one is true, false if none are
+  ast_node result = {.type = literal_t, .lit_t = bool_t, .value.boolean = false};
+  for (int i = 1; i < ast.size; i++) {
+    struct ast_arr clause = ast.child_ast[i].child;
+    if (ast.child_ast[i].type != list_t || !clause.size) {
+      eval_error("Malformed cond clause");
+    }
+    ast_node test = clause.child_ast[0];
+    if (test.type != literal_t || test.lit_t != ident_t ||
+        strcmp(test.value.ident, "else")) {
+      ast_node condition = auto_ast_walk(test, ctx);
+      if (condition.lit_t != bool_t) {
+        eval_error("cond test must be of type bool");
+      }
+      if (!condition.value.boolean) {
+        continue;
+      }
+      result = condition;
+    }
+    for (int j = 1; j < clause.size; j++) {
+      result = auto_ast_walk(clause.child_ast[j], ctx);
+    }
+    return result;
+  }
+  return result;
+}
+
+static bool loop_test(ast_node test, hashmap *ctx) {
+  ast_node condition = auto_ast_walk(test, ctx);
+  if (condition.lit_t != bool_t) {
+    eval_error("Loop condition must be of type bool");
+  }
+  return condition.value.boolean;
+}
+
+ast_node while_loop(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  // [0] = 'while'
+  // [1] = condition
+  // [2...] = body
+  // The body runs in this frame, so its `var`s are seen by the condition
+  ast_node last = {.type = literal_t, .lit_t = bool_t, .value.boolean = false};
+  while (loop_test(ast.child_ast[1], ctx)) {
+    for (int i = 2; i < ast.size; i++) {
+      last = auto_ast_walk(ast.child_ast[i], ctx);
+    }
+  }
+  return last;
+}
+
+ast_node do_loop(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  // (do ((i 0 (+ i 1)) ...) ((< 9 i) result ...) body ...)
+  //  0   1                  2                    3...
+  // The names are bound in this frame like `var`. Every step is evaluated
+  // before any name is updated
+  struct ast_arr bindings = ast.child_ast[1].child;
+  struct ast_arr exit_clause = ast.child_ast[2].child;
+  if (ast.size < 3 || ast.child_ast[1].type != list_t ||
+      ast.child_ast[2].type != list_t || !exit_clause.size) {
+    eval_error("Malformed do loop");
+  }
+  for (int i = 0; i < bindings.size; i++) {
+    struct ast_arr b = bindings.child_ast[i].child;
+    if (bindings.child_ast[i].type != list_t || b.size < 2 || b.size > 3 ||
+        b.child_ast[0].lit_t != ident_t) {
+      eval_error("Malformed do loop binding");
+    }
+    if (hashmap_get(ctx, b.child_ast[0].value.ident).type == const_t) {
+      eval_error("Cannot reassign to const ident %s",
+                 b.child_ast[0].value.ident);
+    }
+  }
+
+  // Not malloc'd, the body may raise and abandon the loop
+  ast_node small[8];
+  ast_node *values =
+      bindings.size <= 8
+          ? small
+          : heap_alloc(bindings.size * sizeof(ast_node), NULL);
+  for (int i = 0; i < bindings.size; i++) {
+    values[i] = auto_ast_walk(bindings.child_ast[i].child.child_ast[1], ctx);
+  }
+  for (int i = 0; i < bindings.size; i++) {
+    bind_ident(ctx, bindings.child_ast[i].child.child_ast[0].value.ident,
+               values[i]);
+  }
+  while (!loop_test(exit_clause.child_ast[0], ctx)) {
+    for (int i = 3; i < ast.size; i++) {
+      auto_ast_walk(ast.child_ast[i], ctx);
+    }
+    for (int i = 0; i < bindings.size; i++) {
+      struct ast_arr b = bindings.child_ast[i].child;
+      if (b.size == 3) {
+        values[i] = auto_ast_walk(b.child_ast[2], ctx);
+      }
+    }
+    for (int i = 0; i < bindings.size; i++) {
+      struct ast_arr b = bindings.child_ast[i].child;
+      if (b.size == 3) {
+        bind_ident(ctx, b.child_ast[0].value.ident, values[i]);
+      }
+    }
+  }
+
+  ast_node result = {.type = literal_t, .lit_t = bool_t, .value.boolean = false};
+  for (int i = 1; i < exit_clause.size; i++) {
+    result = auto_ast_walk(exit_clause.child_ast[i], ctx);
+  }
+  return result;
 }
 
 ast_node func(struct ast_arr ast, hashmap *ctx) {
@@ -229,8 +569,15 @@ ast_node func(struct ast_arr ast, hashmap *ctx) {
   assert(ast.child_ast[0].lit_t == ident_t);
   assert(ast.child_ast[1].lit_t == ident_t);
   assert(ast.child_ast[2].type == list_t);
-  char **params = calloc(ast.child_ast[2].child.size,
-                         sizeof(char **)); // this seg faults < 2
+  if (ctx->slots) {
+    // Defined in a call, it may read the call's names after it returns
+    char *name = ast.child_ast[1].value.ident;
+    ast_node f = bind_ident(ctx, name, closure_new(ast, 2, name, ctx, NULL));
+    closure_late_bind(ctx, name, f);
+    return f;
+  }
+  // NULL terminated, for effects.c
+  char **params = calloc(ast.child_ast[2].child.size + 1, sizeof(char *));
   for (int i = 0; i < ast.child_ast[2].child.size; i++) {
     params[i] = ast.child_ast[2].child.child_ast[i].value.ident;
   }
@@ -251,12 +598,7 @@ ast_node average(struct ast_arr ast, hashmap *ctx) {
   double total = 0;
   int count = 0;
   for (; count < ast.size - 1; count++) {
-    ast_node val = auto_ast_walk(ast.child_ast[count + 1], ctx);
-    if (val.lit_t == integer_t) {
-      total += val.value.integer;
-    } else {
-      total += val.value.floating;
-    }
+    total += to_double(auto_ast_walk(ast.child_ast[count + 1], ctx));
   }
 
   return (ast_node){
@@ -266,24 +608,45 @@ ast_node average(struct ast_arr ast, hashmap *ctx) {
 ast_node my_abs(struct ast_arr ast, hashmap *ctx) {
   assert(ast.child_ast[0].lit_t == ident_t);
   ast_node operand = auto_ast_walk(ast.child_ast[1], ctx);
-  if (operand.lit_t == integer_t) {
+  if (operand.lit_t == integer_t && operand.value.integer != INT64_MIN) {
     return (ast_node){.type = literal_t,
                       .lit_t = integer_t,
                       .value.integer = labs(operand.value.integer)};
+  } else if (operand.lit_t == integer_t || operand.lit_t == bignum_t) {
+    return bignum_abs(operand);
   } else if (operand.lit_t == floating_t) {
     return (ast_node){.type = literal_t,
                       .lit_t = floating_t,
-                      .value.integer = fabs(operand.value.floating)};
+                      .value.floating = fabs(operand.value.floating)};
   }
 
-  printf("unsuported operation on ");
-  ast_print(ast.child_ast[1]);
-  printf("\n");
-  exit(1);
+  char buf[256];
+  eval_error("unsuported operation on %s",
+             operand_text(ast.child_ast[1], buf, sizeof(buf)));
 }
 
-builtin *builtin_arr[] = {plus,  minus, mul,     division, var,     _const,
-                          begin, lt,    if_expr, func,     average, my_abs};
+builtin *builtin_arr[] = {plus,             minus,            mul,
+                          division,         var,              _const,
+                          begin,            lt,               if_expr,
+                          func,             average,          my_abs,
+                          spawn_future,     touch,            pmap,
+                          make_vector,      vector_literal,   vector_length,
+                          vector_ref,       vector_set,       vector_add,
+                          vector_sub,       vector_mul,       vector_div,
+                          vector_sum,       vector_dot,       vector_min,
+                          vector_max,       vector_scale,     sort_in_place,
+                          sort_by,          binary_search,    unique,
+                          cons,             car,              cdr,
+                          list,             list_length,      is_null,
+                          list_map,         fold,             string_append,
+                          substring,        string_length,    string_to_number,
+                          string_index,     string_contains,  string_split,
+                          string_count,     while_loop,       do_loop,
+                          cond,             case_expr,        lambda,
+                          defmemo,          memoize,          memo_stats,
+                          make_generator,   generator_yield,  generator_next,
+                          generator_done,   stream_range,     stream_map,
+                          stream_filter,    stream_take,      stream_fold};
 
 builtin *is_builtin(char *ident) {
   for (int i = 0; i < sizeof(builtins) / sizeof(char *); i++) {
@@ -295,6 +658,16 @@ builtin *is_builtin(char *ident) {
 }
 
 ast_node bind_ident(hashmap *ctx, char *key, ast_node value) {
+  if (!ctx->slots) {
+    effects_rebind(ctx, key, value);
+    // A global outlives the form that named it, so its key is a copy
+    pair *p = hashmap_find(ctx, key);
+    if (p) {
+      p->value = value;
+      return value;
+    }
+    key = strcpy(heap_alloc(strlen(key) + 1, NULL), key);
+  }
   hashmap_insert(ctx, key, value);
   return value;
 }
@@ -302,42 +675,122 @@ ast_node bind_ident(hashmap *ctx, char *key, ast_node value) {
 ast_node get_ident(hashmap *ctx, char *key) {
   ast_node ret = hashmap_get(ctx, key);
   if (ret.type == tombstone_t) {
-    fprintf(stderr, "No variable associated with identifier %s\n", key);
-    exit(EXIT_FAILURE);
+    eval_error("No variable associated with identifier %s", key);
   }
   return ret;
 }
 
+// A call's frame holds its parameters, and for a closure the names it
+// captured. Its parent is the global environment the call was made from,
+// so a function sees globals but never its caller's names. Frames start
+// on the stack, see closure.h for why none outlives its call
+#define FRAME_SLOTS 11
+
+// Copies of a frame made for futures keep `slots` and still count as one
+hashmap *globals(hashmap *ctx) {
+  while (ctx->slots) {
+    ctx = ctx->parent;
+  }
+  return ctx;
+}
+
+bool is_function(ast_node a) {
+  return a.type == function_t ||
+         (a.type != list_t && (a.lit_t == closure_t || a.lit_t == memo_t));
+}
+
+static ast_node call_function(char *name, ast_node f, struct ast_arr call,
+                              hashmap *ctx) {
+  if (f.lit_t == memo_t) {
+    return memo_call(f.value.memo, call, ctx);
+  }
+  eval_enter();
+  pair slots[FRAME_SLOTS];
+  hashmap frame = hashmap_frame(globals(ctx), slots, FRAME_SLOTS);
+  ast_node result;
+  if (f.type == function_t) {
+    for (int i = 0; i < call.size - 1; i++) {
+      bind_ident(&frame, f.value.params[i],
+                 auto_ast_walk(call.child_ast[i + 1], ctx));
+    }
+    ast_node func_to_execute = {.type = list_t, .child = f.child};
+    result = auto_ast_walk(func_to_execute, &frame);
+  } else {
+    closure *c = f.value.closure;
+    if (call.size - 1 != c->site->params) {
+      eval_error("%s expects %d arguments, got %d", name, c->site->params,
+                 call.size - 1);
+    }
+    for (int i = 0; i < c->size; i++) {
+      // Still unbound, the name is a global's
+      if (c->captured[i].value.type != tombstone_t) {
+        bind_ident(&frame, c->captured[i].name, c->captured[i].value);
+      }
+    }
+    if (c->name) {
+      bind_ident(&frame, c->name, c->memo ? memo_node(c->memo) : f);
+    }
+    for (int i = 0; i < c->site->params; i++) {
+      bind_ident(&frame, c->site->names[i],
+                 auto_ast_walk(call.child_ast[i + 1], ctx));
+    }
+    for (int i = 0; i < c->body.size; i++) {
+      result = auto_ast_walk(c->body.child_ast[i], &frame);
+    }
+  }
+  hashmap_free(&frame);
+  eval_exit();
+  return result;
+}
+
+// A lambda called where it's written can't escape, so it lives on the stack.
+// Out of line so every ast_walk frame doesn't carry a closure_buf
+__attribute__((noinline)) static ast_node
+call_lambda(ast_node head, struct ast_arr call, hashmap *ctx) {
+  closure_buf stack;
+  ast_node f = closure_new(head.child, 1, NULL, ctx, &stack);
+  return call_function("lambda", f, call, ctx);
+}
+
 // Evaluates a list by taking the first value as a
 // function, and the remaining values as arguments
 ast_node ast_walk(ast_node ast, hashmap *ctx) {
   assert(ast.type == list_t);
+  eval_step();
   struct ast_arr children = ast.child;
-  char *function_name = children.child_ast[0].value.string;
-  builtin *b;
-  if ((b = is_builtin(function_name)) != NULL) {
-    return b(children, ctx);
-  }
-  // Now we are looking for a user defined func
-  ast_node user_func = get_ident(ctx, function_name);
-  assert(user_func.type == function_t);
-  // We really need to copy the outer ctx, this prevents functions from calling
-  // other functions or even themselves
-  /* hashmap child_ctx = hashmap_init(fnv_string_hash, str_equals, 0.5, 0); */
-  hashmap child_ctx = hashmap_copy(ctx);
-  /* assert(((ast_node *)user_func.value.params)->child.size == children.size -
-   * 1); */
-  for (int i = 0; i < children.size - 1; i++) {
-    bind_ident(&child_ctx, user_func.value.params[i],
-               auto_ast_walk(children.child_ast[i + 1], ctx));
-  }
-
-  ast_node func_to_execute = {.type = list_t, .child = user_func.child};
-  ast_node result = auto_ast_walk(func_to_execute, &child_ctx);
-  hashmap_free(&child_ctx);
+  ast_node head = children.child_ast[0];
+  char *function_name = "lambda";
+  ast_node user_func = head;
+  if (head.type == literal_t && head.lit_t == ident_t) {
+    function_name = head.value.ident;
+    builtin *b;
+    if ((b = is_builtin(function_name)) != NULL) {
+      if (!profiling) {
+        return b(children, ctx);
+      }
+      profile_enter(function_name);
+      ast_node result = b(children, ctx);
+      profile_exit();
+      return result;
+    }
+    // Now we are looking for a user defined func
+    user_func = get_ident(ctx, function_name);
+  } else if (head.type == list_t) {
+    if (is_lambda(head) && !profiling) {
+      return call_lambda(head, children, ctx);
+    }
+    user_func = ast_walk(head, ctx);
+  }
+  if (!is_function(user_func)) {
+    eval_error("%s is not a function", function_name);
+  }
+  if (!profiling) {
+    return call_function(function_name, user_func, children, ctx);
+  }
+  profile_enter(function_name);
+  ast_node result = call_function(function_name, user_func, children, ctx);
+  profile_exit();
   return result;
-  /* fprintf(stderr, "%d %s\n", children.child_ast[0].type, function_name); */
-  /* assert("nothing but builtins implemented yet" == false); */
 }
 
 // Can differentiate between a list or a literal
@@ -13,6 +13,14 @@ builtin *is_builtin(char *);
 ast_node plus(struct ast_arr ast, hashmap *ctx);
 ast_node var(struct ast_arr ast, hashmap *ctx);
 ast_node begin(struct ast_arr ast, hashmap *ctx);
+ast_node func(struct ast_arr ast, hashmap *ctx);
+
+// Functions, closures and memoized functions, what a call can start with
+bool is_function(ast_node);
+
+// The global environment a call frame was made in, `ctx` itself outside
+// of any call
+hashmap *globals(hashmap *ctx);
 
 ast_node bind_ident(hashmap *ctx, char *key, ast_node value);
 ast_node get_ident(hashmap *ctx, char *key);
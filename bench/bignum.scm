@@ -0,0 +1,3 @@
+(func factorial (n) (do ((i 1 (+ i 1)) (p 1 (* p i))) ((< n i) p)))
+(var f (factorial 3000))
+(< (/ (* f f) f) f)
@@ -0,0 +1,2 @@
+(func fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(do ((i 0 (+ i 1)) (s 0 (+ s (* i 3)))) ((< 1000000 i) (+ s (fib 24))))
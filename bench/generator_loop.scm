@@ -0,0 +1,3 @@
+(func count (i) (+ i 0))
+
+(do ((i 0 (+ i 1)) (s 0 (+ s (count i)))) ((< 199999 i) s))
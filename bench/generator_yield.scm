@@ -0,0 +1,6 @@
+(func count ()
+  (do ((i 0 (+ i 1))) ((< 199999 i) 0)
+    (yield i)))
+
+(var g (make-generator count))
+(do ((i 0 (+ i 1)) (s 0 (+ s (next g)))) ((< 199999 i) s))
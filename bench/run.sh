@@ -0,0 +1,27 @@
+#!/bin/sh
+# usage: bench/run.sh [interpreter] [runs]
+# Runs every program in bench/ and prints the fastest of `runs` timings,
+# with the program's last result so pairs can be checked against each
+# other. Pairs compare a builtin with the same work written in the
+# language, e.g. sort_native.scm and sort_scheme.scm, or the same work
+# with and without a feature, e.g. generator_yield.scm and
+# generator_loop.scm, whose difference is the cost of 200000 switches to a
+# generator and back
+bin=${1:-./schemelike}
+runs=${2:-5}
+dir=$(dirname "$0")
+
+for f in "$dir"/*.scm; do
+  best=
+  i=0
+  while [ "$i" -lt "$runs" ]; do
+    start=$(date +%s%N)
+    result=$("$bin" --stream "$f" | tail -n 1)
+    ms=$((($(date +%s%N) - start) / 1000000))
+    if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then
+      best=$ms
+    fi
+    i=$((i + 1))
+  done
+  printf '%-24s %6d ms  %s\n' "$(basename "$f")" "$best" "$result"
+done
@@ -0,0 +1,12 @@
+(func fill (n)
+  (begin
+    (var v (make-vector n 0))
+    (var x 42)
+    (do ((i 0 (+ i 1))) ((< (- n 1) i) v)
+      (var x (* x 1103515245))
+      (var x (+ x 12345))
+      (var x (- x (* (/ x 2147483648) 2147483648)))
+      (vector-set! v i x))))
+
+(var v (sort! (fill 20000)))
+(list (vector-ref v 0) (vector-ref v 9999) (vector-ref v 19999))
@@ -0,0 +1,42 @@
+(func fill (n)
+  (begin
+    (var v (make-vector n 0))
+    (var x 42)
+    (do ((i 0 (+ i 1))) ((< (- n 1) i) v)
+      (var x (* x 1103515245))
+      (var x (+ x 12345))
+      (var x (- x (* (/ x 2147483648) 2147483648)))
+      (vector-set! v i x))))
+
+(func swap (v i j)
+  (begin
+    (var t (vector-ref v i))
+    (vector-set! v i (vector-ref v j))
+    (vector-set! v j t)))
+
+(func sift (v root end)
+  (begin
+    (var done false)
+    (while (if done false (< (+ (* 2 root) 1) end))
+      (var child (+ (* 2 root) 1))
+      (if (< (+ child 1) end)
+          (if (< (vector-ref v child) (vector-ref v (+ child 1)))
+              (var child (+ child 1))
+              child)
+          child)
+      (if (< (vector-ref v root) (vector-ref v child))
+          (begin (swap v root child) (var root child))
+          (var done true)))
+    v))
+
+(func heap-sort (v)
+  (begin
+    (var n (vector-length v))
+    (do ((i (- (/ n 2) 1) (- i 1))) ((< i 0) 0)
+      (sift v i n))
+    (do ((end (- n 1) (- end 1))) ((< end 1) v)
+      (swap v 0 end)
+      (sift v 0 end))))
+
+(var v (heap-sort (fill 20000)))
+(list (vector-ref v 0) (vector-ref v 9999) (vector-ref v 19999))
@@ -0,0 +1,333 @@
+#include "bignum.h"
+#include "eval.h"
+#include "heap.h"
+#include "parse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// An operand, fixnums are viewed through `small` without allocating
+typedef struct view {
+  bool negative;
+  int size;
+  const uint32_t *limbs;
+  uint32_t small[2];
+} view;
+
+static int trim(const uint32_t *a, int n) {
+  while (n && !a[n - 1]) {
+    n--;
+  }
+  return n;
+}
+
+static void view_of(ast_node a, view *v) {
+  if (a.lit_t == bignum_t) {
+    v->negative = a.value.bignum->negative;
+    v->size = a.value.bignum->size;
+    v->limbs = a.value.bignum->limbs;
+    return;
+  }
+  int64_t i = a.value.integer;
+  uint64_t m = i < 0 ? -(uint64_t)i : (uint64_t)i;
+  v->negative = i < 0;
+  v->small[0] = m;
+  v->small[1] = m >> 32;
+  v->size = trim(v->small, 2);
+  v->limbs = v->small;
+}
+
+static bignum *bignum_new(int size, bool heap) {
+  size_t bytes = sizeof(bignum) + size * sizeof(uint32_t);
+  return heap ? heap_alloc(bytes, NULL) : malloc(bytes);
+}
+
+// The value of the magnitude `m`, an integer whenever it fits
+static ast_node number(bool negative, const uint32_t *m, int n, bool heap) {
+  n = trim(m, n);
+  if (n <= 2) {
+    uint64_t u = n ? m[0] : 0;
+    if (n == 2) {
+      u |= (uint64_t)m[1] << 32;
+    }
+    if (u <= INT64_MAX || (negative && u == (uint64_t)INT64_MAX + 1)) {
+      return (ast_node){.type = literal_t,
+                        .lit_t = integer_t,
+                        .value.integer = negative ? (int64_t)(0 - u)
+                                                  : (int64_t)u};
+    }
+  }
+  bignum *b = bignum_new(n, heap);
+  b->negative = negative;
+  b->size = n;
+  memcpy(b->limbs, m, n * sizeof(uint32_t));
+  return (ast_node){.type = literal_t, .lit_t = bignum_t, .value.bignum = b};
+}
+
+static int mag_cmp(const uint32_t *a, int an, const uint32_t *b, int bn) {
+  an = trim(a, an);
+  bn = trim(b, bn);
+  if (an != bn) {
+    return an < bn ? -1 : 1;
+  }
+  for (int i = an - 1; i >= 0; i--) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+// r[0, rn) += a[0, an), the carry runs on while `r` has room
+static void add_at(uint32_t *r, int rn, const uint32_t *a, int an) {
+  uint64_t carry = 0;
+  int i = 0;
+  for (; i < an; i++) {
+    carry += (uint64_t)r[i] + a[i];
+    r[i] = carry;
+    carry >>= 32;
+  }
+  for (; carry && i < rn; i++) {
+    carry += r[i];
+    r[i] = carry;
+    carry >>= 32;
+  }
+}
+
+// r[0, rn) -= a[0, an), `r` must be at least `a`
+static void sub_at(uint32_t *r, int rn, const uint32_t *a, int an) {
+  int64_t borrow = 0;
+  int i = 0;
+  for (; i < an; i++) {
+    int64_t d = (int64_t)r[i] - a[i] - borrow;
+    borrow = d < 0;
+    r[i] = d;
+  }
+  for (; borrow && i < rn; i++) {
+    int64_t d = (int64_t)r[i] - borrow;
+    borrow = d < 0;
+    r[i] = d;
+  }
+}
+
+static void mul_school(const uint32_t *a, int an, const uint32_t *b, int bn,
+                       uint32_t *r) {
+  for (int i = 0; i < an; i++) {
+    uint64_t carry = 0;
+    for (int j = 0; j < bn; j++) {
+      carry += (uint64_t)a[i] * b[j] + r[i + j];
+      r[i + j] = carry;
+      carry >>= 32;
+    }
+    r[i + bn] = carry;
+  }
+}
+
+// r[0, an + bn) = a * b, `r` starts zeroed
+static void mul_mag(const uint32_t *a, int an, const uint32_t *b, int bn,
+                    uint32_t *r) {
+  if (an < BIGNUM_KARATSUBA_LIMBS || bn < BIGNUM_KARATSUBA_LIMBS) {
+    mul_school(a, an, b, bn, r);
+    return;
+  }
+  int m = (an > bn ? an : bn) / 2;
+  if (an <= m || bn <= m) {
+    // Too lopsided to split both, a * b is a * lo + (a * hi << m)
+    if (an <= m) {
+      const uint32_t *t = a;
+      a = b;
+      b = t;
+      int tn = an;
+      an = bn;
+      bn = tn;
+    }
+    uint32_t *hi = calloc(an + bn, sizeof(uint32_t));
+    mul_mag(b, bn, a, m, r);
+    mul_mag(b, bn, &a[m], an - m, hi);
+    add_at(&r[m], an + bn - m, hi, trim(hi, an + bn - m));
+    free(hi);
+    return;
+  }
+
+  // a = a1 << m | a0, b likewise
+  // a * b = z2 << 2m | z1 << m | z0, z1 = (a0 + a1)(b0 + b1) - z2 - z0
+  int a1n = an - m;
+  int b1n = bn - m;
+  uint32_t *z0 = calloc(2 * m, sizeof(uint32_t));
+  uint32_t *z2 = calloc(a1n + b1n, sizeof(uint32_t));
+  mul_mag(a, m, b, m, z0);
+  mul_mag(&a[m], a1n, &b[m], b1n, z2);
+
+  uint32_t *sa = calloc(m + 1, sizeof(uint32_t));
+  uint32_t *sb = calloc(m + 1, sizeof(uint32_t));
+  memcpy(sa, a, m * sizeof(uint32_t));
+  memcpy(sb, b, m * sizeof(uint32_t));
+  add_at(sa, m + 1, &a[m], a1n);
+  add_at(sb, m + 1, &b[m], b1n);
+  int san = trim(sa, m + 1);
+  int sbn = trim(sb, m + 1);
+  uint32_t *z1 = calloc(san + sbn + 1, sizeof(uint32_t));
+  mul_mag(sa, san, sb, sbn, z1);
+  sub_at(z1, san + sbn, z0, trim(z0, 2 * m));
+  sub_at(z1, san + sbn, z2, trim(z2, a1n + b1n));
+
+  memcpy(r, z0, 2 * m * sizeof(uint32_t));
+  add_at(&r[m], an + bn - m, z1, trim(z1, san + sbn));
+  add_at(&r[2 * m], an + bn - 2 * m, z2, trim(z2, a1n + b1n));
+  free(z0);
+  free(z1);
+  free(z2);
+  free(sa);
+  free(sb);
+}
+
+static ast_node add(view *a, view *b) {
+  int n = (a->size > b->size ? a->size : b->size) + 1;
+  uint32_t *r = calloc(n, sizeof(uint32_t));
+  if (a->negative == b->negative) {
+    memcpy(r, a->limbs, a->size * sizeof(uint32_t));
+    add_at(r, n, b->limbs, b->size);
+  } else {
+    if (mag_cmp(a->limbs, a->size, b->limbs, b->size) < 0) {
+      view *t = a;
+      a = b;
+      b = t;
+    }
+    memcpy(r, a->limbs, a->size * sizeof(uint32_t));
+    sub_at(r, n, b->limbs, b->size);
+  }
+  ast_node result = number(a->negative, r, n, true);
+  free(r);
+  return result;
+}
+
+ast_node bignum_add(ast_node x, ast_node y) {
+  view a, b;
+  view_of(x, &a);
+  view_of(y, &b);
+  return add(&a, &b);
+}
+
+ast_node bignum_sub(ast_node x, ast_node y) {
+  view a, b;
+  view_of(x, &a);
+  view_of(y, &b);
+  b.negative = !b.negative;
+  return add(&a, &b);
+}
+
+ast_node bignum_mul(ast_node x, ast_node y) {
+  view a, b;
+  view_of(x, &a);
+  view_of(y, &b);
+  int n = a.size + b.size;
+  uint32_t *r = calloc(n + 1, sizeof(uint32_t));
+  mul_mag(a.limbs, a.size, b.limbs, b.size, r);
+  ast_node result = number(a.negative != b.negative, r, n, true);
+  free(r);
+  return result;
+}
+
+// Shift and subtract, one bit of the quotient at a time
+ast_node bignum_div(ast_node x, ast_node y) {
+  view a, b;
+  view_of(x, &a);
+  view_of(y, &b);
+  if (!b.size) {
+    eval_error("Division by zero");
+  }
+  uint32_t *q = calloc(a.size + 1, sizeof(uint32_t));
+  uint32_t *rem = calloc(b.size + 1, sizeof(uint32_t));
+  for (int64_t bit = (int64_t)a.size * 32 - 1; bit >= 0; bit--) {
+    uint32_t in = a.limbs[bit / 32] >> (bit % 32) & 1;
+    for (int i = 0; i <= b.size; i++) {
+      uint32_t out = rem[i] >> 31;
+      rem[i] = rem[i] << 1 | in;
+      in = out;
+    }
+    if (mag_cmp(rem, b.size + 1, b.limbs, b.size) >= 0) {
+      sub_at(rem, b.size + 1, b.limbs, b.size);
+      q[bit / 32] |= 1u << (bit % 32);
+    }
+  }
+  ast_node result = number(a.negative != b.negative, q, a.size, true);
+  free(q);
+  free(rem);
+  return result;
+}
+
+ast_node bignum_abs(ast_node x) {
+  view a;
+  view_of(x, &a);
+  return number(false, a.limbs, a.size, true);
+}
+
+int bignum_cmp(ast_node x, ast_node y) {
+  view a, b;
+  view_of(x, &a);
+  view_of(y, &b);
+  if (a.negative != b.negative) {
+    return a.negative ? -1 : 1;
+  }
+  int c = mag_cmp(a.limbs, a.size, b.limbs, b.size);
+  return a.negative ? -c : c;
+}
+
+double bignum_to_double(bignum *b) {
+  double d = 0;
+  for (int i = b->size - 1; i >= 0; i--) {
+    d = d * 4294967296.0 + b->limbs[i];
+  }
+  return b->negative ? -d : d;
+}
+
+ast_node bignum_parse(const char *s, bool heap) {
+  bool negative = *s == '-';
+  if (*s == '-' || *s == '+') {
+    s++;
+  }
+  size_t digits = strlen(s);
+  // Each limb holds more than 9 decimal digits
+  int cap = digits / 9 + 2;
+  uint32_t *m = calloc(cap, sizeof(uint32_t));
+  int n = 0;
+  for (; *s; s++) {
+    uint64_t carry = *s - '0';
+    for (int i = 0; i < n; i++) {
+      carry += (uint64_t)m[i] * 10;
+      m[i] = carry;
+      carry >>= 32;
+    }
+    if (carry) {
+      m[n++] = carry;
+    }
+  }
+  ast_node result = number(negative, m, n, heap);
+  free(m);
+  return result;
+}
+
+void bignum_print(FILE *out, bignum *b) {
+  // Peel off nine digits at a time from a copy of the magnitude
+  uint32_t *m = malloc(b->size * sizeof(uint32_t));
+  memcpy(m, b->limbs, b->size * sizeof(uint32_t));
+  uint32_t *chunks = malloc((b->size * 10 / 9 + 2) * sizeof(uint32_t));
+  int n = b->size;
+  int count = 0;
+  while (n) {
+    uint64_t rem = 0;
+    for (int i = n - 1; i >= 0; i--) {
+      rem = rem << 32 | m[i];
+      m[i] = rem / 1000000000;
+      rem %= 1000000000;
+    }
+    chunks[count++] = rem;
+    n = trim(m, n);
+  }
+  fprintf(out, "%s%u", b->negative ? "-" : "", chunks[count - 1]);
+  for (int i = count - 2; i >= 0; i--) {
+    fprintf(out, "%09u", chunks[i]);
+  }
+  free(m);
+  free(chunks);
+}
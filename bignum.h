@@ -0,0 +1,39 @@
+#ifndef BIGNUM_H_
+#define BIGNUM_H_
+#include "parse.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Integers that don't fit in an int64_t, made when fixnum arithmetic
+// overflows and for integer literals out of range. Sign and magnitude, the
+// magnitude in base 2^32 limbs, least significant first and with no
+// leading zero limbs. Immutable once made.
+// Every result that fits in an int64_t is returned as a plain integer, so
+// no bignum ever equals an integer
+typedef struct bignum {
+  bool negative;
+  int32_t size;
+  uint32_t limbs[];
+} bignum;
+
+// Products of operands with fewer limbs than this are done schoolbook,
+// larger ones split recursively by Karatsuba
+#define BIGNUM_KARATSUBA_LIMBS 32
+
+// Operands are integers or bignums
+ast_node bignum_add(ast_node, ast_node);
+ast_node bignum_sub(ast_node, ast_node);
+ast_node bignum_mul(ast_node, ast_node);
+// Truncates towards zero like C, dividing by zero is reported and exits
+ast_node bignum_div(ast_node, ast_node);
+ast_node bignum_abs(ast_node);
+int bignum_cmp(ast_node, ast_node);
+double bignum_to_double(bignum *);
+
+// Decimal digits with an optional sign. Bignums from literals are owned by
+// the tree (`heap` false) and freed with it, see ast_node_free
+ast_node bignum_parse(const char *, bool heap);
+void bignum_print(FILE *, bignum *);
+
+#endif // BIGNUM_H_
@@ -0,0 +1,243 @@
+#include "cache.h"
+#include "hashmap.h"
+#include "parse.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "SLIMAGE"
+// Bumped whenever the same source can parse to a different tree, images
+// from older binaries then miss. 3: integer literals past 32 bits
+#define CACHE_VERSION 3
+
+// Image layout: header, `node_count` ast_nodes, `string_bytes` of strings
+// Child pointers are stored as node indices and string pointers as offsets
+// into the string table, both are patched in place after mapping
+typedef struct image_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t node_size;
+  uint64_t source_hash;
+  uint64_t source_len;
+  uint64_t node_count;
+  uint64_t string_bytes;
+} image_header;
+
+static uint64_t source_hash(const char *source, size_t len) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++) {
+    hash *= 1099511628211;
+    hash ^= (unsigned char)source[i];
+  }
+  return hash;
+}
+
+static bool has_string(ast_node a) {
+  return a.type == literal_t && (a.lit_t == string_t || a.lit_t == ident_t);
+}
+
+static uint64_t count_nodes(ast_node a) {
+  uint64_t count = 1;
+  if (a.type == list_t) {
+    for (int i = 0; i < a.child.size; i++) {
+      count += count_nodes(a.child.child_ast[i]);
+    }
+  }
+  return count;
+}
+
+// Bignum literals point at memory outside the tree, images don't hold them
+static bool has_bignum(ast_node a) {
+  if (a.type == literal_t) {
+    return a.lit_t == bignum_t;
+  }
+  for (int i = 0; a.type == list_t && i < a.child.size; i++) {
+    if (has_bignum(a.child.child_ast[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Only what parse makes can be in an image. Runtime values like vectors
+// or closures would point at memory it doesn't hold, and a literal's site
+// would be freed with the tree
+static bool parsed_node(ast_node a) {
+  if (a.type == list_t) {
+    return true;
+  }
+  if (a.type != literal_t || atomic_load(&a.child.site) || a.child.size ||
+      a.child.cap) {
+    return false;
+  }
+  switch (a.lit_t) {
+  case integer_t:
+  case floating_t:
+  case bool_t:
+  case string_t:
+  case ident_t:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Each distinct string is written once, `strings` maps it to its offset
+static void intern_strings(ast_node a, hashmap *strings, uint64_t *bytes) {
+  if (has_string(a) && hashmap_get(strings, a.value.string).type ==
+                           tombstone_t) {
+    ast_node offset = {.type = literal_t, .value.integer = *bytes};
+    hashmap_insert(strings, a.value.string, offset);
+    *bytes += strlen(a.value.string) + 1;
+  }
+  if (a.type == list_t) {
+    for (int i = 0; i < a.child.size; i++) {
+      intern_strings(a.child.child_ast[i], strings, bytes);
+    }
+  }
+}
+
+// Writes `a` into `nodes[index]` and its children, contiguously, after `*next`
+static void flatten(ast_node a, ast_node *nodes, uint64_t index,
+                    uint64_t *next, hashmap *strings) {
+  ast_node flat = a;
+  if (a.type == literal_t) {
+    flat.child = (struct ast_arr){0};
+  }
+  if (has_string(a)) {
+    flat.value.integer = hashmap_get(strings, a.value.string).value.integer;
+  } else if (a.type == list_t) {
+    uint64_t first = *next;
+    *next += a.child.size;
+    flat.child.child_ast = (ast_node *)first;
+    flat.child.cap = a.child.size;
+    for (int i = 0; i < a.child.size; i++) {
+      flatten(a.child.child_ast[i], nodes, first + i, next, strings);
+    }
+  }
+  nodes[index] = flat;
+}
+
+void cache_store(const char *path, const char *source, size_t len,
+                 ast_node root) {
+  if (has_bignum(root)) {
+    return;
+  }
+  hashmap strings = hashmap_init(fnv_string_hash, str_equals, 0.5, 0);
+  uint64_t string_bytes = 0;
+  intern_strings(root, &strings, &string_bytes);
+
+  image_header header = {.magic = CACHE_MAGIC,
+                         .version = CACHE_VERSION,
+                         .node_size = sizeof(ast_node),
+                         .source_hash = source_hash(source, len),
+                         .source_len = len,
+                         .node_count = count_nodes(root),
+                         .string_bytes = string_bytes};
+  ast_node *nodes = calloc(header.node_count, sizeof(ast_node));
+  char *table = calloc(string_bytes + 1, sizeof(char));
+  uint64_t next = 1;
+  flatten(root, nodes, 0, &next, &strings);
+  for (int i = 0; i < strings.capacity; i++) {
+    pair p = strings.array[i];
+    if (p.key && (uint64_t)p.key != TOMBSTONE) {
+      strcpy(table + p.value.value.integer, p.key);
+    }
+  }
+
+  // Written to a temporary file and renamed so a concurrent run never
+  // maps a half written image
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+  FILE *fp = fopen(tmp, "w");
+  if (fp) {
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(nodes, sizeof(ast_node), header.node_count, fp) ==
+                  header.node_count &&
+              fwrite(table, sizeof(char), string_bytes, fp) == string_bytes;
+    if (fclose(fp) || !ok || rename(tmp, path)) {
+      unlink(tmp);
+    }
+  }
+
+  free(table);
+  free(nodes);
+  hashmap_free(&strings);
+}
+
+bool cache_load(const char *path, const char *source, size_t len,
+                cached_program *out) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(image_header)) {
+    close(fd);
+    return false;
+  }
+  // Private and writable, relocating only dirties the pages we touch
+  void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+
+  image_header *header = map;
+  ast_node *nodes = (ast_node *)(header + 1);
+  char *table = (char *)(nodes + header->node_count);
+  if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) ||
+      header->version != CACHE_VERSION ||
+      header->node_size != sizeof(ast_node) || header->source_len != len ||
+      header->node_count == 0 ||
+      header->node_count > (uint64_t)st.st_size / sizeof(ast_node) ||
+      sizeof(image_header) + header->node_count * sizeof(ast_node) +
+              header->string_bytes !=
+          (uint64_t)st.st_size ||
+      (header->string_bytes && table[header->string_bytes - 1]) ||
+      header->source_hash != source_hash(source, len)) {
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  for (uint64_t i = 0; i < header->node_count; i++) {
+    ast_node *a = &nodes[i];
+    if (!parsed_node(*a)) {
+      munmap(map, st.st_size);
+      return false;
+    }
+    if (has_string(*a)) {
+      uint64_t offset = a->value.integer;
+      if (offset >= header->string_bytes) {
+        munmap(map, st.st_size);
+        return false;
+      }
+      a->value.string = table + offset;
+    } else if (a->type == list_t) {
+      // Children always come after their parent, so a corrupt image can't
+      // make a cycle
+      uint64_t first = (uint64_t)a->child.child_ast;
+      if (a->child.size < 0 || (a->child.size && first <= i) ||
+          first > header->node_count ||
+          (uint64_t)a->child.size > header->node_count - first) {
+        munmap(map, st.st_size);
+        return false;
+      }
+      a->child.child_ast = nodes + first;
+    }
+  }
+
+  *out = (cached_program){.root = nodes[0], .map = map, .map_len = st.st_size};
+  return true;
+}
+
+void cache_release(cached_program *c) {
+  ast_sites_free(&c->root);
+  munmap(c->map, c->map_len);
+}
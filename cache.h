@@ -0,0 +1,23 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+#include "parse.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// A parsed program mapped straight out of an image file, the nodes and
+// strings live in the mapping so it must never go through ast_node_free
+typedef struct cached_program {
+  ast_node root;
+  void *map;
+  size_t map_len;
+} cached_program;
+
+// Returns false when `path` is missing, corrupt, or was written for
+// different source text, the caller should then lex and parse as usual
+bool cache_load(const char *path, const char *source, size_t len,
+                cached_program *);
+// Best effort, failing to write the image is not an error
+void cache_store(const char *path, const char *source, size_t len, ast_node);
+void cache_release(cached_program *);
+
+#endif // CACHE_H_
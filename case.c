@@ -0,0 +1,295 @@
+#include "case.h"
+#include "ast_walking.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "parse.h"
+#include "text.h"
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum key_kind {
+  KEY_NONE,
+  KEY_INTEGER,
+  KEY_FLOAT,
+  KEY_BOOL,
+  KEY_STRING, // strings, and identifiers used as symbols
+} key_kind;
+
+typedef struct case_key {
+  key_kind kind;
+  int32_t clause; // index of the clause in the case form
+  int64_t bits;   // the integer, bool or the bits of the float
+  const char *bytes;
+  int64_t len;
+} case_key;
+
+// Built the first time a case form runs and kept on its head node, the
+// tables are allocated in the same block as the header.
+// Dense integer keys index `jump` by `key - min`, anything else is looked
+// up in `slots` by a hash seeded so that no two keys share a slot
+typedef struct case_table {
+  int32_t otherwise; // the else clause, or -1
+  int64_t min;
+  uint64_t span; // 0 when hashed
+  int32_t *jump;
+  uint64_t seed;
+  uint64_t mask;
+  case_key *slots;
+} case_table;
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 32;
+  x *= 0xd6e8feb86659fd93;
+  x ^= x >> 32;
+  x *= 0xd6e8feb86659fd93;
+  x ^= x >> 32;
+  return x;
+}
+
+static uint64_t key_hash(case_key *k, uint64_t seed) {
+  uint64_t h = seed ^ k->kind;
+  if (k->kind == KEY_STRING) {
+    for (int64_t i = 0; i < k->len; i++) {
+      h = (h ^ (uint8_t)k->bytes[i]) * 0x100000001b3;
+    }
+  } else {
+    h ^= k->bits;
+  }
+  return mix(h);
+}
+
+static bool key_equals(case_key *a, case_key *b) {
+  if (a->kind != b->kind) {
+    return false;
+  }
+  if (a->kind == KEY_STRING) {
+    return a->len == b->len && !memcmp(a->bytes, b->bytes, a->len);
+  }
+  return a->bits == b->bits;
+}
+
+// A key written in the case form
+static case_key datum_key(ast_node d, int32_t clause) {
+  case_key k = {.clause = clause};
+  if (d.type != literal_t) {
+    eval_error("case keys must be literals");
+  }
+  switch (d.lit_t) {
+  case integer_t:
+    k.kind = KEY_INTEGER;
+    k.bits = d.value.integer;
+    break;
+  case floating_t:
+    k.kind = KEY_FLOAT;
+    memcpy(&k.bits, &d.value.floating, sizeof(double));
+    break;
+  case bool_t:
+    k.kind = KEY_BOOL;
+    k.bits = d.value.boolean;
+    break;
+  case string_t:
+  case ident_t:
+    k.kind = KEY_STRING;
+    k.bytes = d.value.string;
+    k.len = strlen(d.value.string);
+    break;
+  default:
+    eval_error("case keys must be literals");
+  }
+  return k;
+}
+
+// The key being dispatched on, KEY_NONE when it can't match anything
+static case_key value_key(ast_node v, char *small) {
+  case_key k = {0};
+  switch (v.lit_t) {
+  case integer_t:
+  case floating_t:
+  case bool_t:
+    k = datum_key((ast_node){.type = literal_t, .lit_t = v.lit_t,
+                             .value = v.value},
+                  0);
+    break;
+  case string_t:
+    k.kind = KEY_STRING;
+    k.bytes = v.value.string;
+    k.len = strlen(v.value.string);
+    break;
+  case text_t:
+    k.kind = KEY_STRING;
+    k.bytes = text_bytes(v.value.text, small);
+    k.len = text_len(v.value.text);
+    break;
+  default:
+    break;
+  }
+  return k;
+}
+
+static bool is_else(ast_node a) {
+  return a.type == literal_t && a.lit_t == ident_t &&
+         !strcmp(a.value.ident, "else");
+}
+
+static case_table *build_jump(case_key *keys, int n, int32_t otherwise) {
+  int64_t min = keys[0].bits;
+  int64_t max = keys[0].bits;
+  for (int i = 1; i < n; i++) {
+    min = keys[i].bits < min ? keys[i].bits : min;
+    max = keys[i].bits > max ? keys[i].bits : max;
+  }
+  uint64_t span = (uint64_t)max - (uint64_t)min + 1;
+  if (!span || span > (uint64_t)n * 2 + CASE_DENSE_SLACK) {
+    return NULL;
+  }
+  case_table *t = malloc(sizeof(case_table) + sizeof(int32_t) * span);
+  *t = (case_table){.otherwise = otherwise,
+                    .min = min,
+                    .span = span,
+                    .jump = (int32_t *)(t + 1)};
+  for (uint64_t i = 0; i < span; i++) {
+    t->jump[i] = -1;
+  }
+  for (int i = 0; i < n; i++) {
+    int32_t *slot = &t->jump[(uint64_t)keys[i].bits - (uint64_t)min];
+    if (*slot < 0) {
+      *slot = keys[i].clause;
+    }
+  }
+  return t;
+}
+
+// Tries seeds until every distinct key lands in its own slot, growing the
+// table after a few misses
+static case_table *build_hash(case_key *keys, int n, int32_t otherwise) {
+  uint64_t size = 4;
+  while (size < (uint64_t)n * 2) {
+    size *= 2;
+  }
+  for (;; size *= 2) {
+    case_table *t = malloc(sizeof(case_table) + sizeof(case_key) * size);
+    for (uint64_t seed = 1; seed <= 32; seed++) {
+      *t = (case_table){.otherwise = otherwise,
+                        .seed = seed * 0x9e3779b97f4a7c15,
+                        .mask = size - 1,
+                        .slots = (case_key *)(t + 1)};
+      memset(t->slots, 0, sizeof(case_key) * size);
+      bool collided = false;
+      for (int i = 0; i < n && !collided; i++) {
+        case_key *slot = &t->slots[key_hash(&keys[i], t->seed) & t->mask];
+        if (slot->kind == KEY_NONE) {
+          *slot = keys[i];
+        } else if (!key_equals(slot, &keys[i])) {
+          collided = true;
+        }
+      }
+      if (!collided) {
+        return t;
+      }
+    }
+    free(t);
+  }
+}
+
+static case_table *build(struct ast_arr ast) {
+  int cap = 8;
+  int n = 0;
+  case_key *keys = calloc(cap, sizeof(case_key));
+  int32_t otherwise = -1;
+  for (int i = 2; i < ast.size; i++) {
+    ast_node clause = ast.child_ast[i];
+    if (clause.type != list_t || !clause.child.size) {
+      eval_error("Malformed case clause");
+    }
+    ast_node head = clause.child.child_ast[0];
+    if (is_else(head)) {
+      otherwise = otherwise < 0 ? i : otherwise;
+      continue;
+    }
+    // ((1 2 3) body...) or (1 body...)
+    int datums = head.type == list_t ? head.child.size : 1;
+    for (int j = 0; j < datums; j++) {
+      if (n == cap) {
+        cap *= 2;
+        keys = reallocarray(keys, cap, sizeof(case_key));
+      }
+      keys[n++] = datum_key(
+          head.type == list_t ? head.child.child_ast[j] : head, i);
+    }
+  }
+
+  bool integers = n > 0;
+  for (int i = 0; i < n; i++) {
+    integers = integers && keys[i].kind == KEY_INTEGER;
+  }
+  case_table *t = NULL;
+  if (integers) {
+    t = build_jump(keys, n, otherwise);
+  }
+  if (!t) {
+    t = build_hash(keys, n, otherwise);
+  }
+  free(keys);
+  return t;
+}
+
+static int32_t lookup(case_table *t, ast_node v) {
+  if (t->span) {
+    if (v.lit_t != integer_t) {
+      return t->otherwise;
+    }
+    uint64_t i = (uint64_t)v.value.integer - (uint64_t)t->min;
+    if (i >= t->span || t->jump[i] < 0) {
+      return t->otherwise;
+    }
+    return t->jump[i];
+  }
+  char small[TEXT_INLINE_MAX];
+  case_key k = value_key(v, small);
+  if (k.kind == KEY_NONE) {
+    return t->otherwise;
+  }
+  case_key *slot = &t->slots[key_hash(&k, t->seed) & t->mask];
+  return key_equals(slot, &k) ? slot->clause : t->otherwise;
+}
+
+bool case_matches(ast_node value, ast_node datum) {
+  char small[TEXT_INLINE_MAX];
+  case_key k = value_key(value, small);
+  case_key d = datum_key(datum, 0);
+  return k.kind != KEY_NONE && key_equals(&k, &d);
+}
+
+ast_node case_expr(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  // (case key ((1 2) body...) (3 body...) (else body...))
+  //  0    1   2...
+  if (ast.size < 2) {
+    eval_error("case expects a key");
+  }
+  _Atomic(void *) *site = &ast.child_ast[0].child.site;
+  case_table *t = atomic_load_explicit(site, memory_order_acquire);
+  if (!t) {
+    void *expected = NULL;
+    t = build(ast);
+    if (!atomic_compare_exchange_strong(site, &expected, t)) {
+      free(t);
+      t = expected;
+    }
+  }
+
+  ast_node result = {.type = literal_t, .lit_t = bool_t, .value.boolean = false};
+  int32_t clause = lookup(t, auto_ast_walk(ast.child_ast[1], ctx));
+  if (clause < 0) {
+    return result;
+  }
+  struct ast_arr body = ast.child_ast[clause].child;
+  for (int i = 1; i < body.size; i++) {
+    result = auto_ast_walk(body.child_ast[i], ctx);
+  }
+  return result;
+}
@@ -0,0 +1,15 @@
+#ifndef CASE_H_
+#define CASE_H_
+#include "hashmap.h"
+#include "parse.h"
+
+// Integer keys spanning at most CASE_DENSE_SLACK more values than twice
+// their count are dispatched through a jump table, anything else through
+// a perfect hash of the keys
+#define CASE_DENSE_SLACK 8
+
+ast_node case_expr(struct ast_arr ast, hashmap *ctx);
+// Whether `value` selects a clause listing `datum`, for compiled cases
+bool case_matches(ast_node value, ast_node datum);
+
+#endif // CASE_H_
@@ -0,0 +1,227 @@
+#include "closure.h"
+#include "ast_walking.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct names {
+  int size;
+  int cap;
+  char **names;
+} names;
+
+static bool listed(names *n, char *name) {
+  for (int i = 0; i < n->size; i++) {
+    if (!strcmp(n->names[i], name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void push(names *n, char *name) {
+  if (n->size == n->cap) {
+    n->cap = n->cap * 2 + 4;
+    n->names = reallocarray(n->names, n->cap, sizeof(char *));
+  }
+  n->names[n->size++] = name;
+}
+
+static char *ident_of(ast_node a) {
+  return a.type == literal_t && a.lit_t == ident_t ? a.value.ident : NULL;
+}
+
+static bool is_form(ast_node a, const char *head) {
+  if (a.type != list_t || !a.child.size) {
+    return false;
+  }
+  char *name = ident_of(a.child.child_ast[0]);
+  return name && !strcmp(name, head);
+}
+
+bool is_lambda(ast_node a) { return is_form(a, "lambda"); }
+
+static void bind_params(ast_node params, names *bound) {
+  for (int i = 0; params.type == list_t && i < params.child.size; i++) {
+    char *name = ident_of(params.child.child_ast[i]);
+    if (name) {
+      push(bound, name);
+    }
+  }
+}
+
+// Adds the names read in `a` that `bound` doesn't hold to `found`. Nested
+// lambdas and funcs bind their parameters for their own body only
+static void free_names(ast_node a, names *bound, names *found) {
+  char *name = ident_of(a);
+  if (name) {
+    if (!listed(bound, name) && !listed(found, name)) {
+      push(found, name);
+    }
+    return;
+  }
+  if (a.type != list_t || !a.child.size) {
+    return;
+  }
+  struct ast_arr c = a.child;
+  int body = 0;
+  int outer = bound->size;
+  if (is_lambda(a) && c.size > 1) {
+    bind_params(c.child_ast[1], bound);
+    body = 2;
+  } else if (is_form(a, "func") && c.size > 2) {
+    if (ident_of(c.child_ast[1])) {
+      push(bound, c.child_ast[1].value.ident);
+    }
+    bind_params(c.child_ast[2], bound);
+    body = 3;
+  } else if (ident_of(c.child_ast[0]) && is_builtin(c.child_ast[0].value.ident)) {
+    // Builtins are found before any binding, see ast_walk
+    body = 1;
+  }
+  for (int i = body; i < c.size; i++) {
+    free_names(c.child_ast[i], bound, found);
+  }
+  bound->size = outer;
+}
+
+static lambda_site *site_new(struct ast_arr form, int params) {
+  names bound = {0};
+  bind_params(form.child_ast[params], &bound);
+  int n = bound.size;
+  names found = {0};
+  for (int i = params + 1; i < form.size; i++) {
+    free_names(form.child_ast[i], &bound, &found);
+  }
+  lambda_site *s =
+      malloc(sizeof(lambda_site) + (n + found.size) * sizeof(char *));
+  s->params = n;
+  s->size = n + found.size;
+  memcpy(s->names, bound.names, n * sizeof(char *));
+  memcpy(&s->names[n], found.names, found.size * sizeof(char *));
+  free(bound.names);
+  free(found.names);
+  return s;
+}
+
+static lambda_site *site_of(struct ast_arr form, int params) {
+  _Atomic(void *) *site = &form.child_ast[0].child.site;
+  lambda_site *s = atomic_load_explicit(site, memory_order_acquire);
+  if (!s) {
+    void *expected = NULL;
+    s = site_new(form, params);
+    if (!atomic_compare_exchange_strong(site, &expected, s)) {
+      free(s);
+      s = expected;
+    }
+  }
+  return s;
+}
+
+// Only call frames are searched, names found past them are globals
+static pair *frame_find(hashmap *ctx, char *name) {
+  for (; ctx->slots; ctx = ctx->parent) {
+    pair *p = hashmap_find(ctx, name);
+    if (p) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+ast_node closure_new(struct ast_arr form, int params, char *name,
+                     hashmap *ctx, closure_buf *stack) {
+  if (form.size <= params + 1 || form.child_ast[params].type != list_t) {
+    eval_error("%s expects a parameter list and a body",
+               form.child_ast[0].value.ident);
+  }
+  lambda_site *s = site_of(form, params);
+  // Closures used in place are done before anything else is bound
+  bool late = !stack && ctx->slots;
+  captured found[s->size - s->params + 1];
+  int n = 0;
+  for (int i = s->params; i < s->size; i++) {
+    pair *p = frame_find(ctx, s->names[i]);
+    if (p) {
+      found[n++] = (captured){p->key, p->value};
+    } else if (late) {
+      found[n++] = (captured){s->names[i], {.type = tombstone_t}};
+    }
+  }
+
+  size_t size = sizeof(closure) + n * sizeof(captured);
+  closure *c = stack && size <= sizeof(closure_buf) ? (closure *)stack
+                                                    : heap_alloc(size, NULL);
+  c->site = s;
+  c->body = (struct ast_arr){.child_ast = &form.child_ast[params + 1],
+                             .size = form.size - params - 1,
+                             .cap = form.size - params - 1};
+  c->name = name;
+  c->memo = NULL;
+  c->size = n;
+  memcpy(c->captured, found, n * sizeof(captured));
+  return (ast_node){.type = literal_t, .lit_t = closure_t, .value.closure = c};
+}
+
+void closure_late_bind(hashmap *ctx, char *name, ast_node value) {
+  for (; ctx->slots; ctx = ctx->parent) {
+    for (int i = 0; i < ctx->capacity; i++) {
+      pair p = ctx->array[i];
+      if (!p.key || (uint64_t)p.key == TOMBSTONE || p.value.type == list_t ||
+          p.value.lit_t != closure_t) {
+        continue;
+      }
+      closure *c = p.value.value.closure;
+      for (int j = 0; j < c->size; j++) {
+        if (c->captured[j].value.type == tombstone_t &&
+            !strcmp(c->captured[j].name, name)) {
+          c->captured[j].value = value;
+        }
+      }
+    }
+  }
+}
+
+ast_node function_arg(struct ast_arr ast, int i, hashmap *ctx,
+                      closure_buf *stack) {
+  if (i >= ast.size) {
+    eval_error("%s expects a function as argument %d",
+               ast.child_ast[0].value.ident, i);
+  }
+  ast_node a = ast.child_ast[i];
+  if (ident_of(a)) {
+    return a;
+  }
+  ast_node f = is_lambda(a) ? closure_new(a.child, 1, NULL, ctx, stack)
+                            : auto_ast_walk(a, ctx);
+  if (!is_function(f)) {
+    eval_error("%s expects a function as argument %d",
+               ast.child_ast[0].value.ident, i);
+  }
+  return f;
+}
+
+ast_node function_value(struct ast_arr ast, int i, hashmap *ctx) {
+  ast_node f = function_arg(ast, i, ctx, NULL);
+  if (ident_of(f)) {
+    f = get_ident(ctx, f.value.ident);
+    if (!is_function(f)) {
+      eval_error("%s expects a function as argument %d",
+                 ast.child_ast[0].value.ident, i);
+    }
+  }
+  return f;
+}
+
+ast_node lambda(struct ast_arr ast, hashmap *ctx) {
+  // (lambda (a b) body ...), the value of the last body form is returned
+  //  0      1     2...
+  assert(ast.child_ast[0].lit_t == ident_t);
+  return closure_new(ast, 1, NULL, ctx, NULL);
+}
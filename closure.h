@@ -0,0 +1,64 @@
+#ifndef CLOSURE_H_
+#define CLOSURE_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <stdalign.h>
+#include <stddef.h>
+
+// Names a lambda reads from outside, found once per lambda form and kept
+// in the site of its head
+typedef struct lambda_site {
+  int params; // names[0, params) are the parameters
+  int size;   // names[params, size) are free in the body
+  char *names[];
+} lambda_site;
+
+typedef struct captured {
+  char *name;
+  ast_node value;
+} captured;
+
+// Closures are flat: creating one copies the values of the free names
+// bound in the creating call frame, and nothing else. Globals aren't
+// copied, calls see them through the frame's parent, see ast_walk. No
+// closure points at a frame, so frames never outlive their call.
+// A closure kept past its creation also holds its free names not yet
+// bound, as tombstones, so funcs defined later in the same call can still
+// be called from it, see closure_late_bind
+typedef struct closure {
+  lambda_site *site;
+  struct ast_arr body;
+  char *name; // a func defined in a call, bound to itself when called
+  struct memo *memo; // set by defmemo, `name` is then bound to the memo
+  int size;
+  captured captured[];
+} closure;
+
+// Enough for a closure capturing a few names. Builtins that only call a
+// function argument before returning keep a lambda written in place here
+// instead of on the heap, as ast_walk does for ((lambda ...) args)
+#define CLOSURE_STACK_CAPTURES 8
+typedef struct closure_buf {
+  alignas(max_align_t) char bytes[sizeof(closure) +
+                                  CLOSURE_STACK_CAPTURES * sizeof(captured)];
+} closure_buf;
+
+bool is_lambda(ast_node);
+// `form` is a lambda or func, its parameter list at `params`. `stack` may
+// be NULL, the closure is then heap allocated
+ast_node closure_new(struct ast_arr form, int params, char *name,
+                     hashmap *ctx, closure_buf *stack);
+// Fills `name` in the closures bound in the call frames of `ctx` that
+// were made before it was bound, for a func defined in a call
+void closure_late_bind(hashmap *ctx, char *name, ast_node value);
+// Argument `i` of a builtin taking a function, as the head of the calls
+// it builds. Names are left to be looked up by each call
+ast_node function_arg(struct ast_arr ast, int i, hashmap *ctx,
+                      closure_buf *stack);
+// Argument `i` as a function value that can be kept past the call. Names
+// are looked up now, the frame holding them may be gone when it's called
+ast_node function_value(struct ast_arr ast, int i, hashmap *ctx);
+
+ast_node lambda(struct ast_arr ast, hashmap *ctx);
+
+#endif // CLOSURE_H_
@@ -0,0 +1,363 @@
+#include "effects.h"
+#include "ast_walking.h"
+#include "closure.h"
+#include "hashmap.h"
+#include "parse.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNBOUNDED INT64_MAX
+
+typedef struct effect {
+  bool pure;
+  int64_t cost;
+} effect;
+
+static const effect impure = {false, 0};
+
+// Builtins that only make a value from their operands, the operands are
+// analysed on their own
+static const char *pure_builtins[] = {
+    "+",              "-",               "*",              "/",
+    "<",              "average",         "abs",            "begin",
+    "if",             "make-vector",     "vector",         "vector-length",
+    "vector-ref",     "vector+",         "vector-",        "vector*",
+    "vector/",        "vector-sum",      "vector-dot",     "vector-min",
+    "vector-max",     "vector-scale",    "binary-search",  "unique",
+    "cons",           "car",             "cdr",            "list",
+    "length",         "null?",           "string-append",  "substring",
+    "string-length",  "string->number",  "string-index",   "string-contains",
+    "string-split",   "string-count",    "stream-range",   "stream-take"};
+
+typedef struct names {
+  int size;
+  int cap;
+  char **names;
+} names;
+
+static bool listed(names *n, char *name) {
+  for (int i = 0; n && i < n->size; i++) {
+    if (!strcmp(n->names[i], name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void push(names *n, char *name) {
+  if (n->size == n->cap) {
+    n->cap = n->cap * 2 + 4;
+    n->names = reallocarray(n->names, n->cap, sizeof(char *));
+  }
+  n->names[n->size++] = name;
+}
+
+// A function analysed, or being analysed when not `done`
+typedef struct known {
+  const void *id;
+  bool done;
+  effect e;
+} known;
+
+typedef struct analysis {
+  hashmap *globals;
+  known *known;
+  int size;
+  int cap;
+} analysis;
+
+static char *ident_of(ast_node a) {
+  return a.type == literal_t && a.lit_t == ident_t ? a.value.ident : NULL;
+}
+
+static bool is(char *name, const char *builtin) {
+  return !strcmp(name, builtin);
+}
+
+static effect combine(effect a, effect b) {
+  int64_t cost;
+  if (__builtin_add_overflow(a.cost, b.cost, &cost)) {
+    cost = UNBOUNDED;
+  }
+  return (effect){a.pure && b.pure, cost};
+}
+
+// The names a function binds in its own frame, wherever they are bound
+static void bound_names(ast_node a, names *n) {
+  if (a.type != list_t || !a.child.size) {
+    return;
+  }
+  struct ast_arr c = a.child;
+  char *head = ident_of(c.child_ast[0]);
+  if (head && c.size > 1 &&
+      (is(head, "var") || is(head, "const") || is(head, "func") ||
+       is(head, "defmemo")) &&
+      ident_of(c.child_ast[1])) {
+    push(n, c.child_ast[1].value.ident);
+  }
+  if (head && is(head, "do") && c.size > 1 && c.child_ast[1].type == list_t) {
+    struct ast_arr bindings = c.child_ast[1].child;
+    for (int i = 0; i < bindings.size; i++) {
+      ast_node b = bindings.child_ast[i];
+      if (b.type == list_t && b.child.size && ident_of(b.child.child_ast[0])) {
+        push(n, b.child.child_ast[0].value.ident);
+      }
+    }
+  }
+  for (int i = 0; i < c.size; i++) {
+    bound_names(c.child_ast[i], n);
+  }
+}
+
+static effect walk(analysis *an, ast_node a, names *locals);
+
+static effect walk_from(analysis *an, struct ast_arr c, int from,
+                        names *locals) {
+  effect e = {true, 1};
+  for (int i = from; i < c.size && e.pure; i++) {
+    e = combine(e, walk(an, c.child_ast[i], locals));
+  }
+  return e;
+}
+
+// Every element of each clause from `from` on
+static effect walk_clauses(analysis *an, struct ast_arr c, int first,
+                           int from, names *locals) {
+  effect e = {true, 1};
+  for (int i = first; i < c.size && e.pure; i++) {
+    if (c.child_ast[i].type != list_t) {
+      return impure;
+    }
+    e = combine(e, walk_from(an, c.child_ast[i].child, from, locals));
+  }
+  return e;
+}
+
+// `locals` is NULL for an operand, which runs in the caller's frame and
+// must bind nothing there
+static effect builtin_effect(analysis *an, struct ast_arr c, char *head,
+                             names *locals) {
+  if (is(head, "lambda")) {
+    // Its body runs when it's called, and calls through values are impure
+    return (effect){true, 1};
+  }
+  if (is(head, "var") || is(head, "const")) {
+    return locals && c.size == 3 ? walk_from(an, c, 2, locals) : impure;
+  }
+  if (is(head, "func")) {
+    return locals ? (effect){true, 1} : impure;
+  }
+  if (is(head, "do")) {
+    if (!locals || c.size < 3 || c.child_ast[2].type != list_t) {
+      return impure;
+    }
+    effect e = walk_clauses(an, c, 1, 1, locals);
+    if (e.pure) {
+      e = combine(e, walk_from(an, c.child_ast[2].child, 0, locals));
+      e = combine(e, walk_from(an, c, 3, locals));
+    }
+    e.cost = UNBOUNDED;
+    return e;
+  }
+  if (is(head, "while")) {
+    effect e = walk_from(an, c, 1, locals);
+    e.cost = UNBOUNDED;
+    return e;
+  }
+  if (is(head, "cond")) {
+    return walk_clauses(an, c, 1, 0, locals);
+  }
+  if (is(head, "case")) {
+    // Each clause starts with data, not an expression
+    if (c.size < 2) {
+      return impure;
+    }
+    effect e = walk(an, c.child_ast[1], locals);
+    return e.pure ? combine(e, walk_clauses(an, c, 2, 1, locals)) : e;
+  }
+  for (size_t i = 0; i < sizeof(pure_builtins) / sizeof(char *); i++) {
+    if (is(head, pure_builtins[i])) {
+      return walk_from(an, c, 1, locals);
+    }
+  }
+  return impure;
+}
+
+// Calling `f`, the value of a global name. A recursive call is taken as
+// pure and unbounded while the function it's in is still being analysed
+static effect function_effect(analysis *an, ast_node f) {
+  const void *id;
+  names locals = {0};
+  struct ast_arr body;
+  ast_node form;
+  if (f.type == function_t) {
+    id = f.value.params;
+    for (char **p = f.value.params; *p; p++) {
+      push(&locals, *p);
+    }
+    form = (ast_node){.type = list_t, .child = f.child};
+    body = (struct ast_arr){.child_ast = &form, .size = 1, .cap = 1};
+  } else if (f.type != list_t && f.lit_t == closure_t &&
+             !f.value.closure->memo) {
+    closure *c = f.value.closure;
+    id = c;
+    for (int i = 0; i < c->site->params; i++) {
+      push(&locals, c->site->names[i]);
+    }
+    for (int i = 0; i < c->size; i++) {
+      if (c->captured[i].value.type != tombstone_t) {
+        push(&locals, c->captured[i].name);
+      }
+    }
+    if (c->name) {
+      push(&locals, c->name);
+    }
+    body = c->body;
+  } else {
+    return impure;
+  }
+
+  for (int i = 0; i < an->size; i++) {
+    if (an->known[i].id == id) {
+      free(locals.names);
+      return an->known[i].done ? an->known[i].e : (effect){true, UNBOUNDED};
+    }
+  }
+  if (an->size == an->cap) {
+    an->cap = an->cap * 2 + 4;
+    an->known = reallocarray(an->known, an->cap, sizeof(known));
+  }
+  int self = an->size++;
+  an->known[self] = (known){.id = id};
+
+  for (int i = 0; i < body.size; i++) {
+    bound_names(body.child_ast[i], &locals);
+  }
+  effect e = walk_from(an, body, 0, &locals);
+  free(locals.names);
+  if (!e.pure) {
+    // Functions analysed since took this one to be pure
+    an->size = self + 1;
+  }
+  an->known[self] = (known){.id = id, .done = true, .e = e};
+  return e;
+}
+
+static effect walk(analysis *an, ast_node a, names *locals) {
+  if (a.type != list_t || !a.child.size) {
+    return (effect){true, 1};
+  }
+  struct ast_arr c = a.child;
+  char *head = ident_of(c.child_ast[0]);
+  if (!head) {
+    return impure;
+  }
+  // Builtins are found before any binding, see ast_walk
+  if (is_builtin(head)) {
+    return builtin_effect(an, c, head, locals);
+  }
+  if (listed(locals, head)) {
+    return impure;
+  }
+  effect e = function_effect(an, hashmap_get(an->globals, head));
+  return e.pure ? combine(e, walk_from(an, c, 1, locals)) : e;
+}
+
+// Whether `a` calls a name that a frame could bind, see effects_unshadowed
+static bool calls_by_name(ast_node a) {
+  if (a.type != list_t || !a.child.size) {
+    return false;
+  }
+  char *head = ident_of(a.child.child_ast[0]);
+  if (head && is(head, "lambda")) {
+    return false;
+  }
+  if (head && !is_builtin(head)) {
+    return true;
+  }
+  for (int i = 1; i < a.child.size; i++) {
+    if (calls_by_name(a.child.child_ast[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t effects_plan(struct ast_arr call, hashmap *ctx) {
+  if (call.size - 1 > EFFECTS_MAX_OPERANDS) {
+    return 0;
+  }
+  analysis an = {.globals = globals(ctx)};
+  uint32_t costly = 0;
+  int count = 0;
+  for (int i = 1; i < call.size; i++) {
+    effect e = walk(&an, call.child_ast[i], NULL);
+    if (!e.pure) {
+      count = 0;
+      break;
+    }
+    if (e.cost >= EFFECTS_MIN_COST) {
+      costly |= 1u << i;
+      count++;
+    }
+  }
+  free(an.known);
+  if (count < 2) {
+    return 0;
+  }
+  for (int i = 1; i < call.size; i++) {
+    if (calls_by_name(call.child_ast[i])) {
+      return costly | 1;
+    }
+  }
+  return costly;
+}
+
+static bool in_frame(hashmap *ctx, char *name) {
+  for (; ctx->slots; ctx = ctx->parent) {
+    if (hashmap_find(ctx, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool effects_unshadowed(ast_node a, hashmap *ctx) {
+  if (!ctx->slots || a.type != list_t || !a.child.size) {
+    return true;
+  }
+  char *head = ident_of(a.child.child_ast[0]);
+  if (head && is(head, "lambda")) {
+    return true;
+  }
+  if (head && !is_builtin(head) && in_frame(ctx, head)) {
+    return false;
+  }
+  for (int i = 1; i < a.child.size; i++) {
+    if (!effects_unshadowed(a.child.child_ast[i], ctx)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Server requests bind names in layers over the same globals, their
+// plans follow one count
+static hashmap *root(hashmap *ctx) {
+  while (ctx->parent) {
+    ctx = ctx->parent;
+  }
+  return ctx;
+}
+
+uint64_t effects_epoch(hashmap *ctx) {
+  return atomic_load_explicit(&root(ctx)->epoch, memory_order_acquire);
+}
+
+void effects_rebind(hashmap *globals, char *name, ast_node value) {
+  if (is_function(value) || is_function(hashmap_get(globals, name))) {
+    atomic_fetch_add_explicit(&root(globals)->epoch, 1,
+                              memory_order_release);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef EFFECTS_H_
+#define EFFECTS_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Effect analysis, so the operands of arithmetic and comparisons can be
+// evaluated in parallel without changing what a program does.
+// An expression is pure when evaluating it changes nothing another one can
+// see: it binds no names where it runs, writes no vector, starts no
+// futures and keeps no state, like a memo's cache or a generator's place.
+// Pure siblings can then run in any order, or all at once, and give the
+// same values. Calls are followed into functions bound to global names,
+// a function is pure when its body is, with its parameters and the names
+// it binds kept to its own frame. Anything the analysis can't see into,
+// such as a call through a parameter or a closure's captured name, is
+// impure.
+// The cost of an expression is the number of forms it evaluates, loops
+// and recursive calls making it unbounded. Only operands costing at least
+// EFFECTS_MIN_COST are worth a task, and only when every operand is pure
+// and at least two are that costly
+#define EFFECTS_MIN_COST 1000
+// Calls with more operands always run in order
+#define EFFECTS_MAX_OPERANDS 15
+// Every level of a recursion like fib's is unbounded too, tasks deep in it
+// would cost more to start than they save. Operands only run as tasks in
+// calls nested in fewer than EFFECTS_MAX_TASK_DEPTH others whose operands
+// did, see eval_task_depth. Calls that ran theirs in order don't count,
+// so down any one path through fib at most 8 calls start tasks, but how
+// many tasks it makes in all depends on when the pool had idle workers
+#define EFFECTS_MAX_TASK_DEPTH 8
+
+// The operands of `call` to evaluate as tasks, bit i set for operand i,
+// planned as if made in `ctx`. Zero when they should all run in order.
+// Bit 0 is set when an operand calls a name, the plan then only holds
+// where effects_unshadowed
+uint32_t effects_plan(struct ast_arr call, hashmap *ctx);
+// A plan assumes every call in an operand is to a global, false when one
+// is instead to a name bound in the call frame `ctx`
+bool effects_unshadowed(ast_node operand, hashmap *ctx);
+
+// Plans also assume what the functions bound to global names do. Binding
+// a global to a function, or replacing one, starts a new epoch and plans
+// made in an earlier one must be made again. Each interpreter counts its
+// own, in the root of the environment `ctx` is in
+uint64_t effects_epoch(hashmap *ctx);
+void effects_rebind(hashmap *globals, char *name, ast_node value);
+
+#endif // EFFECTS_H_
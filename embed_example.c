@@ -0,0 +1,37 @@
+// Runs one interpreter per thread, built with `make embed_example`
+#include "interp.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define THREADS 4
+
+static void *worker(void *arg) {
+  long id = (long)arg;
+  interp *in = interp_new();
+  interp_eval_string(in, "(func fib (n) (if (< n 2) n (+ (fib (- n 1)) "
+                         "(fib (- n 2)))))");
+  char source[64];
+  snprintf(source, sizeof(source), "(fib %ld)", 20 + id);
+  const char *result = interp_eval_string(in, source);
+  printf("thread %ld: (fib %ld) = %s\n", id, 20 + id, result);
+
+  // An error only ends the call that raised it
+  if (!interp_eval_string(in, "(car (list))")) {
+    printf("thread %ld: error: %s\n", id, interp_error(in));
+  }
+  printf("thread %ld: still usable: %s\n", id,
+         interp_eval_string(in, "(fib 10)"));
+  interp_free(in);
+  return NULL;
+}
+
+int main(void) {
+  pthread_t threads[THREADS];
+  for (long i = 0; i < THREADS; i++) {
+    pthread_create(&threads[i], NULL, worker, (void *)i);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  return 0;
+}
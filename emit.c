@@ -0,0 +1,1261 @@
+#include "emit.h"
+#include "ast_walking.h"
+#include "parse.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Static types. A slot only ever moves up, from T_NONE (nothing stored in
+// it yet) to one of the unboxed types and on to T_ANY once it has held two
+// different ones, so inference stops after a few passes
+typedef enum type { T_NONE, T_INT, T_FLOAT, T_BOOL, T_ANY } type;
+
+static const char *ctype[] = {"ast_node", "int64_t", "double", "bool",
+                              "ast_node"};
+// rt_<boxed>() and rt_as_<boxed>() convert from and to ast_node
+static const char *boxed[] = {"", "int", "float", "bool", ""};
+
+// A name bound by var, const or do, or a parameter
+typedef struct slot {
+  char *name;
+  type t;
+  bool constant;
+  bool shared; // a global read by interpreted code
+  int binds;   // binding forms naming it
+} slot;
+
+typedef struct scope {
+  slot *slots;
+  int size;
+  int cap;
+} scope;
+
+typedef struct function {
+  char *name;
+  ast_node form; // (func name (params) body)
+  int params;    // the first `params` locals
+  scope locals;
+  type ret;
+} function;
+
+typedef struct emitter {
+  function *funcs;
+  int funcs_size;
+  int funcs_cap;
+  scope globals;
+  function *current; // NULL at the top level
+  char **builtins;   // B[i] in the output
+  int builtins_size;
+  int builtins_cap;
+  FILE *data;     // arrays of the embedded forms
+  FILE *embedded; // E[i], the embedded forms
+  FILE *heads;    // H[i], the head of each builtin call
+  int arrays;
+  int forms;
+  int calls;
+  int temps;
+  bool final; // false while inferring, output is thrown away
+  bool changed;
+  bool mirror; // interpreted code runs, so it must see shared globals
+} emitter;
+
+// Code for an expression and its static type
+typedef struct code {
+  char *text;
+  type t;
+} code;
+
+static type expr(emitter *, ast_node, FILE *);
+
+static void fail(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "--emit-c: ");
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  exit(1);
+}
+
+static char *ident_of(ast_node a) {
+  return a.type == literal_t && a.lit_t == ident_t ? a.value.ident : NULL;
+}
+
+static char *head(ast_node a) {
+  return a.type == list_t && a.child.size ? ident_of(a.child.child_ast[0])
+                                          : NULL;
+}
+
+static bool is(ast_node a, const char *name) {
+  char *h = head(a);
+  return h && !strcmp(h, name);
+}
+
+static type join(type a, type b) {
+  if (a == T_NONE || a == b) {
+    return b;
+  }
+  return b == T_NONE ? a : T_ANY;
+}
+
+static void widen(emitter *e, type *t, type with) {
+  type j = join(*t, with);
+  if (j != *t) {
+    *t = j;
+    e->changed = true;
+  }
+}
+
+static slot *find(scope *s, char *name) {
+  for (int i = 0; i < s->size; i++) {
+    if (!strcmp(s->slots[i].name, name)) {
+      return &s->slots[i];
+    }
+  }
+  return NULL;
+}
+
+static slot *declare(scope *s, char *name, bool constant) {
+  slot *found = find(s, name);
+  if (!found) {
+    if (s->size == s->cap) {
+      s->cap = s->cap ? s->cap * 2 : 8;
+      s->slots = reallocarray(s->slots, s->cap, sizeof(slot));
+    }
+    found = &s->slots[s->size++];
+    *found = (slot){.name = name};
+  }
+  found->binds++;
+  found->constant |= constant;
+  return found;
+}
+
+static function *find_function(emitter *e, char *name) {
+  for (int i = 0; i < e->funcs_size; i++) {
+    if (!strcmp(e->funcs[i].name, name)) {
+      return &e->funcs[i];
+    }
+  }
+  return NULL;
+}
+
+// Locals shadow globals, like the copied context of an interpreted call
+static slot *resolve(emitter *e, char *name, bool *global) {
+  slot *s = e->current ? find(&e->current->locals, name) : NULL;
+  *global = !s;
+  return s ? s : find(&e->globals, name);
+}
+
+static void cname(FILE *out, char prefix, const char *name) {
+  fprintf(out, "%c_", prefix);
+  for (; *name; name++) {
+    if (isalnum((unsigned char)*name)) {
+      fputc(*name, out);
+    } else {
+      fprintf(out, "_%02x", (unsigned char)*name);
+    }
+  }
+}
+
+static void c_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (isprint(c)) {
+      fputc(c, out);
+    } else {
+      fprintf(out, "\\%03o", c);
+    }
+  }
+  fputc('"', out);
+}
+
+static code compile(emitter *e, ast_node a) {
+  code c;
+  size_t len;
+  FILE *out = open_memstream(&c.text, &len);
+  c.t = expr(e, a, out);
+  fclose(out);
+  return c;
+}
+
+
+
+// Compiles the forms from `from` on, the caller frees the array
+static code *compile_args(emitter *e, struct ast_arr ast, int from) {
+  code *args = calloc(ast.size - from + 1, sizeof(code));
+  for (int i = from; i < ast.size; i++) {
+    args[i - from] = compile(e, ast.child_ast[i]);
+  }
+  return args;
+}
+
+static code text_code(type t, const char *fmt, ...) {
+  code c = {.t = t};
+  size_t len;
+  FILE *out = open_memstream(&c.text, &len);
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(out, fmt, args);
+  va_end(args);
+  fclose(out);
+  return c;
+}
+
+static code name_code(bool global, char *name, type t) {
+  code c = {.t = t};
+  size_t len;
+  FILE *out = open_memstream(&c.text, &len);
+  cname(out, global ? 'g' : 'l', name);
+  fclose(out);
+  return c;
+}
+
+// Writes and frees `c`, converted to `to`
+static void put(FILE *out, code c, type to) {
+  type from = c.t == T_NONE ? T_ANY : c.t;
+  to = to == T_NONE ? T_ANY : to;
+  if (from == to) {
+    fputs(c.text, out);
+  } else if (to == T_ANY) {
+    fprintf(out, "rt_%s(%s)", boxed[from], c.text);
+  } else if (from == T_ANY) {
+    fprintf(out, "rt_as_%s(%s)", boxed[to], c.text);
+  } else if (from == T_INT && to == T_FLOAT) {
+    fprintf(out, "((double)%s)", c.text);
+  } else {
+    fprintf(out, "rt_as_%s(rt_%s(%s))", boxed[to], boxed[from], c.text);
+  }
+  free(c.text);
+}
+
+// Evaluated for its effects only
+static void statement(FILE *out, code c) {
+  fprintf(out, "(void)(%s); ", c.text);
+  free(c.text);
+}
+
+static void test(FILE *out, code c, const char *message) {
+  if (c.t == T_BOOL) {
+    fprintf(out, "(%s)", c.text);
+    free(c.text);
+    return;
+  }
+  fputs("rt_test(", out);
+  put(out, c, T_ANY);
+  fputs(", ", out);
+  c_string(out, message);
+  fputs(")", out);
+}
+
+// Forms in order, the value of the last one, or false if there are none
+static code sequence(emitter *e, ast_node *forms, int n) {
+  if (!n) {
+    return text_code(T_BOOL, "false");
+  }
+  code c;
+  size_t len;
+  FILE *out = open_memstream(&c.text, &len);
+  fputs("({ ", out);
+  for (int i = 0; i < n - 1; i++) {
+    statement(out, compile(e, forms[i]));
+  }
+  code last = compile(e, forms[n - 1]);
+  c.t = last.t;
+  fprintf(out, "%s; })", last.text);
+  free(last.text);
+  fclose(out);
+  return c;
+}
+
+static type variable(emitter *e, char *name, FILE *out) {
+  bool global;
+  slot *s = resolve(e, name, &global);
+  if (s) {
+    cname(out, global ? 'g' : 'l', name);
+    return s->t;
+  }
+  if (find_function(e, name)) {
+    fputs("rt_get(", out);
+    c_string(out, name);
+    fputs(")", out);
+    return T_ANY;
+  }
+  fail("No variable associated with identifier %s", name);
+  return T_ANY;
+}
+
+// Stores `value` in `name` as a statement
+static void assign(emitter *e, char *name, code value, FILE *out) {
+  bool global;
+  slot *s = resolve(e, name, &global);
+  if (!s) {
+    fail("%s is bound somewhere it can't be compiled", name);
+  }
+  widen(e, &s->t, value.t);
+  cname(out, global ? 'g' : 'l', name);
+  fputs(" = ", out);
+  put(out, value, s->t);
+  fputs("; ", out);
+  if (global && s->shared && e->mirror) {
+    fputs("rt_define(", out);
+    c_string(out, name);
+    fputs(", ", out);
+    put(out, name_code(true, name, s->t), T_ANY);
+    fprintf(out, ", %s); ", s->constant ? "true" : "false");
+  }
+}
+
+static int builtin_slot(emitter *e, char *name) {
+  for (int i = 0; i < e->builtins_size; i++) {
+    if (!strcmp(e->builtins[i], name)) {
+      return i;
+    }
+  }
+  if (e->builtins_size == e->builtins_cap) {
+    e->builtins_cap = e->builtins_cap ? e->builtins_cap * 2 : 16;
+    e->builtins = reallocarray(e->builtins, e->builtins_cap, sizeof(char *));
+  }
+  e->builtins[e->builtins_size] = name;
+  return e->builtins_size++;
+}
+
+// Each call gets its own head node, H[i] in the output, which keeps the
+// builtin's data for that call site
+static int call_head(emitter *e, char *name) {
+  if (!e->final) {
+    return 0;
+  }
+  fputs("    {.type = literal_t, .lit_t = ident_t, .value.ident = ", e->heads);
+  c_string(e->heads, name);
+  fputs("},\n", e->heads);
+  return e->calls++;
+}
+
+// Builtins whose result always has the same type
+static const struct {
+  const char *name;
+  type t;
+  const char *field;
+} results[] = {
+    {"<", T_BOOL, "boolean"},
+    {"average", T_FLOAT, "floating"},
+    {"vector-length", T_INT, "integer"},
+    {"binary-search", T_INT, "integer"},
+    {"length", T_INT, "integer"},
+    {"null?", T_BOOL, "boolean"},
+    {"string-length", T_INT, "integer"},
+    {"string-index", T_INT, "integer"},
+    {"string-contains", T_INT, "integer"},
+    {"string-count", T_INT, "integer"},
+};
+
+// Calls a builtin with evaluated arguments, frees `args`
+static type apply(emitter *e, char *name, code *args, int n, FILE *out) {
+  fprintf(out, "rt_apply(B[%d], &H[%d], %d, (ast_node[]){{0}",
+          builtin_slot(e, name), call_head(e, name), n + 1);
+  for (int i = 0; i < n; i++) {
+    fputs(", ", out);
+    put(out, args[i], T_ANY);
+  }
+  fputs("})", out);
+  free(args);
+  for (size_t i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+    if (!strcmp(results[i].name, name)) {
+      fprintf(out, ".value.%s", results[i].field);
+      return results[i].t;
+    }
+  }
+  return T_ANY;
+}
+
+// Builtins taking the name of a function, and which argument it is
+static const struct {
+  const char *name;
+  int arg;
+} by_name[] = {{"map", 1},        {"fold", 1},          {"pmap", 1},
+               {"sort-by", 2},    {"stream-map", 1},    {"stream-filter", 1},
+               {"stream-fold", 1}};
+
+static type builtin_call(emitter *e, struct ast_arr ast, FILE *out) {
+  char *name = ast.child_ast[0].value.ident;
+  int named = 0;
+  for (size_t i = 0; i < sizeof(by_name) / sizeof(by_name[0]); i++) {
+    if (!strcmp(by_name[i].name, name)) {
+      named = by_name[i].arg;
+    }
+  }
+  code *args = calloc(ast.size, sizeof(code));
+  for (int i = 1; i < ast.size; i++) {
+    if (i != named) {
+      args[i - 1] = compile(e, ast.child_ast[i]);
+      continue;
+    }
+    char *f = ident_of(ast.child_ast[i]);
+    if (!f) {
+      fail("%s expects the name of a function as argument %d", name, i);
+    }
+    args[i - 1] = text_code(T_ANY, "rt_ident(\"%s\")", f);
+    // The function runs interpreted
+    e->mirror = true;
+  }
+  return apply(e, name, args, ast.size - 1, out);
+}
+
+static bool numeric(type t) { return t == T_NONE || t == T_INT || t == T_FLOAT; }
+
+static type arith(emitter *e, struct ast_arr ast, FILE *out) {
+  // (+ a b ...) folds left in C when every argument is a number. Like the
+  // builtin, it stays integer until the first float
+  char *op = ast.child_ast[0].value.ident;
+  int n = ast.size - 1;
+  code *args = compile_args(e, ast, 1);
+  bool native = n > 0;
+  bool unknown = false;
+  for (int i = 0; i < n; i++) {
+    native = native && numeric(args[i].t);
+    unknown = unknown || args[i].t == T_NONE;
+  }
+  if (!native || (unknown && e->final)) {
+    return apply(e, op, args, n, out);
+  }
+  if (unknown) {
+    for (int i = 0; i < n; i++) {
+      free(args[i].text);
+    }
+    free(args);
+    return T_NONE;
+  }
+  code acc = args[0];
+  for (int i = 1; i < n; i++) {
+    type t = acc.t == T_INT && args[i].t == T_INT ? T_INT : T_FLOAT;
+    size_t len;
+    char *text;
+    FILE *f = open_memstream(&text, &len);
+    if (t == T_INT) {
+      // Checked, compiled code has no bignums, see runtime.h
+      fprintf(f, "rt_%s(", *op == '+'   ? "add"
+                           : *op == '-' ? "sub"
+                           : *op == '*' ? "mul"
+                                        : "div");
+      put(f, acc, t);
+      fputs(", ", f);
+    } else {
+      fputs("(", f);
+      put(f, acc, t);
+      fprintf(f, " %s ", op);
+    }
+    put(f, args[i], t);
+    fputs(")", f);
+    fclose(f);
+    acc = (code){.text = text, .t = t};
+  }
+  type t = acc.t;
+  put(out, acc, t);
+  free(args);
+  return t;
+}
+
+static type less(emitter *e, struct ast_arr ast, FILE *out) {
+  // Integers compare as integers, as doubles if either is a float
+  int n = ast.size - 1;
+  code *args = compile_args(e, ast, 1);
+  if (n != 2 || !numeric(args[0].t) || !numeric(args[1].t)) {
+    return apply(e, "<", args, n, out);
+  }
+  type t = join(args[0].t, args[1].t) == T_INT ? T_INT : T_FLOAT;
+  fputs("(", out);
+  put(out, args[0], t);
+  fputs(" < ", out);
+  put(out, args[1], t);
+  fputs(")", out);
+  free(args);
+  return T_BOOL;
+}
+
+static type abs_form(emitter *e, struct ast_arr ast, FILE *out) {
+  int n = ast.size - 1;
+  code *args = compile_args(e, ast, 1);
+  if (n != 1 || (args[0].t != T_INT && args[0].t != T_NONE)) {
+    return apply(e, "abs", args, n, out);
+  }
+  fputs("labs(", out);
+  put(out, args[0], T_INT);
+  fputs(")", out);
+  free(args);
+  return T_INT;
+}
+
+static type bind(emitter *e, struct ast_arr ast, FILE *out) {
+  // (var name value), (const name value)
+  char *name = ast.size == 3 ? ident_of(ast.child_ast[1]) : NULL;
+  if (!name) {
+    fail("Malformed %s", ast.child_ast[0].value.ident);
+  }
+  fputs("({ ", out);
+  assign(e, name, compile(e, ast.child_ast[2]), out);
+  type t = variable(e, name, out);
+  fputs("; })", out);
+  return t;
+}
+
+static type begin_form(emitter *e, struct ast_arr ast, FILE *out) {
+  code c = sequence(e, &ast.child_ast[1], ast.size - 1);
+  type t = c.t;
+  put(out, c, t);
+  return t;
+}
+
+static type func_form(emitter *e, struct ast_arr ast, FILE *out) {
+  // Compiled with the other functions, its value is the interpreted one
+  fputs("rt_get(", out);
+  c_string(out, ast.child_ast[1].value.ident);
+  fputs(")", out);
+  return T_ANY;
+}
+
+static type if_form(emitter *e, struct ast_arr ast, FILE *out) {
+  if (ast.size != 4) {
+    fail("if expects a condition, a then and an else branch");
+  }
+  code condition = compile(e, ast.child_ast[1]);
+  code then = compile(e, ast.child_ast[2]);
+  code otherwise = compile(e, ast.child_ast[3]);
+  type t = join(then.t, otherwise.t);
+  fputs("(", out);
+  test(out, condition, "If expression condition must be of type bool");
+  fputs(" ? ", out);
+  put(out, then, t);
+  fputs(" : ", out);
+  put(out, otherwise, t);
+  fputs(")", out);
+  return t;
+}
+
+static type while_form(emitter *e, struct ast_arr ast, FILE *out) {
+  // (while condition body...), false if the body never runs
+  if (ast.size < 2) {
+    fail("Malformed while loop");
+  }
+  code condition = compile(e, ast.child_ast[1]);
+  int n = ast.size - 2;
+  code *body = compile_args(e, ast, 2);
+  type t = join(T_BOOL, n ? body[n - 1].t : T_BOOL);
+  int r = e->temps++;
+  fprintf(out, "({ %s t%d = ", ctype[t], r);
+  put(out, text_code(T_BOOL, "false"), t);
+  fputs("; while (", out);
+  test(out, condition, "Loop condition must be of type bool");
+  fputs(") { ", out);
+  for (int i = 0; i < n - 1; i++) {
+    statement(out, body[i]);
+  }
+  if (n) {
+    fprintf(out, "t%d = ", r);
+    put(out, body[n - 1], t);
+    fputs("; ", out);
+  }
+  fprintf(out, "} t%d; })", r);
+  free(body);
+  return t;
+}
+
+// Evaluates every value into a temporary, then assigns them all
+static void assign_all(emitter *e, struct ast_arr bindings, int value,
+                       FILE *out) {
+  int base = e->temps;
+  e->temps += bindings.size;
+  type *types = calloc(bindings.size + 1, sizeof(type));
+  for (int i = 0; i < bindings.size; i++) {
+    struct ast_arr b = bindings.child_ast[i].child;
+    if (b.size > value) {
+      code c = compile(e, b.child_ast[value]);
+      types[i] = c.t;
+      fprintf(out, "%s t%d = ", ctype[c.t], base + i);
+      put(out, c, c.t);
+      fputs("; ", out);
+    }
+  }
+  for (int i = 0; i < bindings.size; i++) {
+    struct ast_arr b = bindings.child_ast[i].child;
+    if (b.size > value) {
+      assign(e, b.child_ast[0].value.ident,
+             text_code(types[i], "t%d", base + i), out);
+    }
+  }
+  free(types);
+}
+
+static type do_form(emitter *e, struct ast_arr ast, FILE *out) {
+  // (do ((i 0 (+ i 1)) ...) ((< 9 i) result ...) body ...)
+  //  0   1                  2                    3...
+  struct ast_arr bindings = ast.child_ast[1].child;
+  struct ast_arr exit_clause = ast.child_ast[2].child;
+  if (ast.size < 3 || ast.child_ast[1].type != list_t ||
+      ast.child_ast[2].type != list_t || !exit_clause.size) {
+    fail("Malformed do loop");
+  }
+  for (int i = 0; i < bindings.size; i++) {
+    struct ast_arr b = bindings.child_ast[i].child;
+    if (bindings.child_ast[i].type != list_t || b.size < 2 || b.size > 3 ||
+        !ident_of(b.child_ast[0])) {
+      fail("Malformed do loop binding");
+    }
+  }
+  fputs("({ ", out);
+  assign_all(e, bindings, 1, out);
+  fputs("while (!", out);
+  test(out, compile(e, exit_clause.child_ast[0]),
+       "Loop condition must be of type bool");
+  fputs(") { ", out);
+  for (int i = 3; i < ast.size; i++) {
+    statement(out, compile(e, ast.child_ast[i]));
+  }
+  assign_all(e, bindings, 2, out);
+  fputs("} ", out);
+  code result = sequence(e, &exit_clause.child_ast[1], exit_clause.size - 1);
+  type t = result.t;
+  put(out, result, t);
+  fputs("; })", out);
+  return t;
+}
+
+static bool is_else(ast_node a) {
+  char *name = ident_of(a);
+  return name && !strcmp(name, "else");
+}
+
+static type cond_form(emitter *e, struct ast_arr ast, FILE *out) {
+  // (cond (test body...) ... (else body...))
+  int n = ast.size - 1;
+  code *tests = calloc(n + 1, sizeof(code));
+  code *bodies = calloc(n + 1, sizeof(code));
+  int clauses = 0;
+  bool otherwise = false;
+  type t = T_NONE;
+  for (int i = 1; i < ast.size && !otherwise; i++) {
+    struct ast_arr clause = ast.child_ast[i].child;
+    if (ast.child_ast[i].type != list_t || !clause.size) {
+      fail("Malformed cond clause");
+    }
+    otherwise = is_else(clause.child_ast[0]);
+    if (!otherwise) {
+      tests[clauses] = compile(e, clause.child_ast[0]);
+    }
+    // A clause that is only a test results in the test, true
+    bodies[clauses] = clause.size > 1 || otherwise
+                          ? sequence(e, &clause.child_ast[1], clause.size - 1)
+                          : text_code(T_BOOL, "true");
+    t = join(t, bodies[clauses++].t);
+  }
+  if (!otherwise) {
+    bodies[clauses] = text_code(T_BOOL, "false");
+    t = join(t, T_BOOL);
+  }
+  int r = e->temps++;
+  fprintf(out, "({ %s t%d; ", ctype[t], r);
+  int tested = otherwise ? clauses - 1 : clauses;
+  for (int i = 0; i < tested; i++) {
+    fputs(i ? "else if (" : "if (", out);
+    test(out, tests[i], "cond test must be of type bool");
+    fprintf(out, ") { t%d = ", r);
+    put(out, bodies[i], t);
+    fputs("; } ", out);
+  }
+  fprintf(out, "%s{ t%d = ", tested ? "else " : "", r);
+  put(out, bodies[tested], t);
+  fprintf(out, "; } t%d; })", r);
+  free(tests);
+  free(bodies);
+  return t;
+}
+
+static code datum_code(ast_node d) {
+  if (d.type == literal_t) {
+    switch (d.lit_t) {
+    case integer_t:
+      return text_code(T_ANY, "rt_int(INT64_C(%ld))", d.value.integer);
+    case floating_t:
+      return text_code(T_ANY, "rt_float(%a)", d.value.floating);
+    case bool_t:
+      return text_code(T_ANY, "rt_bool(%s)", d.value.boolean ? "true" : "false");
+    case string_t:
+    case ident_t: {
+      code c = {.t = T_ANY};
+      size_t len;
+      FILE *out = open_memstream(&c.text, &len);
+      fputs("rt_string(", out);
+      c_string(out, d.value.string);
+      fputs(")", out);
+      fclose(out);
+      return c;
+    }
+    default:
+      break;
+    }
+  }
+  fail("case keys must be literals");
+  return (code){0};
+}
+
+static bool is_integer(ast_node a) {
+  return a.type == literal_t && a.lit_t == integer_t;
+}
+
+static type case_form(emitter *e, struct ast_arr ast, FILE *out) {
+  // (case key ((1 2) body...) (3 body...) (else body...))
+  //  0    1   2...
+  // Integer keys become a C switch, anything else a chain of tests
+  if (ast.size < 2) {
+    fail("case expects a key");
+  }
+  code key = compile(e, ast.child_ast[1]);
+  int n = ast.size - 2;
+  code *bodies = calloc(n + 2, sizeof(code));
+  int otherwise = -1;
+  bool integers = key.t == T_INT || key.t == T_NONE;
+  type t = T_NONE;
+  for (int i = 0; i < n; i++) {
+    struct ast_arr clause = ast.child_ast[i + 2].child;
+    if (ast.child_ast[i + 2].type != list_t || !clause.size) {
+      fail("Malformed case clause");
+    }
+    ast_node datums = clause.child_ast[0];
+    if (is_else(datums)) {
+      otherwise = otherwise < 0 ? i : otherwise;
+    } else if (datums.type == list_t) {
+      for (int j = 0; j < datums.child.size; j++) {
+        integers = integers && is_integer(datums.child.child_ast[j]);
+      }
+    } else {
+      integers = integers && is_integer(datums);
+    }
+    bodies[i] = sequence(e, &clause.child_ast[1], clause.size - 1);
+    t = join(t, bodies[i].t);
+  }
+  if (otherwise < 0) {
+    otherwise = n;
+    bodies[n] = text_code(T_BOOL, "false");
+    t = join(t, T_BOOL);
+  }
+
+  int r = e->temps++;
+  int k = e->temps++;
+  if (integers) {
+    fprintf(out, "({ %s t%d; switch (", ctype[t], r);
+    put(out, key, T_INT);
+    fputs(") { ", out);
+  } else {
+    fprintf(out, "({ ast_node t%d = ", k);
+    put(out, key, T_ANY);
+    fprintf(out, "; %s t%d; ", ctype[t], r);
+  }
+  // The first clause listing a key wins, like the interpreter's table
+  int64_t *seen = calloc(1, sizeof(int64_t));
+  int seen_size = 0;
+  for (int i = 0; i < n; i++) {
+    if (i == otherwise) {
+      continue;
+    }
+    ast_node datums = ast.child_ast[i + 2].child.child_ast[0];
+    int count = datums.type == list_t ? datums.child.size : 1;
+    bool reachable = false;
+    if (!integers) {
+      fputs("if (", out);
+    }
+    for (int j = 0; j < count; j++) {
+      ast_node d = datums.type == list_t ? datums.child.child_ast[j] : datums;
+      if (!integers) {
+        fprintf(out, "%scase_matches(t%d, ", j ? " || " : "", k);
+        put(out, datum_code(d), T_ANY);
+        fputs(")", out);
+        reachable = true;
+        continue;
+      }
+      bool dup = false;
+      for (int s = 0; s < seen_size; s++) {
+        dup = dup || seen[s] == d.value.integer;
+      }
+      if (!dup) {
+        seen = reallocarray(seen, seen_size + 1, sizeof(int64_t));
+        seen[seen_size++] = d.value.integer;
+        fprintf(out, "case INT64_C(%ld): ", d.value.integer);
+        reachable = true;
+      }
+    }
+    if (!integers) {
+      fprintf(out, "%s) { t%d = ", reachable ? "" : "false", r);
+      put(out, bodies[i], t);
+      fputs("; } else ", out);
+    } else if (reachable) {
+      fprintf(out, "t%d = ", r);
+      put(out, bodies[i], t);
+      fputs("; break; ", out);
+    } else {
+      free(bodies[i].text);
+    }
+  }
+  free(seen);
+  fprintf(out, integers ? "default: t%d = " : "{ t%d = ", r);
+  put(out, bodies[otherwise], t);
+  fprintf(out, "; } t%d; })", r);
+  free(bodies);
+  return t;
+}
+
+// Writes the arrays under `a` to the data, then `a` itself to `out`
+static void embed_node(emitter *e, ast_node a, FILE *out) {
+  if (a.type == list_t) {
+    if (!a.child.size) {
+      fputs("{.type = list_t}", out);
+      return;
+    }
+    char *items;
+    size_t len;
+    FILE *f = open_memstream(&items, &len);
+    for (int i = 0; i < a.child.size; i++) {
+      fputs("    ", f);
+      embed_node(e, a.child.child_ast[i], f);
+      fputs(",\n", f);
+    }
+    fclose(f);
+    int id = e->arrays++;
+    fprintf(e->data, "static ast_node A%d[] = {\n%s};\n", id, items);
+    free(items);
+    fprintf(out,
+            "{.type = list_t, .child = {.child_ast = A%d, .size = %d, .cap "
+            "= %d}}",
+            id, a.child.size, a.child.size);
+    return;
+  }
+  fputs("{.type = literal_t, ", out);
+  switch (a.lit_t) {
+  case integer_t:
+    fprintf(out, ".lit_t = integer_t, .value.integer = INT64_C(%ld)}",
+            a.value.integer);
+    return;
+  case floating_t:
+    fprintf(out, ".lit_t = floating_t, .value.floating = %a}",
+            a.value.floating);
+    return;
+  case bool_t:
+    fprintf(out, ".lit_t = bool_t, .value.boolean = %s}",
+            a.value.boolean ? "true" : "false");
+    return;
+  case string_t:
+  case ident_t:
+    fprintf(out, ".lit_t = %s, .value.%s = ",
+            a.lit_t == string_t ? "string_t" : "ident_t",
+            a.lit_t == string_t ? "string" : "ident");
+    c_string(out, a.value.string);
+    fputs("}", out);
+    return;
+  default:
+    fail("unexpected literal");
+  }
+}
+
+// Forms kept for the interpreter, E[i] in the output
+static int embed(emitter *e, ast_node a) {
+  if (!e->final) {
+    return 0;
+  }
+  fputs("    ", e->embedded);
+  embed_node(e, a, e->embedded);
+  fputs(",\n", e->embedded);
+  return e->forms++;
+}
+
+static void uses_no_locals(emitter *e, ast_node a) {
+  char *name = ident_of(a);
+  if (name && find(&e->current->locals, name)) {
+    fail("future can't use %s, a local of %s", name, e->current->name);
+  }
+  if (a.type == list_t) {
+    for (int i = 0; i < a.child.size; i++) {
+      uses_no_locals(e, a.child.child_ast[i]);
+    }
+  }
+}
+
+static type future_form(emitter *e, struct ast_arr ast, FILE *out) {
+  // The expression runs interpreted on the pool, so it only sees globals
+  if (ast.size != 2) {
+    fail("future expects one expression");
+  }
+  if (e->current) {
+    uses_no_locals(e, ast.child_ast[1]);
+  }
+  e->mirror = true;
+  code *args = calloc(2, sizeof(code));
+  args[0] = text_code(T_ANY, "E[%d]", embed(e, ast.child_ast[1]));
+  return apply(e, "future", args, 1, out);
+}
+
+static type interpreted_only(emitter *e, struct ast_arr ast, FILE *out) {
+  fail("%s isn't supported, it only runs interpreted",
+       ast.child_ast[0].value.ident);
+  return T_NONE;
+}
+
+static type call(emitter *e, function *f, struct ast_arr ast, FILE *out) {
+  if (ast.size - 1 != f->params) {
+    fail("%s expects %d arguments, got %d", f->name, f->params, ast.size - 1);
+  }
+  code *args = compile_args(e, ast, 1);
+  cname(out, 'f', f->name);
+  fputs("(", out);
+  for (int i = 0; i < f->params; i++) {
+    slot *param = &f->locals.slots[i];
+    widen(e, &param->t, args[i].t);
+    if (i) {
+      fputs(", ", out);
+    }
+    put(out, args[i], param->t);
+  }
+  fputs(")", out);
+  free(args);
+  return f->ret;
+}
+
+static const struct {
+  const char *name;
+  type (*compile)(emitter *, struct ast_arr, FILE *);
+} forms[] = {
+    {"+", arith},         {"-", arith},        {"*", arith},
+    {"/", arith},         {"<", less},         {"abs", abs_form},
+    {"var", bind},        {"const", bind},     {"begin", begin_form},
+    {"func", func_form},  {"if", if_form},     {"while", while_form},
+    {"do", do_form},      {"cond", cond_form}, {"case", case_form},
+    {"future", future_form}, {"lambda", interpreted_only},
+    {"defmemo", interpreted_only}, {"memoize", interpreted_only},
+    {"make-generator", interpreted_only}, {"yield", interpreted_only},
+};
+
+static type expr(emitter *e, ast_node a, FILE *out) {
+  if (a.type == literal_t) {
+    switch (a.lit_t) {
+    case integer_t:
+      fprintf(out, "INT64_C(%ld)", a.value.integer);
+      return T_INT;
+    case floating_t:
+      fprintf(out, "%a", a.value.floating);
+      return T_FLOAT;
+    case bool_t:
+      fputs(a.value.boolean ? "true" : "false", out);
+      return T_BOOL;
+    case string_t:
+      fputs("rt_string(", out);
+      c_string(out, a.value.string);
+      fputs(")", out);
+      return T_ANY;
+    case ident_t:
+      return variable(e, a.value.ident, out);
+    default:
+      fail("unexpected literal");
+    }
+  }
+  char *name = head(a);
+  if (!name) {
+    fail("only named functions can be called");
+  }
+  for (size_t i = 0; i < sizeof(forms) / sizeof(forms[0]); i++) {
+    if (!strcmp(forms[i].name, name)) {
+      return forms[i].compile(e, a.child, out);
+    }
+  }
+  if (is_builtin(name)) {
+    return builtin_call(e, a.child, out);
+  }
+  function *f = find_function(e, name);
+  if (!f) {
+    fail("%s is not a function", name);
+  }
+  return call(e, f, a.child, out);
+}
+
+static void prescan(emitter *e, ast_node a, function *in);
+
+static void define_function(emitter *e, ast_node a, function *in) {
+  // (func name (params) body)
+  struct ast_arr c = a.child;
+  if (in) {
+    fail("functions can only be defined at the top level, not in %s",
+         in->name);
+  }
+  if (c.size != 4 || !ident_of(c.child_ast[1]) ||
+      c.child_ast[2].type != list_t || c.child_ast[3].type != list_t) {
+    fail("Malformed func");
+  }
+  char *name = c.child_ast[1].value.ident;
+  if (find_function(e, name)) {
+    fail("%s is defined more than once", name);
+  }
+  if (e->funcs_size == e->funcs_cap) {
+    e->funcs_cap = e->funcs_cap ? e->funcs_cap * 2 : 8;
+    e->funcs = reallocarray(e->funcs, e->funcs_cap, sizeof(function));
+  }
+  function *f = &e->funcs[e->funcs_size++];
+  *f = (function){.name = name, .form = a};
+  struct ast_arr params = c.child_ast[2].child;
+  for (int i = 0; i < params.size; i++) {
+    char *param = ident_of(params.child_ast[i]);
+    if (!param || find(&f->locals, param)) {
+      fail("Malformed parameters of %s", name);
+    }
+    declare(&f->locals, param, false)->binds = 0;
+  }
+  f->params = params.size;
+  prescan(e, c.child_ast[3], f);
+}
+
+// Finds the functions and every name bound at the top level or in each
+static void prescan(emitter *e, ast_node a, function *in) {
+  if (a.type != list_t) {
+    return;
+  }
+  struct ast_arr c = a.child;
+  scope *s = in ? &in->locals : &e->globals;
+  if (is(a, "func")) {
+    define_function(e, a, in);
+    return;
+  }
+  if (is(a, "var") || is(a, "const")) {
+    if (c.size != 3 || !ident_of(c.child_ast[1])) {
+      fail("Malformed %s", head(a));
+    }
+    declare(s, c.child_ast[1].value.ident, is(a, "const"));
+  }
+  if (is(a, "do") && c.size > 1 && c.child_ast[1].type == list_t) {
+    struct ast_arr bindings = c.child_ast[1].child;
+    for (int i = 0; i < bindings.size; i++) {
+      ast_node b = bindings.child_ast[i];
+      if (b.type == list_t && b.child.size && ident_of(b.child.child_ast[0])) {
+        declare(s, b.child.child_ast[0].value.ident, false);
+      }
+    }
+  }
+  if (is(a, "case")) {
+    // Everything but the keys at the head of each clause
+    if (c.size > 1) {
+      prescan(e, c.child_ast[1], in);
+    }
+    for (int i = 2; i < c.size; i++) {
+      struct ast_arr clause = c.child_ast[i].child;
+      for (int j = 1; c.child_ast[i].type == list_t && j < clause.size; j++) {
+        prescan(e, clause.child_ast[j], in);
+      }
+    }
+    return;
+  }
+  for (int i = 0; i < c.size; i++) {
+    prescan(e, c.child_ast[i], in);
+  }
+}
+
+// Whether `name` is read inside a func or future, which may run interpreted
+static bool interpreted_use(ast_node a, char *name, bool inside) {
+  char *ident = ident_of(a);
+  if (ident) {
+    return inside && !strcmp(ident, name);
+  }
+  inside = inside || is(a, "func") || is(a, "future");
+  for (int i = 0; a.type == list_t && i < a.child.size; i++) {
+    if (interpreted_use(a.child.child_ast[i], name, inside)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void check_consts(scope *s) {
+  for (int i = 0; i < s->size; i++) {
+    if (s->slots[i].constant && s->slots[i].binds > 1) {
+      fail("Cannot reassign to const ident %s", s->slots[i].name);
+    }
+  }
+}
+
+static void settle(scope *s) {
+  for (int i = 0; i < s->size; i++) {
+    s->slots[i].t = s->slots[i].t == T_NONE ? T_ANY : s->slots[i].t;
+  }
+}
+
+static void function_code(emitter *e, function *f, FILE *out) {
+  e->current = f;
+  // A local that is also a global starts out as the global's value
+  for (int i = f->params; i < f->locals.size; i++) {
+    slot *g = find(&e->globals, f->locals.slots[i].name);
+    if (g) {
+      widen(e, &f->locals.slots[i].t, g->t);
+    }
+  }
+  code body = compile(e, f->form.child.child_ast[3]);
+  widen(e, &f->ret, body.t);
+
+  fprintf(out, "static %s ", ctype[f->ret]);
+  cname(out, 'f', f->name);
+  fputs("(", out);
+  for (int i = 0; i < f->params; i++) {
+    fprintf(out, "%s%s ", i ? ", " : "", ctype[f->locals.slots[i].t]);
+    cname(out, 'l', f->locals.slots[i].name);
+  }
+  fputs(f->params ? ") {\n" : "void) {\n", out);
+  for (int i = f->params; i < f->locals.size; i++) {
+    slot *s = &f->locals.slots[i];
+    slot *g = find(&e->globals, s->name);
+    fprintf(out, "  %s ", ctype[s->t]);
+    cname(out, 'l', s->name);
+    if (g) {
+      fputs(" = ", out);
+      put(out, name_code(true, s->name, g->t), s->t);
+      fputs(";\n", out);
+    } else {
+      fputs(" = {0};\n", out);
+    }
+  }
+  fputs("  return ", out);
+  put(out, body, f->ret);
+  fputs(";\n}\n\n", out);
+  e->current = NULL;
+}
+
+static bool prints_const(ast_node a) {
+  if (is(a, "begin") && a.child.size > 1) {
+    return prints_const(a.child.child_ast[a.child.size - 1]);
+  }
+  return is(a, "const");
+}
+
+static void pass(emitter *e, struct ast_arr forms, FILE *funcs, FILE *body) {
+  for (int i = 0; i < e->funcs_size; i++) {
+    function_code(e, &e->funcs[i], funcs);
+  }
+  for (int i = 0; i < forms.size; i++) {
+    code c = compile(e, forms.child_ast[i]);
+    if (prints_const(forms.child_ast[i])) {
+      // The interpreter prints the const_t node, not its value
+      fputs("  ", body);
+      statement(body, c);
+      fputs("rt_print((ast_node){.type = const_t});\n", body);
+    } else {
+      fputs("  rt_print(", body);
+      put(body, c, T_ANY);
+      fputs(");\n", body);
+    }
+  }
+}
+
+// Repeats passes until no slot, parameter or result changes type
+static void infer(emitter *e, struct ast_arr forms, FILE *sink) {
+  do {
+    e->changed = false;
+    pass(e, forms, sink, sink);
+  } while (e->changed);
+}
+
+void emit_c(ast_node root, const char *source_name, FILE *out) {
+  emitter e = {0};
+  struct ast_arr forms = root.child;
+  for (int i = 0; i < forms.size; i++) {
+    prescan(&e, forms.child_ast[i], NULL);
+  }
+  check_consts(&e.globals);
+  for (int i = 0; i < e.globals.size; i++) {
+    for (int j = 0; j < forms.size && !e.globals.slots[i].shared; j++) {
+      e.globals.slots[i].shared =
+          interpreted_use(forms.child_ast[j], e.globals.slots[i].name, false);
+    }
+  }
+  for (int i = 0; i < e.funcs_size; i++) {
+    check_consts(&e.funcs[i].locals);
+  }
+
+  FILE *sink = fopen("/dev/null", "w");
+  infer(&e, forms, sink);
+  // Anything nothing was ever stored in is boxed
+  settle(&e.globals);
+  for (int i = 0; i < e.funcs_size; i++) {
+    settle(&e.funcs[i].locals);
+    e.funcs[i].ret = e.funcs[i].ret == T_NONE ? T_ANY : e.funcs[i].ret;
+  }
+  infer(&e, forms, sink);
+  fclose(sink);
+
+  e.final = true;
+  char *data, *embedded, *heads, *funcs, *body;
+  size_t data_len, embedded_len, heads_len, funcs_len, body_len;
+  e.data = open_memstream(&data, &data_len);
+  e.embedded = open_memstream(&embedded, &embedded_len);
+  e.heads = open_memstream(&heads, &heads_len);
+  FILE *funcs_out = open_memstream(&funcs, &funcs_len);
+  FILE *body_out = open_memstream(&body, &body_len);
+  // The functions are E[0] to E[funcs_size - 1], for rt_init
+  for (int i = 0; i < e.funcs_size; i++) {
+    embed(&e, e.funcs[i].form);
+  }
+  pass(&e, forms, funcs_out, body_out);
+  fclose(e.data);
+  fclose(e.embedded);
+  fclose(e.heads);
+  fclose(funcs_out);
+  fclose(body_out);
+
+  fprintf(out, "// Generated by schemelike --emit-c from %s\n", source_name);
+  fprintf(out, "#include \"runtime.h\"\n\n");
+  fprintf(out, "static char *builtin_names[] = {");
+  for (int i = 0; i < e.builtins_size; i++) {
+    c_string(out, e.builtins[i]);
+    fputs(", ", out);
+  }
+  fprintf(out, "NULL};\n");
+  fprintf(out, "static builtin *B[%d];\n", e.builtins_size + 1);
+  fprintf(out, "static ast_node H[%d] = {\n%s    {0},\n};\n", e.calls + 1,
+          heads);
+  fprintf(out, "static ast_node E[%d];\n\n", e.forms + 1);
+  for (int i = 0; i < e.globals.size; i++) {
+    fprintf(out, "static %s ", ctype[e.globals.slots[i].t]);
+    cname(out, 'g', e.globals.slots[i].name);
+    fputs(";\n", out);
+  }
+  fputs("\n", out);
+  for (int i = 0; i < e.funcs_size; i++) {
+    function *f = &e.funcs[i];
+    fprintf(out, "static %s ", ctype[f->ret]);
+    cname(out, 'f', f->name);
+    fputs("(", out);
+    for (int j = 0; j < f->params; j++) {
+      fprintf(out, "%s%s", j ? ", " : "", ctype[f->locals.slots[j].t]);
+    }
+    fputs(f->params ? ");\n" : "void);\n", out);
+  }
+  fprintf(out, "\n%s%s", funcs, data);
+  fprintf(out, "static ast_node E[%d] = {\n%s    {0},\n};\n\n", e.forms + 1,
+          embedded);
+  fprintf(out, "int main(void) {\n"
+               "  for (int i = 0; builtin_names[i]; i++) {\n"
+               "    B[i] = is_builtin(builtin_names[i]);\n"
+               "  }\n");
+  fprintf(out, "  rt_init(E, %d);\n%s", e.funcs_size, body);
+  fprintf(out, "  rt_finish(E, %d, H, %d);\n  return 0;\n}\n", e.forms,
+          e.calls);
+
+  free(data);
+  free(embedded);
+  free(heads);
+  free(funcs);
+  free(body);
+  for (int i = 0; i < e.funcs_size; i++) {
+    free(e.funcs[i].locals.slots);
+  }
+  free(e.funcs);
+  free(e.globals.slots);
+  free(e.builtins);
+}
@@ -0,0 +1,23 @@
+#ifndef EMIT_H_
+#define EMIT_H_
+#include "parse.h"
+#include <stdio.h>
+
+// Translates a program to C that prints what `--stream` prints for it,
+// with these exceptions:
+// - lambda, defmemo, memoize, make-generator and yield are rejected
+//   wherever they appear, so are functions passed by anything but name,
+//   as in `(fold (lambda ...) ...)`
+// - integer arithmetic has no bignums, overflow is reported and exits
+//   where the interpreter would promote
+// - other forms it can't translate are reported and exit(1)
+// Every `func` becomes a C function, and every name gets a C variable.
+// Types are inferred across the whole program, so parameters, variables
+// and results that only ever hold integers, floats or bools are unboxed
+// and use C's operators. Everything else stays an ast_node and calls the
+// builtins through runtime.h.
+// Builtins that call functions by name (map, fold, pmap, sort-by) and
+// `future` run the interpreted definitions kept in the runtime
+void emit_c(ast_node root, const char *source_name, FILE *out);
+
+#endif // EMIT_H_
@@ -0,0 +1,307 @@
+#include "eval.h"
+#include "ast_walking.h"
+#include "hashmap.h"
+#include "parse.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define ASAN_FIBERS
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define ASAN_FIBERS
+#endif
+#endif
+#ifdef ASAN_FIBERS
+// Told about every stack switch, it would report false positives otherwise
+#include <sanitizer/asan_interface.h>
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+struct evaluation {
+  ucontext_t start;
+  bool started;
+  void *context[5]; // for __builtin_setjmp, see jump
+  void *resumer[5];
+  char *stack;
+  void (*fn)(void *);
+  void *arg;
+  ast_node expr;
+  hashmap *ctx;
+  ast_node result;
+  char *error;
+  bool done;
+  int depth; // eval_depth while suspended
+  int64_t fuel; // eval_fuel while suspended
+  int task_depth; // eval_task_depth while suspended
+  bool fuelled;
+  // The resumer's stack, for the sanitizer
+  const void *resumer_bottom;
+  size_t resumer_size;
+  // How deep the stack was when last left
+  char *low;
+};
+
+int eval_max_depth = EVAL_DEFAULT_MAX_DEPTH;
+_Thread_local int eval_depth;
+_Thread_local uintptr_t eval_stack_limit;
+_Thread_local int64_t eval_fuel = INT64_MAX;
+_Thread_local int eval_task_depth;
+static _Thread_local evaluation *current;
+
+#define SPARE_STACKS 4
+static _Thread_local char *spare[SPARE_STACKS];
+static _Thread_local int spares;
+
+// Asked for once, sysconf is slow enough to show in every switch
+static size_t guard_bytes(void) {
+  static _Thread_local size_t page;
+  if (!page) {
+    page = sysconf(_SC_PAGESIZE);
+  }
+  return page;
+}
+
+static char *stack_new(void) {
+  if (spares) {
+    return spare[--spares];
+  }
+  char *s = mmap(NULL, EVAL_STACK_BYTES, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1,
+                 0);
+  if (s == MAP_FAILED) {
+    perror("mmap failed");
+    exit(EXIT_FAILURE);
+  }
+  // Stacks grow down, running off the end faults instead of corrupting
+  mprotect(s, guard_bytes(), PROT_NONE);
+  return s;
+}
+
+static void stack_free(char *s) {
+  if (spares < SPARE_STACKS) {
+    spare[spares++] = s;
+    return;
+  }
+  munmap(s, EVAL_STACK_BYTES);
+}
+
+void eval_overflow(void) {
+  if (eval_depth > eval_max_depth) {
+    eval_error("Maximum call depth of %d exceeded, see --max-depth",
+               eval_max_depth);
+  }
+  eval_error("Evaluation stack exhausted");
+}
+
+// Continues the context saved in `to`. Not instrumented, the sanitizer
+// would try to unpoison the whole stack being left, see jump
+__attribute__((noinline, no_sanitize_address)) static void
+resume(void **to) {
+  __builtin_longjmp(to, 1);
+}
+
+// Saves the running context in `from` and continues `to`, whose stack
+// is `size` bytes from `bottom`. Returns once `from` is continued, the
+// stack it came from is then stored in `came_from`, if given.
+// Only an evaluation's first start goes through its ucontext, which saves
+// and restores the signal mask with a system call each way. Every switch
+// after that is a __builtin_setjmp and __builtin_longjmp, which save and
+// restore just the frame, stack pointer and resume address. Unlike
+// longjmp they aren't fortified, which refuses to jump to a frame deeper
+// than the current one, nor intercepted by the sanitizer, which would try
+// to unpoison the whole stack being left and give up past 64MB
+static void jump(void **from, void **to, ucontext_t *start,
+                 const void *bottom, size_t size, bool last,
+                 evaluation *came_from) {
+#ifdef ASAN_FIBERS
+  void *fake_stack = NULL;
+  __sanitizer_start_switch_fiber(last ? NULL : &fake_stack, bottom, size);
+#endif
+  if (!__builtin_setjmp(from)) {
+    if (start) {
+      setcontext(start);
+    }
+    resume(to);
+  }
+#ifdef ASAN_FIBERS
+  __sanitizer_finish_switch_fiber(
+      fake_stack, came_from ? &came_from->resumer_bottom : NULL,
+      came_from ? &came_from->resumer_size : NULL);
+#endif
+}
+
+static void run(void) {
+  evaluation *e = current;
+#ifdef ASAN_FIBERS
+  __sanitizer_finish_switch_fiber(NULL, &e->resumer_bottom, &e->resumer_size);
+#endif
+  e->fn(e->arg);
+  e->done = true;
+  e->low = __builtin_frame_address(0);
+  jump(e->context, e->resumer, NULL, e->resumer_bottom, e->resumer_size,
+       true, NULL);
+}
+
+evaluation *eval_start(void (*fn)(void *), void *arg) {
+  evaluation *e = calloc(1, sizeof(evaluation));
+  e->stack = stack_new();
+  e->fn = fn;
+  e->arg = arg;
+  e->fuel = INT64_MAX;
+  getcontext(&e->start);
+  e->start.uc_stack.ss_sp = e->stack + guard_bytes();
+  e->start.uc_stack.ss_size = EVAL_STACK_BYTES - guard_bytes();
+  makecontext(&e->start, run, 0);
+  return e;
+}
+
+static void walk(void *arg) {
+  evaluation *e = arg;
+  e->result = auto_ast_walk(e->expr, e->ctx);
+}
+
+evaluation *eval_new(ast_node expr, hashmap *ctx) {
+  evaluation *e = eval_start(walk, NULL);
+  e->arg = e;
+  e->expr = expr;
+  e->ctx = ctx;
+  return e;
+}
+
+bool eval_resume(evaluation *e) {
+  evaluation *outer = current;
+  int depth = eval_depth;
+  uintptr_t limit = eval_stack_limit;
+  int64_t fuel = eval_fuel;
+  int task_depth = eval_task_depth;
+  current = e;
+  eval_depth = e->depth;
+  eval_fuel = e->fuel;
+  eval_task_depth = e->task_depth;
+  eval_stack_limit = (uintptr_t)e->stack + guard_bytes() + EVAL_STACK_MARGIN;
+  ucontext_t *start = e->started ? NULL : &e->start;
+  e->started = true;
+  jump(e->resumer, e->context, start, e->stack + guard_bytes(),
+       EVAL_STACK_BYTES - guard_bytes(), false, NULL);
+  e->depth = eval_depth;
+  e->fuel = eval_fuel;
+  e->task_depth = eval_task_depth;
+  current = outer;
+  eval_depth = depth;
+  eval_stack_limit = limit;
+  eval_fuel = fuel;
+  eval_task_depth = task_depth;
+  return e->done;
+}
+
+ast_node eval_result(evaluation *e) { return e->result; }
+
+const char *eval_failure(evaluation *e) { return e->error; }
+
+void eval_free(evaluation *e) {
+#ifdef ASAN_FIBERS
+  // Frames that never returned are still marked as in use, the next stack
+  // at this address mustn't inherit them
+  char *low = e->low ? e->low - guard_bytes() : e->stack + EVAL_STACK_BYTES;
+  if (low < e->stack + guard_bytes()) {
+    low = e->stack + guard_bytes();
+  }
+  __asan_unpoison_memory_region(low, e->stack + EVAL_STACK_BYTES - low);
+#endif
+  stack_free(e->stack);
+  free(e->error);
+  free(e);
+}
+
+void eval_suspend(void) {
+  evaluation *e = current;
+  if (!e) {
+    fprintf(stderr, "Can only suspend inside an evaluation\n");
+    exit(1);
+  }
+  e->low = __builtin_frame_address(0);
+  jump(e->context, e->resumer, NULL, e->resumer_bottom, e->resumer_size,
+       false, e);
+}
+
+evaluation *eval_current(void) { return current; }
+
+void eval_set_fuel(evaluation *e, int64_t fuel) {
+  e->fuel = fuel;
+  e->fuelled = true;
+}
+
+int64_t eval_fuel_left(evaluation *e) { return e->fuel; }
+
+bool eval_fuelled(void) { return current && current->fuelled; }
+
+void eval_out_of_fuel(void) {
+  if (current && current->fuelled) {
+    eval_suspend();
+  } else {
+    eval_fuel = INT64_MAX;
+  }
+}
+
+bool eval_yield(void) {
+  if (!current || !current->fuelled) {
+    return false;
+  }
+  eval_suspend();
+  return true;
+}
+
+ast_node eval(ast_node expr, hashmap *ctx) {
+  if (current) {
+    return auto_ast_walk(expr, ctx);
+  }
+  evaluation *e = eval_new(expr, ctx);
+  while (!eval_resume(e)) {
+  }
+  if (e->error) {
+    fprintf(stderr, "%s\n", e->error);
+    exit(1);
+  }
+  ast_node result = e->result;
+  eval_free(e);
+  return result;
+}
+
+char *eval_protect(void (*fn)(void *), void *arg) {
+  evaluation *e = eval_start(fn, arg);
+  while (!eval_resume(e)) {
+  }
+  char *error = e->error;
+  e->error = NULL;
+  eval_free(e);
+  return error;
+}
+
+void eval_raise(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  evaluation *e = current;
+  if (!e) {
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    exit(1);
+  }
+  va_list again;
+  va_copy(again, args);
+  int len = vsnprintf(NULL, 0, format, args);
+  e->error = malloc(len + 1);
+  vsnprintf(e->error, len + 1, format, again);
+  va_end(again);
+  va_end(args);
+  // Nothing left on this stack is ever returned to
+  e->done = true;
+  e->low = __builtin_frame_address(0);
+  jump(e->context, e->resumer, NULL, e->resumer_bottom, e->resumer_size,
+       true, NULL);
+  __builtin_unreachable();
+}
@@ -0,0 +1,108 @@
+#ifndef EVAL_H_
+#define EVAL_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Evaluations run on stacks of their own rather than the thread's. Each
+// stack reserves EVAL_STACK_BYTES of address space, which only gets backed
+// by memory as the evaluation goes deeper, above an inaccessible guard
+// page. A thread keeps a few finished stacks around for its next ones.
+// The evaluator itself still recurses on that stack: every nested form
+// and call is a C frame of ast_walk and the builtin or call_function
+// running it, around 2.5KB per call of a simple recursive function.
+// There is no heap allocated continuation stack: how deep a program can
+// recurse is bounded only by the reserved stack, and by eval_max_depth.
+// Every function call counts against eval_max_depth. Passing it, or
+// getting within EVAL_STACK_MARGIN of the end of the stack, is an error
+// instead of a crash. A stack holds around 400000 nested calls of a
+// simple recursive function, and half that in the sanitized build, so an
+// eval_max_depth past that ends with the stack exhausted instead.
+// An evaluation can suspend itself part way through and be resumed later.
+// Errors in the program abandon the evaluation they happen in, see
+// eval_error
+#define EVAL_STACK_BYTES ((size_t)1 << 30)
+#define EVAL_STACK_MARGIN (256 * 1024)
+#define EVAL_DEFAULT_MAX_DEPTH 100000
+
+extern int eval_max_depth;
+
+typedef struct evaluation evaluation;
+
+evaluation *eval_new(ast_node, hashmap *);
+// An evaluation of `fn(arg)` instead of an expression
+evaluation *eval_start(void (*fn)(void *), void *arg);
+// Runs until the evaluation finishes or suspends itself, true once it has
+// finished
+bool eval_resume(evaluation *);
+ast_node eval_result(evaluation *);
+void eval_free(evaluation *);
+// Returns from the eval_resume that is running the current evaluation
+void eval_suspend(void);
+// NULL outside of any evaluation
+evaluation *eval_current(void);
+
+// Every form evaluated is a step. An evaluation given fuel suspends itself
+// once it has taken that many steps, eval_resume then returns false and
+// the evaluation can be refuelled and resumed. Without fuel it never runs
+// out. Evaluations started inside it have none of their own
+void eval_set_fuel(evaluation *, int64_t);
+// Negative once it ran out
+int64_t eval_fuel_left(evaluation *);
+// Whether the current evaluation runs on fuel
+bool eval_fuelled(void);
+// Suspends the current evaluation if it runs on fuel, so one waiting on
+// another thread lets others use its own. False when it doesn't
+bool eval_yield(void);
+
+// Evaluates to completion on a stack of its own, or in place when already
+// inside an evaluation. An error is printed and exits
+ast_node eval(ast_node, hashmap *);
+
+// Reports an error in the program, `format` as for printf without a
+// trailing newline. The current evaluation is abandoned and finishes with
+// the message as its error. Outside of any evaluation the message is
+// printed and the process exits.
+// eval_raise never returns but isn't declared _Noreturn: AddressSanitizer
+// would unpoison the whole stack before every call to it, and gives up
+// with a warning on an evaluation stack deeper than 64MB. eval_free
+// unpoisons what an abandoned evaluation leaves behind instead
+#define eval_error(...) (eval_raise(__VA_ARGS__), __builtin_unreachable())
+void eval_raise(const char *format, ...) __attribute__((format(printf, 1, 2)));
+// NULL unless the evaluation finished at an error
+const char *eval_failure(evaluation *);
+// Runs `fn(arg)` to completion on a stack of its own, even from inside
+// another evaluation. Returns the error it stopped at, to be freed, or NULL
+char *eval_protect(void (*fn)(void *), void *arg);
+
+// Of the current evaluation, kept in thread locals so calls stay cheap
+extern _Thread_local int eval_depth;
+extern _Thread_local uintptr_t eval_stack_limit;
+extern _Thread_local int64_t eval_fuel;
+// How many calls whose operands run as tasks the current expression is
+// nested in, see effects.h. The tasks start one deeper than their call
+extern _Thread_local int eval_task_depth;
+// Never returns, see eval_error
+void eval_overflow(void);
+void eval_out_of_fuel(void);
+
+// Counts a step of the current evaluation
+static inline void eval_step(void) {
+  if (--eval_fuel < 0) {
+    eval_out_of_fuel();
+  }
+}
+
+// Brackets every function call
+static inline void eval_enter(void) {
+  char here;
+  if (++eval_depth > eval_max_depth || (uintptr_t)&here < eval_stack_limit) {
+    eval_overflow();
+    __builtin_unreachable();
+  }
+}
+
+static inline void eval_exit(void) { eval_depth--; }
+
+#endif // EVAL_H_
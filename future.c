@@ -0,0 +1,165 @@
+#include "future.h"
+#include "ast_walking.h"
+#include "closure.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "list.h"
+#include "parse.h"
+#include "pool.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void evaluate(void *arg) {
+  future *f = arg;
+  eval_depth = f->depth;
+  eval_task_depth = f->task_depth;
+  f->result = auto_ast_walk(f->expr, &f->ctx);
+}
+
+// A copy of every layer of `ctx`. The program goes on binding globals
+// while the task runs, and an insert may move the table it would read
+static hashmap snapshot(hashmap *ctx) {
+  hashmap copy = hashmap_copy(ctx);
+  if (ctx->parent) {
+    copy.parent = malloc(sizeof(hashmap));
+    *copy.parent = snapshot(ctx->parent);
+  }
+  return copy;
+}
+
+static void snapshot_free(hashmap *h) {
+  hashmap *parent = h->parent;
+  hashmap_free(h);
+  if (parent) {
+    snapshot_free(parent);
+    free(parent);
+  }
+}
+
+static void run_future(void *arg) {
+  future *f = arg;
+  heap *outer = heap_use(f->heap);
+  f->error = eval_protect(evaluate, f);
+  heap_use(outer);
+  snapshot_free(&f->ctx);
+  atomic_store_explicit(&f->done, true, memory_order_release);
+}
+
+static void future_start(future *f, ast_node expr, hashmap *ctx, int depth,
+                         int task_depth) {
+  f->expr = expr;
+  f->ctx = snapshot(ctx);
+  f->depth = depth;
+  f->task_depth = task_depth;
+  f->heap = heap_current();
+  f->error = NULL;
+  atomic_init(&f->done, false);
+  pool_submit(run_future, f);
+}
+
+// Runs other queued tasks while waiting, so touching from inside a task
+// can't deadlock the pool. A scheduled script gives up its thread instead
+// of spinning, see scheduler.h
+static void await(future *f) {
+  while (!atomic_load_explicit(&f->done, memory_order_acquire)) {
+    if (!pool_help() && !eval_yield()) {
+      sched_yield();
+    }
+  }
+}
+
+ast_node future_wait(future *f) {
+  await(f);
+  if (f->error) {
+    eval_error("%s", f->error);
+  }
+  return f->result;
+}
+
+// A future that was never touched may still be running when its heap is
+// freed
+static void future_finalize(void *p) {
+  future *f = p;
+  await(f);
+  free(f->error);
+}
+
+future *future_spawn(ast_node expr, hashmap *ctx) {
+  future *f = heap_alloc(sizeof(future), future_finalize);
+  future_start(f, expr, ctx, eval_depth, eval_task_depth + 1);
+  return f;
+}
+
+ast_node spawn_future(struct ast_arr ast, hashmap *ctx) {
+  // (future expr)
+  assert(ast.child_ast[0].lit_t == ident_t);
+  future *f = heap_alloc(sizeof(future), future_finalize);
+  future_start(f, ast.child_ast[1], ctx, 0, 0);
+  return (ast_node){.type = literal_t, .lit_t = future_t, .value.future = f};
+}
+
+ast_node touch(struct ast_arr ast, hashmap *ctx) {
+  // (touch value), anything but a future is returned as is
+  assert(ast.child_ast[0].lit_t == ident_t);
+  ast_node value = auto_ast_walk(ast.child_ast[1], ctx);
+  if (value.type == literal_t && value.lit_t == future_t) {
+    return future_wait(value.value.future);
+  }
+  return value;
+}
+
+ast_node pmap(struct ast_arr ast, hashmap *ctx) {
+  // (pmap f a b c) calls (f a), (f b) and (f c) in parallel
+  //  0    1 2...
+  assert(ast.child_ast[0].lit_t == ident_t);
+  closure_buf stack;
+  ast_node f = function_arg(ast, 1, ctx, &stack);
+  int n = ast.size - 2;
+  ast_node *calls = calloc(n * 2 + 1, sizeof(ast_node));
+  future *futures = calloc(n + 1, sizeof(future));
+  // The calls may use a closure on this stack, none start before every
+  // argument is known and all finish before any error is raised
+  for (int i = 0; i < n; i++) {
+    ast_node v = auto_ast_walk(ast.child_ast[i + 2], ctx);
+    if (v.type == function_t || v.type == list_t || v.type == tombstone_t) {
+      free(futures);
+      free(calls);
+      eval_error("pmap can only pass values");
+    }
+    // A fresh node, `v` may be a const
+    calls[i * 2] = f;
+    calls[i * 2 + 1] = (ast_node){.type = literal_t, .lit_t = v.lit_t,
+                                  .value = v.value};
+  }
+  for (int i = 0; i < n; i++) {
+    ast_node call = {.type = list_t,
+                     .child = {.child_ast = &calls[i * 2], .size = 2, .cap = 2}};
+    future_start(&futures[i], call, ctx, 0, 0);
+  }
+
+  ast_node *results = calloc(n + 1, sizeof(ast_node));
+  char *error = NULL;
+  for (int i = 0; i < n; i++) {
+    await(&futures[i]);
+    results[i] = futures[i].result;
+    if (!error) {
+      error = futures[i].error;
+    } else {
+      free(futures[i].error);
+    }
+  }
+  cons_chunk *l = error ? NULL : list_from(results, n);
+  free(results);
+  free(futures);
+  free(calls);
+  if (error) {
+    char message[strlen(error) + 1];
+    strcpy(message, error);
+    free(error);
+    eval_error("%s", message);
+  }
+  return list_node(l);
+}
@@ -0,0 +1,34 @@
+#ifndef FUTURE_H_
+#define FUTURE_H_
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include <stdatomic.h>
+
+// An expression being evaluated on the thread pool. The task evaluates in
+// its own copy of the creating environment, every layer of it, so names
+// bound after it starts are never seen by it. It allocates from the
+// creator's heap. An error stops only the task, it
+// is raised again when the future is waited on
+typedef struct future {
+  ast_node expr;
+  hashmap ctx;
+  int depth; // eval_depth the task starts at
+  int task_depth; // and eval_task_depth
+  heap *heap;
+  ast_node result;
+  char *error;
+  atomic_bool done;
+} future;
+
+// Starts evaluating `expr` as (future expr) would, but at the current call
+// depth, so it runs out of depth exactly where evaluating it in place would,
+// and one task deeper, see eval_task_depth
+future *future_spawn(ast_node expr, hashmap *ctx);
+ast_node future_wait(future *);
+
+ast_node spawn_future(struct ast_arr ast, hashmap *ctx);
+ast_node touch(struct ast_arr ast, hashmap *ctx);
+ast_node pmap(struct ast_arr ast, hashmap *ctx);
+
+#endif // FUTURE_H_
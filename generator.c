@@ -0,0 +1,157 @@
+#include "generator.h"
+#include "ast_walking.h"
+#include "closure.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// The generator this thread is continuing, only ever set while its
+// evaluation runs
+static _Thread_local generator *running;
+
+// Generators started and not yet exhausted, on any thread
+static atomic_int suspended;
+
+static void run(void *arg) {
+  generator *g = arg;
+  ast_node call = {.type = list_t,
+                   .child = {.child_ast = &g->fn, .size = 1, .cap = 1}};
+  auto_ast_walk(call, g->ctx);
+}
+
+static void generator_finalize(void *p) {
+  generator *g = p;
+  if (g->eval) {
+    eval_free(g->eval);
+    atomic_fetch_sub(&suspended, 1);
+  }
+}
+
+static generator *generator_arg(struct ast_arr ast, hashmap *ctx) {
+  ast_node g = ast.size > 1 ? auto_ast_walk(ast.child_ast[1], ctx)
+                            : (ast_node){.type = tombstone_t};
+  if (g.type != literal_t || g.lit_t != generator_t) {
+    eval_error("%s expects a generator", ast.child_ast[0].value.ident);
+  }
+  return g.value.generator;
+}
+
+// Runs `g` up to its next yield unless one is pending, false once it is
+// exhausted
+static bool advance(generator *g) {
+  if (g->pending) {
+    return true;
+  }
+  if (g->exhausted) {
+    return false;
+  }
+  if (g->running) {
+    eval_error("next on a generator that is already running");
+  }
+  if (!g->eval) {
+    g->eval = eval_start(run, g);
+    atomic_fetch_add(&suspended, 1);
+  }
+  g->running = true;
+  bool done;
+  for (;;) {
+    generator *outer = running;
+    running = g;
+    eval_set_fuel(g->eval, eval_fuel);
+    done = eval_resume(g->eval);
+    eval_fuel = eval_fuel_left(g->eval);
+    running = outer;
+    if (done || g->pending) {
+      break;
+    }
+    // It used up all of our fuel, see eval_yield
+    eval_out_of_fuel();
+  }
+  g->running = false;
+  if (!done) {
+    return true;
+  }
+
+  const char *error = eval_failure(g->eval);
+  char message[error ? strlen(error) + 1 : 1];
+  strcpy(message, error ? error : "");
+  eval_free(g->eval);
+  atomic_fetch_sub(&suspended, 1);
+  g->eval = NULL;
+  g->exhausted = true;
+  if (error) {
+    eval_error("%s", message);
+  }
+  return false;
+}
+
+bool generators_suspended(void) { return atomic_load(&suspended) > 0; }
+
+bool generator_take(generator *g, ast_node *value) {
+  if (!advance(g)) {
+    return false;
+  }
+  g->pending = false;
+  *value = g->value;
+  return true;
+}
+
+ast_node make_generator(struct ast_arr ast, hashmap *ctx) {
+  // (make-generator f), f takes no arguments
+  //  0              1
+  assert(ast.child_ast[0].lit_t == ident_t);
+  ast_node f = function_value(ast, 1, ctx);
+  if (f.type == literal_t && f.lit_t == closure_t &&
+      f.value.closure->site->params) {
+    eval_error("make-generator expects a function of no arguments");
+  }
+  generator *g = heap_alloc(sizeof(generator), generator_finalize);
+  *g = (generator){.fn = f, .ctx = globals(ctx)};
+  return (ast_node){
+      .type = literal_t, .lit_t = generator_t, .value.generator = g};
+}
+
+ast_node generator_yield(struct ast_arr ast, hashmap *ctx) {
+  // (yield value), returns `value` once the generator is continued
+  //  0     1
+  assert(ast.child_ast[0].lit_t == ident_t);
+  if (ast.size != 2) {
+    eval_error("yield expects a value");
+  }
+  ast_node value = auto_ast_walk(ast.child_ast[1], ctx);
+  generator *g = running;
+  if (!g || eval_current() != g->eval) {
+    eval_error("yield outside of a generator");
+  }
+  g->value = value;
+  g->pending = true;
+  eval_suspend();
+  return value;
+}
+
+ast_node generator_next(struct ast_arr ast, hashmap *ctx) {
+  // (next g default), `default` is returned once g is exhausted
+  //  0    1 2
+  assert(ast.child_ast[0].lit_t == ident_t);
+  generator *g = generator_arg(ast, ctx);
+  ast_node value;
+  if (!generator_take(g, &value)) {
+    if (ast.size > 2) {
+      return auto_ast_walk(ast.child_ast[2], ctx);
+    }
+    eval_error("next on an exhausted generator");
+  }
+  return value;
+}
+
+ast_node generator_done(struct ast_arr ast, hashmap *ctx) {
+  // (generator-done? g), runs g up to its next yield to find out
+  assert(ast.child_ast[0].lit_t == ident_t);
+  generator *g = generator_arg(ast, ctx);
+  return (ast_node){
+      .type = literal_t, .lit_t = bool_t, .value.boolean = !advance(g)};
+}
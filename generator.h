@@ -0,0 +1,39 @@
+#ifndef GENERATOR_H_
+#define GENERATOR_H_
+#include "eval.h"
+#include "hashmap.h"
+#include "parse.h"
+#include <stdbool.h>
+
+// A function of no arguments run as a coroutine, on an evaluation of its
+// own. Each (next g) continues it up to its next (yield v) and returns v,
+// so the values it produces are made one at a time as they are asked for
+// and never all held at once. What the function returns is dropped, the
+// generator is then exhausted.
+// The function runs in the global environment it was made in, with the
+// fuel of whoever calls next, see eval.h. An error in it is raised again
+// by the next that ran into it
+typedef struct generator {
+  ast_node fn;
+  hashmap *ctx;
+  evaluation *eval; // started by the first next
+  ast_node value;
+  bool pending; // `value` was yielded and not yet taken by next
+  bool running;
+  bool exhausted;
+} generator;
+
+// Continues `g` up to its next yield and stores the value yielded, false
+// once it is exhausted
+bool generator_take(generator *, ast_node *value);
+
+// Whether any generator has been started and not exhausted. Its stack may
+// hold values allocated while it ran, see program_stream
+bool generators_suspended(void);
+
+ast_node make_generator(struct ast_arr ast, hashmap *ctx);
+ast_node generator_yield(struct ast_arr ast, hashmap *ctx);
+ast_node generator_next(struct ast_arr ast, hashmap *ctx);
+ast_node generator_done(struct ast_arr ast, hashmap *ctx);
+
+#endif // GENERATOR_H_
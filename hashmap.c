@@ -108,7 +108,25 @@ hashmap hashmap_init(hash_function hash, equals_function eq, float load_factor,
     perror("calloc failed");
     exit(EXIT_FAILURE);
   }
-  return (hashmap){load_factor, capacity, 0, 0, hash, eq, array};
+  return (hashmap){load_factor, capacity, 0, 0, hash, eq, array, NULL, NULL};
+}
+
+// Creates an empty map whose misses are looked up in `parent`,
+// `parent` must outlive the returned map
+hashmap hashmap_layer(hashmap *parent) {
+  hashmap h = hashmap_init(parent->hash_func, parent->equals_func,
+                           parent->load_factor, 0);
+  h.parent = parent;
+  return h;
+}
+
+// A layer over `parent` that starts in `slots`, `capacity` of them, so a
+// map living as long as its caller's stack frame needs no allocation until
+// it grows. `capacity` should be prime, like any other table size
+hashmap hashmap_frame(hashmap *parent, pair *slots, int capacity) {
+  memset(slots, 0, capacity * sizeof(pair));
+  return (hashmap){parent->load_factor, capacity, 0, 0, parent->hash_func,
+                   parent->equals_func, slots, parent, slots};
 }
 
 // Frees all dynamically associated memory with a hashmap
@@ -117,7 +135,9 @@ void hashmap_free(hashmap *h) {
   if (!h) {
     return;
   }
-  free(h->array);
+  if (h->array != h->slots) {
+    free(h->array);
+  }
   h = NULL;
 }
 
@@ -167,7 +187,8 @@ pair *hashmap_first_avail(hashmap *h, char *key, int *collisions) {
 // `new_cap` should be set to a prime number for best performace
 void hashmap_resize(hashmap *h, int new_cap) {
   if (!new_cap) {
-    new_cap = next_prime(h->capacity);
+    // Doubling keeps inserts amortized O(1) as the table grows
+    new_cap = next_prime(h->capacity * 2);
   }
 
   int old_cap = h->capacity;
@@ -198,7 +219,9 @@ void hashmap_resize(hashmap *h, int new_cap) {
       }
     }
   }
-  free(old_array);
+  if (old_array != h->slots) {
+    free(old_array);
+  }
 }
 
 void hashmap_insert(hashmap *h, char *key, ast_node value) {
@@ -227,15 +250,16 @@ void hashmap_insert(hashmap *h, char *key, ast_node value) {
   *first_avail = new;
 }
 
-// Returns TOMBSTONE if element is not found
+// Returns TOMBSTONE if element is not found in `h` or any of its parents
 // returns value if found
 ast_node hashmap_get(hashmap *h, char *key) {
-  pair *p = hashmap_find(h, key);
-  if (!p) {
-    return (ast_node){.type = tombstone_t};
-  } else {
-    return p->value;
+  for (; h; h = h->parent) {
+    pair *p = hashmap_find(h, key);
+    if (p) {
+      return p->value;
+    }
   }
+  return (ast_node){.type = tombstone_t};
 }
 
 // Returns TOMBSTONE if element is not found
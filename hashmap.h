@@ -1,5 +1,6 @@
 #pragma once
 #include "parse.h"
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -36,7 +37,7 @@ bool value_equals(void *, void *);
 bool str_equals(void *, void *);
 
 // Hashmap
-typedef struct {
+typedef struct hashmap {
   float load_factor;
   int capacity;
   int size;
@@ -44,9 +45,17 @@ typedef struct {
   hash_function hash_func;
   equals_function equals_func;
   pair *array;
+  // Lookups that miss fall through to `parent`, inserts never touch it
+  struct hashmap *parent;
+  // Set by hashmap_frame, the caller's storage `array` starts in
+  pair *slots;
+  // Of the interpreter whose globals this is the root of, see effects.h
+  atomic_uint_fast64_t epoch;
 } hashmap;
 
 hashmap hashmap_init(hash_function, equals_function, float, int);
+hashmap hashmap_layer(hashmap *);
+hashmap hashmap_frame(hashmap *, pair *, int);
 void hashmap_free(hashmap *);
 pair *hashmap_find(hashmap *, char *);
 pair *hashmap_first_avail(hashmap *, char *, int *);
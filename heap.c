@@ -0,0 +1,75 @@
+#include "heap.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct object {
+  struct object *next;
+  void (*finalize)(void *);
+  max_align_t data[];
+} object;
+
+// Pushed to with a CAS so worker threads can allocate without a lock
+struct heap {
+  _Atomic(object *) objects;
+};
+
+static heap process;
+static _Thread_local heap *in_use;
+
+static heap *current(void) { return in_use ? in_use : &process; }
+
+void *heap_alloc(size_t size, void (*finalize)(void *)) {
+  object *o = calloc(1, sizeof(object) + size);
+  if (!o) {
+    perror("calloc failed");
+    exit(EXIT_FAILURE);
+  }
+  heap *h = current();
+  o->finalize = finalize;
+  o->next = atomic_load_explicit(&h->objects, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(
+      &h->objects, &o->next, o, memory_order_release, memory_order_relaxed)) {
+  }
+  return o->data;
+}
+
+void *heap_mark(void) { return atomic_load(&current()->objects); }
+
+static void release(heap *h, void *mark) {
+  // Finalizers run before anything is freed, one may wait on a task that
+  // still uses newer objects. Whatever such tasks allocate meanwhile is
+  // picked up by the next round
+  object *first;
+  while ((first = atomic_exchange(&h->objects, mark)) != mark) {
+    for (object *o = first; o != mark; o = o->next) {
+      if (o->finalize) {
+        o->finalize(o->data);
+      }
+    }
+    while (first != mark) {
+      object *next = first->next;
+      free(first);
+      first = next;
+    }
+  }
+}
+
+void heap_release(void *mark) { release(current(), mark); }
+
+void heap_free_all(void) { heap_release(NULL); }
+
+heap *heap_new(void) { return calloc(1, sizeof(heap)); }
+
+heap *heap_use(heap *h) {
+  heap *previous = in_use;
+  in_use = h;
+  return previous;
+}
+
+heap *heap_current(void) { return in_use; }
+
+void heap_destroy(heap *h) {
+  release(h, NULL);
+  free(h);
+}
@@ -0,0 +1,29 @@
+#ifndef HEAP_H_
+#define HEAP_H_
+#include <stddef.h>
+
+// Runtime values (futures, vectors, ...) outlive the expression that made
+// them and there is no collector, so they are allocated here and all freed
+// together by heap_free_all when the interpreter shuts down.
+// `finalize` may be NULL, it is called with the object before it is freed
+void *heap_alloc(size_t, void (*finalize)(void *));
+void heap_free_all(void);
+
+// Frees everything allocated since the matching heap_mark, so a server
+// request can drop its values without touching the prelude's.
+// No other thread may be allocating while this runs
+void *heap_mark(void);
+void heap_release(void *);
+
+// Each embedded interpreter allocates from a heap of its own, see interp.h.
+// The calls above work on the heap in use by the calling thread, the
+// process wide one unless heap_use was given another
+typedef struct heap heap;
+heap *heap_new(void);
+// Returns the heap that was in use, NULL for the process wide one
+heap *heap_use(heap *);
+heap *heap_current(void);
+// Frees the heap and everything allocated from it
+void heap_destroy(heap *);
+
+#endif // HEAP_H_
@@ -0,0 +1,88 @@
+#include "interp.h"
+#include "ast_walking.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include "program.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct interp {
+  hashmap globals;
+  heap *heap;
+  // Functions defined by earlier calls point into their programs
+  program *programs;
+  int programs_size;
+  int programs_cap;
+  char *output;
+  char *error;
+};
+
+typedef struct request {
+  interp *in;
+  const char *source;
+  ast_node result;
+} request;
+
+interp *interp_new(void) {
+  interp *in = calloc(1, sizeof(interp));
+  in->globals = hashmap_init(fnv_string_hash, str_equals, 0.5, 0);
+  in->heap = heap_new();
+  return in;
+}
+
+static void run(void *arg) {
+  request *r = arg;
+  interp *in = r->in;
+  program p = program_parse(r->source, strlen(r->source));
+  if (in->programs_size == in->programs_cap) {
+    in->programs_cap = in->programs_cap * 2 + 4;
+    in->programs =
+        reallocarray(in->programs, in->programs_cap, sizeof(program));
+  }
+  in->programs[in->programs_size++] = p;
+  struct ast_arr forms = p.root.child;
+  for (int i = 0; i < forms.size; i++) {
+    r->result = auto_ast_walk(forms.child_ast[i], &in->globals);
+  }
+}
+
+const char *interp_eval_string(interp *in, const char *source) {
+  free(in->output);
+  free(in->error);
+  in->output = NULL;
+  request r = {.in = in, .source = source, .result = {.type = tombstone_t}};
+  heap *outer = heap_use(in->heap);
+  in->error = eval_protect(run, &r);
+  if (!in->error) {
+    size_t len;
+    FILE *out = open_memstream(&in->output, &len);
+    ast_fprint(out, r.result);
+    fclose(out);
+  }
+  heap_use(outer);
+  return in->output;
+}
+
+const char *interp_error(interp *in) { return in->error; }
+
+void interp_free(interp *in) {
+  // Untouched futures still read the globals and the programs
+  heap_destroy(in->heap);
+  for (int i = 0; i < in->globals.capacity; i++) {
+    ast_node a = in->globals.array[i].value;
+    if (a.type == function_t) {
+      free(a.value.params);
+    }
+  }
+  hashmap_free(&in->globals);
+  for (int i = 0; i < in->programs_size; i++) {
+    program_free(&in->programs[i]);
+  }
+  free(in->programs);
+  free(in->output);
+  free(in->error);
+  free(in);
+}
@@ -0,0 +1,27 @@
+#ifndef INTERP_H_
+#define INTERP_H_
+
+// The interpreter as a library, built by `make lib` into libschemelike.a
+// and libschemelike.so, see embed_example.c.
+// Interpreters share no mutable state, so each thread can run its own
+// without locking. Only the thread pool behind future and pmap, and an
+// atomic count of suspended generators, are shared by the whole process.
+// Profiling is per thread. One interpreter must not be used by two
+// threads at once
+#define INTERP_API __attribute__((visibility("default")))
+
+typedef struct interp interp;
+
+INTERP_API interp *interp_new(void);
+// Evaluates each top level form of `source` in order, definitions are kept
+// for later calls. Returns the printed value of the last form, valid until
+// the next call, or NULL when evaluation stopped at an error. Forms before
+// the error keep their effects
+INTERP_API const char *interp_eval_string(interp *, const char *source);
+// The message of the error the last call stopped at, NULL if it finished
+INTERP_API const char *interp_error(interp *);
+// Frees every value the interpreter made, waiting for futures it never
+// touched
+INTERP_API void interp_free(interp *);
+
+#endif // INTERP_H_
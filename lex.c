@@ -1,4 +1,5 @@
 #include "lex.h"
+#include "eval.h"
 #include "utils.h"
 #include <assert.h>
 #include <stdio.h>
@@ -105,9 +106,8 @@ token *lex_string(string *source, int *cursor) {
     (*cursor)++;
   }
 
-  fprintf(stderr, "Unclosed string literal around %.*s", 20,
-          &str_val(source)[orig_cursor]);
-  exit(EXIT_FAILURE);
+  eval_error("Unclosed string literal around %.*s", 20,
+             &str_val(source)[orig_cursor]);
 }
 
 token *lex_ident(string *source, int *cursor) {
@@ -163,6 +163,9 @@ token_arr lex(string *source) {
 outer:
   while (cursor < str_len(source)) {
     eat_whitespace(source, &cursor);
+    if (cursor >= str_len(source)) {
+      break; // trailing whitespace
+    }
     for (int i = 0; i < lexer_count; i++) {
       t = lexer_array[i](source, &cursor);
       if (t) {
@@ -170,8 +173,7 @@ outer:
         goto outer;
       }
     }
-    fprintf(stderr, "Unable to lex token at pos: %d\n", cursor);
-    exit(EXIT_FAILURE);
+    eval_error("Unable to lex token at pos: %d", cursor);
   }
 
   return ta;
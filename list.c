@@ -0,0 +1,215 @@
+#include "list.h"
+#include "ast_walking.h"
+#include "closure.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+cons_chunk *list_chunk(cons_chunk *l) {
+  return (cons_chunk *)((uint64_t)l & (0x0000FFFFFFFFFFFF));
+}
+
+uint16_t list_index(cons_chunk *l) { return (uint16_t)((uint64_t)l >> 48); }
+
+static cons_chunk *list_pack(cons_chunk *c, uint16_t index) {
+  return (cons_chunk *)((uint64_t)c | ((uint64_t)index << 48));
+}
+
+static cons_chunk *chunk_new(uint16_t cap, cons_chunk *next) {
+  cons_chunk *c = heap_alloc(sizeof(cons_chunk) + sizeof(cell) * cap, NULL);
+  c->next = next;
+  c->cap = cap;
+  atomic_init(&c->start, cap);
+  return c;
+}
+
+static cell *first(cons_chunk *l) {
+  return &list_chunk(l)->items[list_index(l)];
+}
+
+static cons_chunk *rest(cons_chunk *l) {
+  cons_chunk *c = list_chunk(l);
+  uint16_t i = list_index(l) + 1;
+  return i < c->cap ? list_pack(c, i) : c->next;
+}
+
+ast_node list_node(cons_chunk *l) {
+  return (ast_node){.type = literal_t, .lit_t = cons_t, .value.cons = l};
+}
+
+static cell to_cell(ast_node a) {
+  if (a.type == function_t || a.type == list_t || a.type == tombstone_t) {
+    eval_error("Lists can only hold values");
+  }
+  return (cell){.lit_t = a.lit_t, .value = a.value};
+}
+
+static ast_node from_cell(cell *c) {
+  return (ast_node){.type = literal_t, .lit_t = c->lit_t, .value = c->value};
+}
+
+// Builds a list of `n` values, all in one chunk where they fit
+cons_chunk *list_from(ast_node *values, int64_t n) {
+  cons_chunk *l = NULL;
+  while (n > 0) {
+    uint16_t size = n < UINT16_MAX ? n : UINT16_MAX;
+    cons_chunk *c = chunk_new(size, l);
+    for (uint16_t i = 0; i < size; i++) {
+      c->items[i] = to_cell(values[n - size + i]);
+    }
+    atomic_store(&c->start, 0);
+    l = list_pack(c, 0);
+    n -= size;
+  }
+  return l;
+}
+
+ast_node list_first(cons_chunk *l) { return from_cell(first(l)); }
+
+cons_chunk *list_rest(cons_chunk *l) { return rest(l); }
+
+static int64_t length(cons_chunk *l) {
+  int64_t n = 0;
+  while (l) {
+    cons_chunk *c = list_chunk(l);
+    n += c->cap - list_index(l);
+    l = c->next;
+  }
+  return n;
+}
+
+void list_print(FILE *out, cons_chunk *l) {
+  fputc('(', out);
+  for (; l; l = rest(l)) {
+    ast_fprint(out, from_cell(first(l)));
+    if (rest(l)) {
+      fputc(' ', out);
+    }
+  }
+  fputc(')', out);
+}
+
+static cons_chunk *list_arg(struct ast_arr ast, int i, hashmap *ctx) {
+  ast_node a = auto_ast_walk(ast.child_ast[i], ctx);
+  if (a.lit_t != cons_t) {
+    eval_error("%s expects a list as argument %d", ast.child_ast[0].value.ident,
+               i);
+  }
+  return a.value.cons;
+}
+
+static cons_chunk *nonempty_arg(struct ast_arr ast, hashmap *ctx) {
+  cons_chunk *l = list_arg(ast, 1, ctx);
+  if (!l) {
+    eval_error("%s of an empty list", ast.child_ast[0].value.ident);
+  }
+  return l;
+}
+
+ast_node cons(struct ast_arr ast, hashmap *ctx) {
+  // (cons x l)
+  assert(ast.child_ast[0].lit_t == ident_t);
+  cell x = to_cell(auto_ast_walk(ast.child_ast[1], ctx));
+  cons_chunk *l = list_arg(ast, 2, ctx);
+
+  cons_chunk *c = list_chunk(l);
+  uint16_t i = list_index(l);
+  // Claim the free slot in front of l if nothing else has
+  if (c && i > 0 && atomic_compare_exchange_strong(&c->start, &i, i - 1)) {
+    c->items[i - 1] = x;
+    return list_node(list_pack(c, i - 1));
+  }
+
+  // Lists built up by consing get longer chunks as they grow
+  uint16_t cap = CONS_CHUNK_MIN;
+  if (c && c->cap * 2 > cap) {
+    cap = c->cap * 2 < CONS_CHUNK_MAX ? c->cap * 2 : CONS_CHUNK_MAX;
+  }
+  cons_chunk *fresh = chunk_new(cap, l);
+  fresh->items[cap - 1] = x;
+  atomic_store(&fresh->start, cap - 1);
+  return list_node(list_pack(fresh, cap - 1));
+}
+
+ast_node car(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  return from_cell(first(nonempty_arg(ast, ctx)));
+}
+
+ast_node cdr(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  return list_node(rest(nonempty_arg(ast, ctx)));
+}
+
+ast_node list(struct ast_arr ast, hashmap *ctx) {
+  // (list a b c)
+  assert(ast.child_ast[0].lit_t == ident_t);
+  int64_t n = ast.size - 1;
+  ast_node *values = calloc(n + 1, sizeof(ast_node));
+  for (int64_t i = 0; i < n; i++) {
+    values[i] = auto_ast_walk(ast.child_ast[i + 1], ctx);
+  }
+  cons_chunk *l = list_from(values, n);
+  free(values);
+  return list_node(l);
+}
+
+ast_node list_length(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  return (ast_node){.type = literal_t,
+                    .lit_t = integer_t,
+                    .value.integer = length(list_arg(ast, 1, ctx))};
+}
+
+ast_node is_null(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  return (ast_node){.type = literal_t,
+                    .lit_t = bool_t,
+                    .value.boolean = list_arg(ast, 1, ctx) == NULL};
+}
+
+static ast_node call(ast_node *nodes, int size, hashmap *ctx) {
+  ast_node c = {.type = list_t,
+                .child = {.child_ast = nodes, .size = size, .cap = size}};
+  return ast_walk(c, ctx);
+}
+
+ast_node list_map(struct ast_arr ast, hashmap *ctx) {
+  // (map f l), the result is built in a single chunk
+  //  0   1 2
+  assert(ast.child_ast[0].lit_t == ident_t);
+  closure_buf stack;
+  ast_node nodes[2] = {function_arg(ast, 1, ctx, &stack)};
+  cons_chunk *l = list_arg(ast, 2, ctx);
+  int64_t n = length(l);
+  ast_node *results = calloc(n + 1, sizeof(ast_node));
+  for (int64_t i = 0; l; l = rest(l), i++) {
+    nodes[1] = from_cell(first(l));
+    results[i] = call(nodes, 2, ctx);
+  }
+  cons_chunk *mapped = list_from(results, n);
+  free(results);
+  return list_node(mapped);
+}
+
+ast_node fold(struct ast_arr ast, hashmap *ctx) {
+  // (fold f init l) is (f (f (f init a) b) c) for l = (a b c)
+  //  0    1 2    3
+  assert(ast.child_ast[0].lit_t == ident_t);
+  closure_buf stack;
+  ast_node nodes[3] = {function_arg(ast, 1, ctx, &stack)};
+  ast_node acc = auto_ast_walk(ast.child_ast[2], ctx);
+  cons_chunk *l = list_arg(ast, 3, ctx);
+  for (; l; l = rest(l)) {
+    cell c = to_cell(acc);
+    nodes[1] = from_cell(&c);
+    nodes[2] = from_cell(first(l));
+    acc = call(nodes, 3, ctx);
+  }
+  return acc;
+}
@@ -0,0 +1,52 @@
+#ifndef LIST_H_
+#define LIST_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// One element of a runtime list, lists only hold values so the node's
+// children aren't needed
+typedef struct cell {
+  literal_type lit_t;
+  literal_value value;
+} cell;
+
+// Lists are cdr-coded: consecutive elements share a chunk and only the
+// last one links to the rest of the list. A list value packs the chunk
+// pointer with the index of its first element in the top 16 bits, like
+// `string` does with its length, so the list is items[index..cap) then
+// `next`. The empty list is NULL.
+// Chunks fill from the back, consing onto a list that starts at the front
+// of its chunk's used region takes the slot before it instead of
+// allocating
+typedef struct cons_chunk {
+  struct cons_chunk *next;
+  uint16_t cap;
+  _Atomic uint16_t start; // first used slot
+  cell items[];
+} cons_chunk;
+
+#define CONS_CHUNK_MIN 16
+#define CONS_CHUNK_MAX 4096
+
+cons_chunk *list_chunk(cons_chunk *);
+uint16_t list_index(cons_chunk *);
+ast_node list_node(cons_chunk *);
+cons_chunk *list_from(ast_node *, int64_t);
+// For walking a list, which mustn't be empty
+ast_node list_first(cons_chunk *);
+cons_chunk *list_rest(cons_chunk *);
+void list_print(FILE *, cons_chunk *);
+
+ast_node cons(struct ast_arr ast, hashmap *ctx);
+ast_node car(struct ast_arr ast, hashmap *ctx);
+ast_node cdr(struct ast_arr ast, hashmap *ctx);
+ast_node list(struct ast_arr ast, hashmap *ctx);
+ast_node list_length(struct ast_arr ast, hashmap *ctx);
+ast_node is_null(struct ast_arr ast, hashmap *ctx);
+ast_node list_map(struct ast_arr ast, hashmap *ctx);
+ast_node fold(struct ast_arr ast, hashmap *ctx);
+
+#endif // LIST_H_
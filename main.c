@@ -1,11 +1,22 @@
 #include "ast_walking.h"
+#include "cache.h"
+#include "emit.h"
+#include "eval.h"
 #include "hashmap.h"
+#include "heap.h"
 #include "lex.h"
 #include "parse.h"
+#include "pool.h"
+#include "profile.h"
+#include "program.h"
+#include "scheduler.h"
+#include "server.h"
 #include "utils.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 const char *HEADER = "\033[1;95m";
 const char *OKBLUE = "\033[1;94m";
 const char *OKCYAN = "\033[1;96m";
@@ -15,49 +26,184 @@ const char *FAIL = "\033[1;91m";
 const char *ENDC = "\033[0m";
 const char *UNDERLINE = "\033[4m";
 
+static void free_functions(hashmap *ctx) {
+  for (int i = 0; i < ctx->capacity; i++) {
+    ast_node a = ctx->array[i].value;
+    if (a.type == function_t) {
+      free(a.value.params);
+    }
+  }
+}
+
+static void finish_profile(const char *filename) {
+  if (profiling) {
+    char folded[4096];
+    snprintf(folded, sizeof(folded), "%s.folded",
+             strcmp(filename, "-") ? filename : "stdin");
+    profile_report(stderr);
+    profile_write_folded(folded);
+    profile_free();
+  }
+}
+
+// Evaluates and prints one top level form at a time, see program_stream
+static int run_stream(const char *filename) {
+  int fd = strcmp(filename, "-") ? open(filename, O_RDONLY) : STDIN_FILENO;
+  if (fd < 0) {
+    perror("Unable to open source file");
+    exit(1);
+  }
+  hashmap ctx = hashmap_init(fnv_string_hash, str_equals, 0.5, 0);
+  program kept = program_stream(fd, &ctx);
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+  pool_shutdown();
+  free_functions(&ctx);
+  finish_profile(filename);
+  program_free(&kept);
+  hashmap_free(&ctx);
+  heap_free_all();
+  return 0;
+}
+
+// Writes the C translation of `filename` to `out_path`, see emit.h
+static int emit_program(const char *filename, const char *out_path) {
+  size_t len;
+  char *raw = read_file(filename, &len);
+  if (!raw) {
+    perror("Unable to read source file");
+    exit(1);
+  }
+  program prog = program_parse(raw, len);
+  FILE *out = fopen(out_path, "w");
+  if (!out) {
+    perror("Unable to open output file");
+    exit(1);
+  }
+  emit_c(prog.root, filename, out);
+  fclose(out);
+  program_free(&prog);
+  free(raw);
+  return 0;
+}
+
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    printf("usage: ./%s filename\n", argv[0]);
+  char *filename = NULL;
+  char *socket_path = NULL;
+  char *emit_path = NULL;
+  int workers = 0;
+  int tasks = 0;
+  int64_t fuel = SCHED_DEFAULT_FUEL;
+  bool no_cache = false;
+  bool stream = false;
+  double profile_rate = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--profile")) {
+      profile_rate = 1;
+    } else if (!strncmp(argv[i], "--profile=", 10)) {
+      // Fraction of runs to profile, e.g. --profile=0.01
+      profile_rate = atof(argv[i] + 10);
+    } else if (!strcmp(argv[i], "--stream")) {
+      stream = true;
+    } else if (!strcmp(argv[i], "--no-cache")) {
+      no_cache = true;
+    } else if (!strcmp(argv[i], "--emit-c") && i + 1 < argc) {
+      emit_path = argv[++i];
+    } else if (!strcmp(argv[i], "--serve") && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (!strncmp(argv[i], "--workers=", 10)) {
+      workers = atoi(argv[i] + 10);
+    } else if (!strncmp(argv[i], "--tasks=", 8)) {
+      tasks = atoi(argv[i] + 8);
+    } else if (!strncmp(argv[i], "--fuel=", 7)) {
+      fuel = atoll(argv[i] + 7);
+    } else if (!strncmp(argv[i], "--max-depth=", 12)) {
+      eval_max_depth = atoi(argv[i] + 12);
+    } else if (!filename) {
+      filename = argv[i];
+    } else {
+      filename = NULL;
+      break;
+    }
+  }
+  if (socket_path) {
+    // `filename` is an optional prelude in server mode
+    return serve(socket_path, filename, workers, tasks, fuel);
+  }
+  if (!filename) {
+    printf("usage: ./%s [--profile[=rate]] [--no-cache] [--stream] "
+           "[--max-depth=n] filename\n",
+           argv[0]);
+    printf("       ./%s [--profile[=rate]] - (stream from stdin)\n", argv[0]);
+    printf("       ./%s --serve socket [--workers=n] [--tasks=n [--fuel=n]] "
+           "[prelude]\n",
+           argv[0]);
+    printf("       ./%s --emit-c out.c filename\n", argv[0]);
     exit(1);
   }
+  if (emit_path) {
+    return emit_program(filename, emit_path);
+  }
+  profile_start(profile_rate);
+  if (stream || !strcmp(filename, "-")) {
+    return run_stream(filename);
+  }
   printf("%sSchemelike interpreter!%s\n\n", OKGREEN, ENDC);
   hashmap ctx = hashmap_init(fnv_string_hash, str_equals, 0.5, 0);
 
-  FILE *fp = fopen(argv[1], "r");
-  char raw[1000];
-  size_t read = fread(raw, sizeof(char), 1000, fp);
-  raw[read - 1] = 0;
+  size_t len;
+  char *raw = read_file(filename, &len);
+  if (!raw) {
+    perror("Unable to read source file");
+    exit(1);
+  }
   printf("%sSource code: %s\n", OKBLUE, ENDC);
   puts(raw);
-  fclose(fp);
-
-  string program = str_auto(raw);
 
-  token_arr ta = lex(&program);
-  /* for (int i = 0; i < ta.size; i++) { */
-  /*   token_debug(ta.tokens[i]); */
-  /* } */
-  str_free(&program);
+  // The parsed program is cached next to the source, keyed by its contents
+  char cache_path[4096];
+  snprintf(cache_path, sizeof(cache_path), "%s.slc", filename);
+  cached_program image;
+  bool cached = !no_cache && cache_load(cache_path, raw, len, &image);
 
-  int cursor = 0;
-  ast_node ast = parse(ta, &cursor);
+  program prog = {0};
+  ast_node root;
+  if (cached) {
+    root = image.root;
+  } else {
+    prog = program_parse(raw, len);
+    root = prog.root;
+    if (!no_cache) {
+      cache_store(cache_path, raw, len, root);
+    }
+  }
+  free(raw);
+  struct ast_arr forms = root.child;
   printf("%sAST Representation: %s\n", OKBLUE, ENDC);
-  ast_print(ast);
-  puts("");
+  for (int i = 0; i < forms.size; i++) {
+    ast_print(forms.child_ast[i]);
+    puts("");
+  }
 
-  ast_node result = ast_walk(ast, &ctx);
+  ast_node result = {.type = tombstone_t};
+  for (int i = 0; i < forms.size; i++) {
+    result = eval(forms.child_ast[i], &ctx);
+  }
   printf("%sResult:%s \n", FAIL, ENDC);
   ast_print(result);
   puts("");
+  // Futures that were never touched may still be using the AST
+  pool_shutdown();
 
-  for (int i = 0; i < ctx.capacity; i++) {
-    ast_node a = ctx.array[i].value;
-    if (a.type == function_t) {
-      free(a.value.params);
-    }
-  }
+  free_functions(&ctx);
+  finish_profile(filename);
 
-  ast_node_free(&ast);
-  ta_free(&ta);
+  if (cached) {
+    cache_release(&image);
+  } else {
+    program_free(&prog);
+  }
   hashmap_free(&ctx);
+  heap_free_all();
 }
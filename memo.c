@@ -0,0 +1,273 @@
+#include "memo.h"
+#include "ast_walking.h"
+#include "closure.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "list.h"
+#include "parse.h"
+#include "text.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct key {
+  char *bytes;
+  size_t len;
+  size_t cap;
+  char buf[128];
+} key;
+
+static void key_put(key *k, const void *p, size_t n) {
+  if (k->len + n > k->cap) {
+    k->cap = (k->len + n) * 2;
+    if (k->bytes == k->buf) {
+      k->bytes = memcpy(malloc(k->cap), k->buf, k->len);
+    } else {
+      k->bytes = realloc(k->bytes, k->cap);
+    }
+  }
+  memcpy(&k->bytes[k->len], p, n);
+  k->len += n;
+}
+
+// Appends `a` to the key, false if calls taking it can't be cached
+static bool key_arg(key *k, ast_node a) {
+  char tag = a.lit_t;
+  int64_t bits;
+  switch (a.lit_t) {
+  case integer_t:
+  case floating_t:
+    bits = a.value.integer; // copies the bits of either type
+    break;
+  case bool_t:
+    bits = a.value.boolean;
+    break;
+  case string_t:
+  case text_t: {
+    // Literals and runtime strings with the same bytes are the same key
+    tag = string_t;
+    text *t = text_of(a);
+    char buf[TEXT_INLINE_MAX];
+    bits = text_len(t);
+    key_put(k, &tag, 1);
+    key_put(k, &bits, sizeof(bits));
+    key_put(k, text_bytes(t, buf), bits);
+    return true;
+  }
+  default:
+    return false;
+  }
+  key_put(k, &tag, 1);
+  key_put(k, &bits, sizeof(bits));
+  return true;
+}
+
+static uint64_t key_hash(key *k) {
+  uint64_t h = 0xcbf29ce484222325;
+  for (size_t i = 0; i < k->len; i++) {
+    h = (h ^ (unsigned char)k->bytes[i]) * 0x100000001b3;
+  }
+  return h;
+}
+
+static bool cacheable_result(ast_node a) {
+  return a.type == literal_t && (a.lit_t == integer_t ||
+                                 a.lit_t == floating_t || a.lit_t == bool_t);
+}
+
+// The index slot holding the entry for `k`, or the empty slot it would go in
+static int32_t *slot_of(memo *m, uint64_t hash, key *k) {
+  for (int32_t i = hash & m->mask;; i = (i + 1) & m->mask) {
+    int32_t e = m->index[i];
+    if (e < 0) {
+      return &m->index[i];
+    }
+    memo_entry *entry = &m->entries[e];
+    if (entry->hash == hash && entry->len == k->len &&
+        !memcmp(entry->key, k->bytes, k->len)) {
+      return &m->index[i];
+    }
+  }
+}
+
+// Backward shift deletion, so probes never need tombstones
+static void unindex(memo *m, int32_t e) {
+  int32_t i = m->entries[e].hash & m->mask;
+  while (m->index[i] != e) {
+    i = (i + 1) & m->mask;
+  }
+  for (int32_t j = (i + 1) & m->mask; m->index[j] >= 0; j = (j + 1) & m->mask) {
+    int32_t home = m->entries[m->index[j]].hash & m->mask;
+    // Entries whose home is cyclically in (i, j] are already reachable
+    bool reachable = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+    if (!reachable) {
+      m->index[i] = m->index[j];
+      i = j;
+    }
+  }
+  m->index[i] = -1;
+}
+
+static int32_t clock_evict(memo *m) {
+  while (m->entries[m->hand].referenced) {
+    m->entries[m->hand].referenced = false;
+    m->hand = (m->hand + 1) % m->cap;
+  }
+  int32_t e = m->hand;
+  m->hand = (m->hand + 1) % m->cap;
+  unindex(m, e);
+  free(m->entries[e].key);
+  return e;
+}
+
+static void insert(memo *m, uint64_t hash, key *k, ast_node result) {
+  if (*slot_of(m, hash, k) >= 0) {
+    // Another thread made the same call meanwhile
+    return;
+  }
+  int32_t e = m->size < m->cap ? m->size++ : clock_evict(m);
+  m->entries[e] = (memo_entry){.hash = hash,
+                               .len = k->len,
+                               .key = memcpy(malloc(k->len + 1), k->bytes, k->len),
+                               .result = result};
+  *slot_of(m, hash, k) = e;
+}
+
+ast_node memo_call(memo *m, struct ast_arr call, hashmap *ctx) {
+  ast_node nodes[call.size];
+  nodes[0] = m->fn;
+  key k = {.bytes = k.buf, .cap = sizeof(k.buf)};
+  bool cacheable = true;
+  for (int i = 1; i < call.size; i++) {
+    nodes[i] = auto_ast_walk(call.child_ast[i], ctx);
+    cacheable = cacheable && key_arg(&k, nodes[i]);
+  }
+  ast_node c = {.type = list_t,
+                .child = {.child_ast = nodes, .size = call.size, .cap = call.size}};
+  if (!cacheable) {
+    if (k.bytes != k.buf) {
+      free(k.bytes);
+    }
+    return ast_walk(c, ctx);
+  }
+
+  uint64_t hash = key_hash(&k);
+  pthread_mutex_lock(&m->lock);
+  int32_t e = *slot_of(m, hash, &k);
+  if (e >= 0) {
+    m->entries[e].referenced = true;
+    m->hits++;
+    ast_node result = m->entries[e].result;
+    pthread_mutex_unlock(&m->lock);
+    if (k.bytes != k.buf) {
+      free(k.bytes);
+    }
+    return result;
+  }
+  m->misses++;
+  pthread_mutex_unlock(&m->lock);
+
+  // The lock isn't held while the function runs, it may call itself
+  ast_node result = ast_walk(c, ctx);
+  if (cacheable_result(result)) {
+    pthread_mutex_lock(&m->lock);
+    insert(m, hash, &k, result);
+    pthread_mutex_unlock(&m->lock);
+  }
+  if (k.bytes != k.buf) {
+    free(k.bytes);
+  }
+  return result;
+}
+
+static void memo_finalize(void *p) {
+  memo *m = p;
+  for (int i = 0; i < m->size; i++) {
+    free(m->entries[i].key);
+  }
+  free(m->entries);
+  free(m->index);
+  pthread_mutex_destroy(&m->lock);
+  if (m->owns_fn) {
+    free(m->fn.value.params);
+  }
+}
+
+static memo *memo_new(ast_node fn, int64_t cap, bool owns_fn) {
+  memo *m = heap_alloc(sizeof(memo), memo_finalize);
+  // The index needs a power of two of at least two slots per entry
+  int slots = 2;
+  while (slots < cap * 2) {
+    slots *= 2;
+  }
+  *m = (memo){.fn = fn,
+              .cap = cap,
+              .owns_fn = owns_fn,
+              .mask = slots - 1,
+              .index = malloc(slots * sizeof(int32_t)),
+              .entries = calloc(cap, sizeof(memo_entry))};
+  memset(m->index, -1, slots * sizeof(int32_t));
+  pthread_mutex_init(&m->lock, NULL);
+  return m;
+}
+
+ast_node memo_node(memo *m) {
+  return (ast_node){.type = literal_t, .lit_t = memo_t, .value.memo = m};
+}
+
+ast_node defmemo(struct ast_arr ast, hashmap *ctx) {
+  // (defmemo fib (n) body), a func whose results are cached
+  //  0       1   2   3
+  assert(ast.child_ast[0].lit_t == ident_t);
+  ast_node fn = func(ast, ctx);
+  memo *m = memo_new(fn, MEMO_DEFAULT_CAP, fn.type == function_t);
+  if (fn.lit_t == closure_t) {
+    // Its recursive calls go through the cache too
+    fn.value.closure->memo = m;
+  }
+  return bind_ident(ctx, ast.child_ast[1].value.ident, memo_node(m));
+}
+
+ast_node memoize(struct ast_arr ast, hashmap *ctx) {
+  // (memoize f) or (memoize f capacity), a cached version of f. Calls f
+  // makes to itself by name aren't cached
+  //  0       1  2
+  assert(ast.child_ast[0].lit_t == ident_t);
+  if (ast.size < 2 || ast.size > 3) {
+    eval_error("memoize expects a function and maybe a capacity");
+  }
+  ast_node fn = auto_ast_walk(ast.child_ast[1], ctx);
+  if (!is_function(fn)) {
+    eval_error("memoize expects a function");
+  }
+  int64_t cap = MEMO_DEFAULT_CAP;
+  if (ast.size == 3) {
+    ast_node a = auto_ast_walk(ast.child_ast[2], ctx);
+    if (a.lit_t != integer_t || a.value.integer < 1 ||
+        a.value.integer > INT32_MAX / 4) {
+      eval_error("memoize expects a positive capacity");
+    }
+    cap = a.value.integer;
+  }
+  return memo_node(memo_new(fn, cap, false));
+}
+
+ast_node memo_stats(struct ast_arr ast, hashmap *ctx) {
+  // (memo-stats f), the list (hits misses entries) of a memoized function
+  assert(ast.child_ast[0].lit_t == ident_t);
+  ast_node fn = auto_ast_walk(ast.child_ast[1], ctx);
+  if (fn.lit_t != memo_t) {
+    eval_error("memo-stats expects a memoized function");
+  }
+  memo *m = fn.value.memo;
+  pthread_mutex_lock(&m->lock);
+  ast_node stats[3] = {
+      {.type = literal_t, .lit_t = integer_t, .value.integer = m->hits},
+      {.type = literal_t, .lit_t = integer_t, .value.integer = m->misses},
+      {.type = literal_t, .lit_t = integer_t, .value.integer = m->size},
+  };
+  pthread_mutex_unlock(&m->lock);
+  return list_node(list_from(stats, 3));
+}
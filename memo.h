@@ -0,0 +1,48 @@
+#ifndef MEMO_H_
+#define MEMO_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// A cached result, keyed on the call's arguments flattened to bytes
+typedef struct memo_entry {
+  uint64_t hash;
+  uint32_t len;
+  bool referenced; // set by hits, cleared as the clock hand passes
+  char *key;
+  ast_node result;
+} memo_entry;
+
+// A function wrapped in a result cache of at most `cap` entries. When it
+// is full the clock hand evicts the first entry not hit since the hand
+// last passed it. `index` maps hashes to entries by linear probing, its
+// slots are a power of two at least twice `cap`, less one in `mask`.
+// Only calls whose arguments are numbers, bools or strings and whose
+// result is a number or bool are cached, anything else just runs
+typedef struct memo {
+  ast_node fn;
+  bool owns_fn; // made by defmemo, its params are freed with the memo
+  pthread_mutex_t lock;
+  int cap;
+  int size;
+  int hand;
+  int32_t mask;
+  int32_t *index;
+  memo_entry *entries;
+  int64_t hits;
+  int64_t misses;
+} memo;
+
+#define MEMO_DEFAULT_CAP 4096
+
+ast_node memo_node(memo *);
+// `call` is the call being made, its arguments are evaluated in `ctx`
+ast_node memo_call(memo *, struct ast_arr call, hashmap *ctx);
+
+ast_node defmemo(struct ast_arr ast, hashmap *ctx);
+ast_node memoize(struct ast_arr ast, hashmap *ctx);
+ast_node memo_stats(struct ast_arr ast, hashmap *ctx);
+
+#endif // MEMO_H_
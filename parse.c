@@ -1,6 +1,13 @@
 #include "parse.h"
+#include "bignum.h"
+#include "eval.h"
 #include "lex.h"
+#include "list.h"
+#include "text.h"
+#include "vector.h"
 #include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,10 +20,23 @@ ast_node ast_node_init() {
           .child_ast = calloc(sizeof(ast_node), 4), .size = 0, .cap = 4}};
 }
 
+static void site_free(ast_node *a) {
+  void *site = atomic_load(&a->child.site);
+  if (!((uintptr_t)site & 1)) {
+    free(site);
+  }
+}
+
 void ast_node_free(ast_node *a) {
   if (a->type == function_t) {
     free(a->value.params);
   }
+  if (a->type == literal_t) {
+    site_free(a);
+    if (a->lit_t == bignum_t) {
+      free(a->value.bignum);
+    }
+  }
   if (a->type == list_t) {
     for (int i = 0; i < a->child.size; i++) {
       ast_node_free(&a->child.child_ast[i]);
@@ -25,41 +45,81 @@ void ast_node_free(ast_node *a) {
   }
 }
 
-void ast_print(ast_node node) {
+void ast_sites_free(ast_node *a) {
+  if (a->type == literal_t) {
+    site_free(a);
+    a->child.site = NULL;
+  }
+  if (a->type == list_t) {
+    for (int i = 0; i < a->child.size; i++) {
+      ast_sites_free(&a->child.child_ast[i]);
+    }
+  }
+}
+
+void ast_fprint(FILE *out, ast_node node) {
   if (node.type == literal_t) {
     switch (node.lit_t) {
     case integer_t:
-      printf("%ld", node.value.integer);
+      fprintf(out, "%ld", node.value.integer);
       return;
     case floating_t:
-      printf("%f", node.value.floating);
+      fprintf(out, "%f", node.value.floating);
       return;
     case bool_t:
-      printf("%s", node.value.boolean ? "true" : "false");
+      fprintf(out, "%s", node.value.boolean ? "true" : "false");
       return;
     case string_t:
-      printf("\"%s\"", node.value.string);
+      fprintf(out, "\"%s\"", node.value.string);
       return;
     case ident_t:
-      printf("%s", node.value.ident);
+      fprintf(out, "%s", node.value.ident);
+      return;
+    case future_t:
+      fprintf(out, "#<future>");
+      return;
+    case vector_t:
+      vector_print(out, node.value.vector);
+      return;
+    case cons_t:
+      list_print(out, node.value.cons);
+      return;
+    case text_t:
+      text_print(out, node.value.text);
+      return;
+    case closure_t:
+      fprintf(out, "#<lambda>");
+      return;
+    case memo_t:
+      fprintf(out, "#<memo>");
+      return;
+    case bignum_t:
+      bignum_print(out, node.value.bignum);
+      return;
+    case generator_t:
+      fprintf(out, "#<generator>");
+      return;
+    case stream_t:
+      fprintf(out, "#<stream>");
       return;
     default:
-      fprintf(stderr, "Unreachable\n");
-      exit(1);
+      eval_error("Unreachable");
     }
   }
 
-  printf("(");
+  fputc('(', out);
   for (int i = 0; i < node.child.size; i++) {
-    ast_print(node.child.child_ast[i]);
+    ast_fprint(out, node.child.child_ast[i]);
     if (i != node.child.size - 1) {
-      printf(" ");
+      fputc(' ', out);
     }
   }
-  printf(")");
+  fputc(')', out);
   return;
 }
 
+void ast_print(ast_node node) { ast_fprint(stdout, node); }
+
 void ast_node_pb(ast_node *outer, ast_node child) {
   assert(outer->type == list_t);
   if (outer->child.size + 1 >= outer->child.cap) {
@@ -74,8 +134,7 @@ ast_node parse(token_arr tokens, int *index) {
   ast_node ast = ast_node_init();
   token t = tokens.tokens[*index];
   if (t.type != syntax_type || strcmp(t.value, "(")) {
-    fprintf(stderr, "Error parsing, must start with `(`\n");
-    exit(EXIT_FAILURE);
+    eval_error("Error parsing, must start with `(`");
   }
   (*index)++; // skip past `(` token
 
@@ -96,8 +155,12 @@ ast_node parse(token_arr tokens, int *index) {
     ast_node literal = {.type = literal_t};
     switch (t.type) {
     case integer_type:
+      errno = 0;
       literal.lit_t = integer_t;
-      literal.value.integer = atoi(t.value);
+      literal.value.integer = strtoll(t.value, NULL, 10);
+      if (errno == ERANGE) {
+        literal = bignum_parse(t.value, false);
+      }
       break;
     case floating_type:
       literal.lit_t = floating_t;
@@ -116,8 +179,7 @@ ast_node parse(token_arr tokens, int *index) {
       literal.value.ident = t.value;
       break;
     default:
-      fprintf(stderr, "Unreachable, token: %s\n", t.value);
-      exit(EXIT_FAILURE);
+      eval_error("Unreachable, token: %s", t.value);
     }
     ast_node_pb(&ast, literal);
     (*index)++;
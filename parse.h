@@ -2,6 +2,7 @@
 #define PARSE_H_
 #include "lex.h"
 #include <stdbool.h>
+#include <stdio.h>
 
 typedef enum ast_type {
   literal_t,
@@ -18,6 +19,15 @@ typedef enum literal_type {
   string_t,
   ident_t,
   params_t,
+  future_t,
+  vector_t,
+  cons_t,
+  text_t,
+  closure_t,
+  memo_t,
+  bignum_t,
+  generator_t,
+  stream_t,
 } literal_type;
 
 typedef union literal_value {
@@ -27,12 +37,27 @@ typedef union literal_value {
   double floating;
   bool boolean;
   char **params; // struct ast_node*
+  struct future *future;
+  struct vector *vector;
+  struct cons_chunk *cons; // packed, see list.h
+  struct text *text;       // tagged, see text.h
+  struct closure *closure;
+  struct memo *memo;
+  struct bignum *bignum;
+  struct generator *generator;
+  struct stream *stream;
 } literal_value;
 
 typedef struct ast_node {
   ast_type type;
   struct ast_arr {
-    struct ast_node *child_ast;
+    union {
+      struct ast_node *child_ast;
+      // Literals have no children. The head of a call may instead carry
+      // data its builtin built for that call site, freed with the tree.
+      // A site with its low bit set is a small value, not an allocation
+      _Atomic(void *) site;
+    };
     int size;
     int cap;
   } child;
@@ -40,8 +65,12 @@ typedef struct ast_node {
   literal_value value;
 } ast_node;
 
-ast_node ast_node_int();
+ast_node ast_node_init();
 void ast_node_free(ast_node *);
+// Frees only the call site data, for trees whose nodes aren't malloc'd
+void ast_sites_free(ast_node *);
+void ast_fprint(FILE *, ast_node);
+// To stdout
 void ast_print(ast_node);
 void ast_node_pb(ast_node *, ast_node);
 ast_node parse(token_arr, int *);
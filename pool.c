@@ -0,0 +1,223 @@
+#include "pool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct task {
+  task_fn fn;
+  void *arg;
+} task;
+
+// Ring buffer, `cap` is a power of 2 and the indices only ever grow
+typedef struct deque {
+  pthread_mutex_t lock;
+  task *tasks;
+  uint64_t head; // thieves take from here
+  uint64_t tail; // the owner pushes and pops here
+  uint64_t cap;
+} deque;
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic(bool) started;
+static int workers;
+static deque *deques;
+static pthread_t *threads;
+static _Thread_local int self = -1;
+static atomic_uint next_deque;
+
+// Idle workers sleep on `idle` until something is queued
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static atomic_int queued;
+static atomic_int running;
+static bool stopping;
+
+static void deque_push(deque *d, task t) {
+  pthread_mutex_lock(&d->lock);
+  if (d->tail - d->head == d->cap) {
+    task *grown = calloc(d->cap * 2, sizeof(task));
+    for (uint64_t i = d->head; i < d->tail; i++) {
+      grown[i & (d->cap * 2 - 1)] = d->tasks[i & (d->cap - 1)];
+    }
+    free(d->tasks);
+    d->tasks = grown;
+    d->cap *= 2;
+  }
+  d->tasks[d->tail++ & (d->cap - 1)] = t;
+  pthread_mutex_unlock(&d->lock);
+}
+
+static bool deque_pop(deque *d, task *t) {
+  bool found = false;
+  pthread_mutex_lock(&d->lock);
+  if (d->tail != d->head) {
+    *t = d->tasks[--d->tail & (d->cap - 1)];
+    found = true;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+static bool deque_steal(deque *d, task *t) {
+  bool found = false;
+  pthread_mutex_lock(&d->lock);
+  if (d->tail != d->head) {
+    *t = d->tasks[d->head++ & (d->cap - 1)];
+    found = true;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+// A task is counted as running before it stops being queued, so
+// pool_drain never sees both counts at 0 while one is in flight
+static bool take(task *t) {
+  atomic_fetch_add(&running, 1);
+  if (self >= 0 && deque_pop(&deques[self], t)) {
+    atomic_fetch_sub(&queued, 1);
+    return true;
+  }
+  int start = self >= 0 ? self + 1 : 0;
+  for (int i = 0; i < workers; i++) {
+    if (deque_steal(&deques[(start + i) % workers], t)) {
+      atomic_fetch_sub(&queued, 1);
+      return true;
+    }
+  }
+  atomic_fetch_sub(&running, 1);
+  return false;
+}
+
+static void run(task t) {
+  t.fn(t.arg);
+  atomic_fetch_sub(&running, 1);
+}
+
+static void *worker_main(void *arg) {
+  self = (int)(intptr_t)arg;
+  for (;;) {
+    task t;
+    if (take(&t)) {
+      run(t);
+      continue;
+    }
+    pthread_mutex_lock(&idle_lock);
+    while (!atomic_load(&queued) && !stopping) {
+      pthread_cond_wait(&idle, &idle_lock);
+    }
+    bool done = stopping && !atomic_load(&queued);
+    pthread_mutex_unlock(&idle_lock);
+    if (done) {
+      return NULL;
+    }
+  }
+}
+
+static void pool_start(void) {
+  workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers < 1) {
+    workers = 1;
+  }
+  deques = calloc(workers, sizeof(deque));
+  threads = calloc(workers, sizeof(pthread_t));
+  for (int i = 0; i < workers; i++) {
+    pthread_mutex_init(&deques[i].lock, NULL);
+    deques[i].cap = 16;
+    deques[i].tasks = calloc(deques[i].cap, sizeof(task));
+  }
+  for (int i = 0; i < workers; i++) {
+    if (pthread_create(&threads[i], NULL, worker_main, (void *)(intptr_t)i)) {
+      perror("pthread_create failed");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+void pool_submit(task_fn fn, void *arg) {
+  if (!atomic_load_explicit(&started, memory_order_acquire)) {
+    pthread_mutex_lock(&start_lock);
+    if (!started) {
+      pool_start();
+      atomic_store_explicit(&started, true, memory_order_release);
+    }
+    pthread_mutex_unlock(&start_lock);
+  }
+  int d = self >= 0 ? self : atomic_fetch_add(&next_deque, 1) % workers;
+  deque_push(&deques[d], (task){fn, arg});
+
+  pthread_mutex_lock(&idle_lock);
+  atomic_fetch_add(&queued, 1);
+  pthread_cond_signal(&idle);
+  pthread_mutex_unlock(&idle_lock);
+}
+
+bool pool_help(void) {
+  if (!atomic_load_explicit(&started, memory_order_acquire)) {
+    return false;
+  }
+  task t;
+  if (!take(&t)) {
+    return false;
+  }
+  run(t);
+  return true;
+}
+
+int pool_idle(void) {
+  // The caller is busy too unless it's a worker, which counts as running
+  int busy = self < 0;
+  if (!atomic_load_explicit(&started, memory_order_acquire)) {
+    static atomic_int cores;
+    int n = atomic_load_explicit(&cores, memory_order_relaxed);
+    if (!n) {
+      n = sysconf(_SC_NPROCESSORS_ONLN);
+      n = n < 1 ? 1 : n;
+      atomic_store_explicit(&cores, n, memory_order_relaxed);
+    }
+    return n - busy;
+  }
+  int idle = workers - busy - atomic_load(&running) - atomic_load(&queued);
+  return idle > 0 ? idle : 0;
+}
+
+bool pool_busy(void) {
+  return atomic_load_explicit(&started, memory_order_acquire) &&
+         (atomic_load(&queued) || atomic_load(&running));
+}
+
+void pool_drain(void) {
+  if (!atomic_load_explicit(&started, memory_order_acquire)) {
+    return;
+  }
+  while (atomic_load(&queued) || atomic_load(&running)) {
+    if (!pool_help()) {
+      sched_yield();
+    }
+  }
+}
+
+void pool_shutdown(void) {
+  if (!atomic_load(&started)) {
+    return;
+  }
+  pthread_mutex_lock(&idle_lock);
+  stopping = true;
+  pthread_cond_broadcast(&idle);
+  pthread_mutex_unlock(&idle_lock);
+  for (int i = 0; i < workers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  for (int i = 0; i < workers; i++) {
+    pthread_mutex_destroy(&deques[i].lock);
+    free(deques[i].tasks);
+  }
+  free(deques);
+  free(threads);
+  deques = NULL;
+  stopping = false;
+  atomic_store(&started, false);
+}
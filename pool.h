@@ -0,0 +1,27 @@
+#ifndef POOL_H_
+#define POOL_H_
+#include <stdbool.h>
+
+// Work stealing thread pool, one worker and one deque per online core.
+// Workers push and pop their own deque LIFO and steal FIFO from the others,
+// threads outside the pool submit round robin. Started on first submit.
+typedef void (*task_fn)(void *);
+
+void pool_submit(task_fn, void *);
+// Runs one queued task on the calling thread, returns false if none was
+// found. Used by threads that are waiting on a result so they never block
+// while work they depend on sits in a queue.
+bool pool_help(void);
+// Cores with nothing to do, not counting the caller's, as a hint for
+// whether handing work to the pool would get it done any sooner
+int pool_idle(void);
+// Whether any task is queued or running. Only a hint unless the caller
+// is the one that would submit the next task
+bool pool_busy(void);
+// Helps until nothing is queued or running
+void pool_drain(void);
+// Drains every queued task then joins the workers, the next submit
+// starts a fresh pool
+void pool_shutdown(void);
+
+#endif // POOL_H_
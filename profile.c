@@ -0,0 +1,262 @@
+#include "profile.h"
+#include "hashmap.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+_Thread_local bool profiling = false;
+
+typedef struct prof_func {
+  char *name;
+  uint64_t hash;
+  uint64_t calls;
+  uint64_t self_ns;
+  uint64_t inclusive_ns;
+  // Recursion depth, only the outermost activation adds inclusive time
+  int active;
+} prof_func;
+
+// One node per unique call stack, used for the folded output
+typedef struct prof_node {
+  int func;
+  int parent;
+  uint64_t self_ns;
+} prof_node;
+
+typedef struct prof_frame {
+  int func;
+  int node;
+  uint64_t start;
+  uint64_t child_ns;
+} prof_frame;
+
+// Open addressed tables of indices into `funcs` and `nodes`, -1 is empty
+typedef struct prof_table {
+  int *slots;
+  int cap;
+} prof_table;
+
+// Like `profiling`, each thread profiles into tables of its own
+static _Thread_local prof_func *funcs;
+static _Thread_local int funcs_size, funcs_cap;
+static _Thread_local prof_table func_table;
+
+static _Thread_local prof_node *nodes;
+static _Thread_local int nodes_size, nodes_cap;
+static _Thread_local prof_table node_table;
+
+static _Thread_local prof_frame *frames;
+static _Thread_local int frames_size, frames_cap;
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void table_init(prof_table *t, int cap) {
+  t->cap = cap;
+  t->slots = malloc(sizeof(int) * cap);
+  memset(t->slots, -1, sizeof(int) * cap);
+}
+
+static uint64_t node_hash(int parent, int func) {
+  return ((uint64_t)parent << 32 | (uint32_t)func) * 0x9E3779B97F4A7C15ull;
+}
+
+// `cap` is always a power of 2, so masking replaces the modulo
+static void table_grow(prof_table *t, uint64_t (*hash_of)(int)) {
+  int old_cap = t->cap;
+  int *old_slots = t->slots;
+  table_init(t, old_cap * 2);
+  for (int i = 0; i < old_cap; i++) {
+    if (old_slots[i] == -1) {
+      continue;
+    }
+    uint64_t index = hash_of(old_slots[i]) & (t->cap - 1);
+    while (t->slots[index] != -1) {
+      index = (index + 1) & (t->cap - 1);
+    }
+    t->slots[index] = old_slots[i];
+  }
+  free(old_slots);
+}
+
+static uint64_t func_hash_of(int i) { return funcs[i].hash; }
+static uint64_t node_hash_of(int i) {
+  return node_hash(nodes[i].parent, nodes[i].func);
+}
+
+static int intern_func(const char *name) {
+  uint64_t hash = fnv_string_hash((void *)name);
+  uint64_t index = hash & (func_table.cap - 1);
+  for (;; index = (index + 1) & (func_table.cap - 1)) {
+    int i = func_table.slots[index];
+    if (i == -1) {
+      break;
+    }
+    if (funcs[i].hash == hash && !strcmp(funcs[i].name, name)) {
+      return i;
+    }
+  }
+
+  if (funcs_size + 1 >= funcs_cap) {
+    funcs_cap *= 2;
+    funcs = reallocarray(funcs, funcs_cap, sizeof(prof_func));
+  }
+  funcs[funcs_size] = (prof_func){.name = strdup(name), .hash = hash};
+  func_table.slots[index] = funcs_size;
+  if ((funcs_size + 1) * 2 > func_table.cap) {
+    table_grow(&func_table, func_hash_of);
+  }
+  return funcs_size++;
+}
+
+static int intern_node(int parent, int func) {
+  uint64_t index = node_hash(parent, func) & (node_table.cap - 1);
+  for (;; index = (index + 1) & (node_table.cap - 1)) {
+    int i = node_table.slots[index];
+    if (i == -1) {
+      break;
+    }
+    if (nodes[i].parent == parent && nodes[i].func == func) {
+      return i;
+    }
+  }
+
+  if (nodes_size + 1 >= nodes_cap) {
+    nodes_cap *= 2;
+    nodes = reallocarray(nodes, nodes_cap, sizeof(prof_node));
+  }
+  nodes[nodes_size] = (prof_node){.func = func, .parent = parent};
+  node_table.slots[index] = nodes_size;
+  if ((nodes_size + 1) * 2 > node_table.cap) {
+    table_grow(&node_table, node_hash_of);
+  }
+  return nodes_size++;
+}
+
+void profile_start(double sample_rate) {
+  if (sample_rate <= 0) {
+    return;
+  }
+  srand48(time(NULL) ^ getpid());
+  if (sample_rate < 1 && drand48() >= sample_rate) {
+    return;
+  }
+
+  funcs_cap = 16;
+  funcs = calloc(funcs_cap, sizeof(prof_func));
+  table_init(&func_table, 32);
+  nodes_cap = 16;
+  nodes = calloc(nodes_cap, sizeof(prof_node));
+  table_init(&node_table, 32);
+  frames_cap = 16;
+  frames = calloc(frames_cap, sizeof(prof_frame));
+  profiling = true;
+}
+
+void profile_enter(const char *name) {
+  int func = intern_func(name);
+  int parent = frames_size ? frames[frames_size - 1].node : -1;
+  if (frames_size + 1 >= frames_cap) {
+    frames_cap *= 2;
+    frames = reallocarray(frames, frames_cap, sizeof(prof_frame));
+  }
+  funcs[func].calls++;
+  funcs[func].active++;
+  frames[frames_size++] = (prof_frame){
+      .func = func, .node = intern_node(parent, func), .start = now_ns()};
+}
+
+void profile_exit(void) {
+  uint64_t end = now_ns();
+  prof_frame f = frames[--frames_size];
+  uint64_t elapsed = end - f.start;
+  uint64_t self = elapsed - f.child_ns;
+
+  funcs[f.func].self_ns += self;
+  nodes[f.node].self_ns += self;
+  if (--funcs[f.func].active == 0) {
+    funcs[f.func].inclusive_ns += elapsed;
+  }
+  if (frames_size) {
+    frames[frames_size - 1].child_ns += elapsed;
+  }
+}
+
+static int by_self_time(const void *a, const void *b) {
+  uint64_t x = funcs[*(const int *)a].self_ns;
+  uint64_t y = funcs[*(const int *)b].self_ns;
+  return (x < y) - (x > y);
+}
+
+void profile_report(FILE *out) {
+  if (!profiling) {
+    return;
+  }
+  uint64_t total = 0;
+  int *order = malloc(sizeof(int) * (funcs_size + 1));
+  for (int i = 0; i < funcs_size; i++) {
+    order[i] = i;
+    total += funcs[i].self_ns;
+  }
+  qsort(order, funcs_size, sizeof(int), by_self_time);
+
+  fprintf(out, "%10s %12s %7s %12s  %s\n", "calls", "self ms", "self %",
+          "total ms", "function");
+  for (int i = 0; i < funcs_size; i++) {
+    prof_func f = funcs[order[i]];
+    fprintf(out, "%10lu %12.3f %6.2f%% %12.3f  %s\n", f.calls, f.self_ns / 1e6,
+            total ? 100.0 * f.self_ns / total : 0.0, f.inclusive_ns / 1e6,
+            f.name);
+  }
+  free(order);
+}
+
+void profile_write_folded(const char *path) {
+  if (!profiling) {
+    return;
+  }
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    perror("Unable to open folded stack file");
+    return;
+  }
+
+  int *stack = malloc(sizeof(int) * (nodes_size + 1));
+  for (int i = 0; i < nodes_size; i++) {
+    if (!nodes[i].self_ns) {
+      continue;
+    }
+    int depth = 0;
+    for (int n = i; n != -1; n = nodes[n].parent) {
+      stack[depth++] = nodes[n].func;
+    }
+    while (depth--) {
+      fprintf(fp, "%s%c", funcs[stack[depth]].name, depth ? ';' : ' ');
+    }
+    fprintf(fp, "%lu\n", nodes[i].self_ns);
+  }
+  free(stack);
+  fclose(fp);
+}
+
+void profile_free(void) {
+  if (!profiling) {
+    return;
+  }
+  for (int i = 0; i < funcs_size; i++) {
+    free(funcs[i].name);
+  }
+  free(funcs);
+  free(func_table.slots);
+  free(nodes);
+  free(node_table.slots);
+  free(frames);
+  profiling = false;
+}
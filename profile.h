@@ -0,0 +1,23 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Set by profile_start, checked before every enter/exit so a run that
+// isn't being profiled only pays for a branch per call. Thread local, only
+// the thread that called profile_start is profiled.
+extern _Thread_local bool profiling;
+
+// `sample_rate` is the probability (0.0 - 1.0) that this run is profiled
+void profile_start(double sample_rate);
+void profile_enter(const char *);
+void profile_exit(void);
+
+// Per function calls, self time and inclusive time, sorted by self time
+void profile_report(FILE *);
+// One `caller;callee self_ns` line per unique stack, for flamegraph.pl
+void profile_write_folded(const char *);
+void profile_free(void);
+
+#endif // PROFILE_H_
@@ -0,0 +1,294 @@
+#include "program.h"
+#include "ast_walking.h"
+#include "eval.h"
+#include "generator.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "lex.h"
+#include "parse.h"
+#include "pool.h"
+#include "utils.h"
+#include <sched.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct chunk {
+  const char *start;
+  size_t len;
+  size_t offset; // of `start` in the whole source
+  token_arr ta;
+  ast_node forms;
+  atomic_bool done;
+} chunk;
+
+typedef struct form_scan {
+  size_t i;
+  int depth;
+} form_scan;
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n'; }
+
+// Resumable scan for the end of a top level form. Follows the token rules
+// in lex.c, so parens inside string literals and identifiers don't count
+// towards the depth. Returns true once a form closes, `i` is then just past
+// it. Otherwise `i` is left at the start of the last token, which may
+// continue past `len` unless `at_eof` is set.
+static bool scan_form(form_scan *sc, const char *s, size_t len, bool at_eof) {
+  while (sc->i < len) {
+    size_t i = sc->i;
+    char c = s[i];
+    if (is_space(c)) {
+      sc->i++;
+      continue;
+    } else if (c == '(') {
+      sc->depth++;
+      sc->i++;
+      continue;
+    } else if (c == ')') {
+      sc->i++;
+      if (--sc->depth <= 0) {
+        sc->depth = 0;
+        return true;
+      }
+      continue;
+    } else if (c == '"') {
+      const char *close = memchr(&s[i + 1], '"', len - i - 1);
+      i = close ? close - s + 1 : len + 1;
+    } else if ((c >= '0' && c <= '9') || c == '.') {
+      while (i < len && ((s[i] >= '0' && s[i] <= '9') || s[i] == '.')) {
+        i++;
+      }
+    } else if (len - i >= 4 && !strncmp(&s[i], "true", 4)) {
+      i += 4;
+    } else if (len - i >= 5 && !strncmp(&s[i], "false", 5)) {
+      i += 5;
+    } else {
+      while (i < len && !is_space(s[i]) && s[i] != ')') {
+        i++;
+      }
+    }
+    // An unclosed string, or a token running into the end of the buffer
+    if (i >= len && !at_eof) {
+      return false;
+    }
+    sc->i = i < len ? i : len;
+  }
+  return false;
+}
+
+// Returns the index just past the top level form that starts at or after `i`
+static size_t form_end(const char *s, size_t i, size_t len) {
+  form_scan sc = {.i = i};
+  scan_form(&sc, s, len, true);
+  return sc.i;
+}
+
+static void parse_chunk(void *arg) {
+  chunk *c = arg;
+  char *text = strndup(c->start, c->len);
+  string s = str_auto(text);
+  free(text);
+  c->ta = lex(&s);
+  str_free(&s);
+  for (int i = 0; i < c->ta.size; i++) {
+    c->ta.tokens[i].location += c->offset;
+  }
+
+  c->forms = ast_node_init();
+  int cursor = 0;
+  while (cursor < c->ta.size) {
+    ast_node_pb(&c->forms, parse(c->ta, &cursor));
+  }
+  atomic_store_explicit(&c->done, true, memory_order_release);
+}
+
+program program_parse(const char *source, size_t len) {
+  // Chunks are bounded by what a `string` can hold, large sources are cut
+  // into a few chunks per core so the pool can balance them
+  int cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t target = UINT16_MAX;
+  if (len >= PARALLEL_PARSE_MIN && len / (cores * 4) < target) {
+    target = len / (cores * 4);
+  }
+
+  int cap = 4;
+  int size = 0;
+  chunk *chunks = calloc(cap, sizeof(chunk));
+  for (size_t start = 0; start < len;) {
+    size_t end = start;
+    while (end < len && end - start < target) {
+      size_t next = form_end(source, end, len);
+      if (next - start > UINT16_MAX) {
+        if (end == start) {
+          free(chunks);
+          eval_error("Top level form at byte %zu is longer than %d bytes",
+                     start, UINT16_MAX);
+        }
+        break;
+      }
+      end = next;
+    }
+    if (size + 1 >= cap) {
+      cap *= 2;
+      chunks = reallocarray(chunks, cap, sizeof(chunk));
+    }
+    chunks[size++] =
+        (chunk){.start = &source[start], .len = end - start, .offset = start};
+    start = end;
+  }
+
+  if (len < PARALLEL_PARSE_MIN) {
+    for (int i = 0; i < size; i++) {
+      parse_chunk(&chunks[i]);
+    }
+  } else {
+    for (int i = 0; i < size; i++) {
+      pool_submit(parse_chunk, &chunks[i]);
+    }
+  }
+
+  // Stitch the forms back together in source order
+  program p = {.root = ast_node_init(), .chunks_size = size,
+               .chunks = calloc(size + 1, sizeof(token_arr))};
+  for (int i = 0; i < size; i++) {
+    while (!atomic_load_explicit(&chunks[i].done, memory_order_acquire)) {
+      if (!pool_help()) {
+        sched_yield();
+      }
+    }
+    for (int j = 0; j < chunks[i].forms.child.size; j++) {
+      ast_node_pb(&p.root, chunks[i].forms.child.child_ast[j]);
+    }
+    free(chunks[i].forms.child.child_ast);
+    p.chunks[i] = chunks[i].ta;
+  }
+  free(chunks);
+  return p;
+}
+
+void program_free(program *p) {
+  ast_node_free(&p->root);
+  for (int i = 0; i < p->chunks_size; i++) {
+    ta_free(&p->chunks[i]);
+  }
+  free(p->chunks);
+}
+
+// What in a form can be reached once it has been evaluated. Global keys
+// are copied when bound, but string literals are viewed in place, and
+// functions and closures keep their body in the AST
+enum { BINDS = 1, MAKES_CODE = 2, HAS_STRINGS = 4, STARTS_FUTURES = 8 };
+
+static int form_uses(ast_node a) {
+  if (a.type == literal_t) {
+    return a.lit_t == string_t ? HAS_STRINGS : 0;
+  }
+  if (a.type != list_t) {
+    return 0;
+  }
+  int found = 0;
+  if (a.child.size && a.child.child_ast[0].type == literal_t &&
+      a.child.child_ast[0].lit_t == ident_t) {
+    char *head = a.child.child_ast[0].value.ident;
+    if (!strcmp(head, "var") || !strcmp(head, "const") ||
+        !strcmp(head, "do")) {
+      found |= BINDS;
+    } else if (!strcmp(head, "func") || !strcmp(head, "defmemo")) {
+      found |= BINDS | MAKES_CODE;
+    } else if (!strcmp(head, "lambda")) {
+      found |= MAKES_CODE;
+    } else if (!strcmp(head, "future")) {
+      found |= STARTS_FUTURES;
+    }
+  }
+  for (int i = 0; i < a.child.size; i++) {
+    found |= form_uses(a.child.child_ast[i]);
+  }
+  return found;
+}
+
+static void stream_form(const char *text, size_t len, hashmap *ctx,
+                        program *kept) {
+  if (len > UINT16_MAX) {
+    eval_error("Top level form is longer than %d bytes", UINT16_MAX);
+  }
+  chunk c = {.start = text, .len = len};
+  parse_chunk(&c);
+  int uses = form_uses(c.forms);
+  // Futures of earlier forms may still be running and allocating, their
+  // objects would be mixed in with this form's
+  bool quiet = !pool_busy();
+  void *mark = heap_mark();
+  for (int i = 0; i < c.forms.child.size; i++) {
+    ast_print(eval(c.forms.child.child_ast[i], ctx));
+    puts("");
+  }
+  fflush(stdout);
+
+  // Values the form made can only be reached from its result, unless it
+  // bound them or a generator it continued holds them. Releasing would
+  // wait for the futures it started
+  if (!(uses & (BINDS | STARTS_FUTURES)) && quiet &&
+      !generators_suspended()) {
+    heap_release(mark);
+  }
+  // A future it started may still be reading it
+  if (!(uses & STARTS_FUTURES) &&
+      (!(uses & BINDS) || !(uses & (MAKES_CODE | HAS_STRINGS)))) {
+    ast_node_free(&c.forms);
+    ta_free(&c.ta);
+    return;
+  }
+  for (int i = 0; i < c.forms.child.size; i++) {
+    ast_node_pb(&kept->root, c.forms.child.child_ast[i]);
+  }
+  free(c.forms.child.child_ast);
+  if (!(kept->chunks_size & (kept->chunks_size - 1))) {
+    kept->chunks = reallocarray(kept->chunks, kept->chunks_size * 2 + 1,
+                                sizeof(token_arr));
+  }
+  kept->chunks[kept->chunks_size++] = c.ta;
+}
+
+program program_stream(int fd, hashmap *ctx) {
+  program kept = {.root = ast_node_init()};
+  size_t cap = 4096;
+  size_t size = 0;
+  char *buf = malloc(cap);
+  form_scan sc = {0};
+  bool eof = false;
+
+  for (;;) {
+    if (scan_form(&sc, buf, size, eof) || (eof && size)) {
+      size_t end = sc.i;
+      stream_form(buf, end, ctx, &kept);
+      memmove(buf, &buf[end], size - end);
+      size -= end;
+      sc = (form_scan){0};
+      continue;
+    }
+    if (eof) {
+      break;
+    }
+    if (size + 1 >= cap) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+    ssize_t n = read(fd, &buf[size], cap - size - 1);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      eof = true;
+    } else {
+      size += n;
+    }
+  }
+  free(buf);
+  return kept;
+}
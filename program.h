@@ -0,0 +1,28 @@
+#ifndef PROGRAM_H_
+#define PROGRAM_H_
+#include "hashmap.h"
+#include "lex.h"
+#include "parse.h"
+#include <stddef.h>
+
+// Every top level form of a source file, in order, as the children of
+// `root`. The forms point into `chunks` so both live as long as the program
+typedef struct program {
+  ast_node root;
+  token_arr *chunks;
+  int chunks_size;
+} program;
+
+// Sources over PARALLEL_PARSE_MIN bytes are split on top level form
+// boundaries and the pieces are lexed and parsed on the thread pool
+#define PARALLEL_PARSE_MIN (256 * 1024)
+
+program program_parse(const char *source, size_t len);
+// Reads, evaluates and prints one top level form at a time from `fd`.
+// Forms are freed once evaluated unless a global they bind keeps their
+// code or string literals, or they start futures. Those are returned and
+// must outlive `ctx`. Futures run on while later forms are read
+program program_stream(int fd, hashmap *ctx);
+void program_free(program *);
+
+#endif // PROGRAM_H_
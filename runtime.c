@@ -0,0 +1,99 @@
+#include "runtime.h"
+#include "ast_walking.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+hashmap rt_ctx;
+
+void rt_init(ast_node *forms, int defs) {
+  rt_ctx = hashmap_init(fnv_string_hash, str_equals, 0.5, 0);
+  for (int i = 0; i < defs; i++) {
+    ast_walk(forms[i], &rt_ctx);
+  }
+}
+
+void rt_finish(ast_node *forms, int n, ast_node *heads, int calls) {
+  fflush(stdout);
+  // Futures that were never touched may still be using the forms
+  pool_shutdown();
+  for (int i = 0; i < rt_ctx.capacity; i++) {
+    ast_node a = rt_ctx.array[i].value;
+    if (a.type == function_t) {
+      free(a.value.params);
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    ast_sites_free(&forms[i]);
+  }
+  for (int i = 0; i < calls; i++) {
+    ast_sites_free(&heads[i]);
+  }
+  hashmap_free(&rt_ctx);
+  heap_free_all();
+}
+
+ast_node rt_apply(builtin *b, ast_node *head, int size, ast_node *nodes) {
+  nodes[0] = *head;
+  ast_node result = b(
+      (struct ast_arr){.child_ast = nodes, .size = size, .cap = size}, &rt_ctx);
+  // Compiled code only runs on the main thread, nothing else writes `head`
+  head->child.site = nodes[0].child.site;
+  return result;
+}
+
+ast_node rt_get(char *name) { return get_ident(&rt_ctx, name); }
+
+void rt_define(char *name, ast_node value, bool constant) {
+  if (constant) {
+    value.type = const_t;
+  }
+  bind_ident(&rt_ctx, name, value);
+}
+
+bool rt_test(ast_node condition, const char *message) {
+  if (condition.lit_t != bool_t) {
+    fprintf(stderr, "%s\n", message);
+    exit(1);
+  }
+  return condition.value.boolean;
+}
+
+void rt_overflow(void) {
+  fprintf(stderr, "Integer overflow, bignums need the interpreter\n");
+  exit(1);
+}
+
+static void expected(const char *type) {
+  fprintf(stderr, "Expected %s\n", type);
+  exit(1);
+}
+
+int64_t rt_as_int(ast_node a) {
+  if (a.lit_t != integer_t) {
+    expected("an integer");
+  }
+  return a.value.integer;
+}
+
+double rt_as_float(ast_node a) {
+  if (a.lit_t != floating_t) {
+    expected("a float");
+  }
+  return a.value.floating;
+}
+
+bool rt_as_bool(ast_node a) {
+  if (a.lit_t != bool_t) {
+    expected("a bool");
+  }
+  return a.value.boolean;
+}
+
+void rt_print(ast_node a) {
+  ast_print(a);
+  puts("");
+}
@@ -0,0 +1,94 @@
+#ifndef RUNTIME_H_
+#define RUNTIME_H_
+#include "ast_walking.h"
+#include "case.h"
+#include "hashmap.h"
+#include "parse.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// What programs written by --emit-c link against, see emit.h. Builtins
+// run in `rt_ctx`, which also holds the interpreted definition of every
+// user function, for printing and for the builtins that call by name
+extern hashmap rt_ctx;
+
+// Binds the first `defs` embedded forms, the program's funcs
+void rt_init(ast_node *forms, int defs);
+void rt_finish(ast_node *forms, int n, ast_node *heads, int calls);
+
+// `nodes` is the call, `head` then the evaluated arguments. Each call has
+// its own `head`, which keeps the builtin's data for it, see parse.h
+ast_node rt_apply(builtin *, ast_node *head, int size, ast_node *nodes);
+ast_node rt_get(char *name);
+// Mirrors a global for interpreted code, only emitted when some is run
+void rt_define(char *name, ast_node value, bool constant);
+bool rt_test(ast_node condition, const char *message);
+int64_t rt_as_int(ast_node);
+double rt_as_float(ast_node);
+bool rt_as_bool(ast_node);
+void rt_print(ast_node);
+
+// Integer arithmetic in compiled code is checked, but can't promote to a
+// bignum since the result's C type is fixed. Overflow is reported and
+// exits, the program has to run interpreted
+_Noreturn void rt_overflow(void);
+
+static inline int64_t rt_add(int64_t a, int64_t b) {
+  int64_t r;
+  if (__builtin_add_overflow(a, b, &r)) {
+    rt_overflow();
+  }
+  return r;
+}
+
+static inline int64_t rt_sub(int64_t a, int64_t b) {
+  int64_t r;
+  if (__builtin_sub_overflow(a, b, &r)) {
+    rt_overflow();
+  }
+  return r;
+}
+
+static inline int64_t rt_mul(int64_t a, int64_t b) {
+  int64_t r;
+  if (__builtin_mul_overflow(a, b, &r)) {
+    rt_overflow();
+  }
+  return r;
+}
+
+static inline int64_t rt_div(int64_t a, int64_t b) {
+  if (!b) {
+    fprintf(stderr, "Division by zero\n");
+    exit(1);
+  }
+  if (a == INT64_MIN && b == -1) {
+    rt_overflow();
+  }
+  return a / b;
+}
+
+static inline ast_node rt_int(int64_t i) {
+  return (ast_node){.type = literal_t, .lit_t = integer_t, .value.integer = i};
+}
+
+static inline ast_node rt_float(double d) {
+  return (ast_node){
+      .type = literal_t, .lit_t = floating_t, .value.floating = d};
+}
+
+static inline ast_node rt_bool(bool b) {
+  return (ast_node){.type = literal_t, .lit_t = bool_t, .value.boolean = b};
+}
+
+static inline ast_node rt_string(char *s) {
+  return (ast_node){.type = literal_t, .lit_t = string_t, .value.string = s};
+}
+
+static inline ast_node rt_ident(char *s) {
+  return (ast_node){.type = literal_t, .lit_t = ident_t, .value.ident = s};
+}
+
+#endif // RUNTIME_H_
@@ -0,0 +1,202 @@
+#include "scheduler.h"
+#include "ast_walking.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+struct script {
+  evaluation *eval;
+  struct ast_arr forms;
+  hashmap *ctx;
+  heap *heap;
+  ast_node result;
+  script_stats stats;
+  void (*done)(script *, void *);
+  void *arg;
+  script *next;
+};
+
+// One thread and the scripts pinned to it, run round robin
+typedef struct runner {
+  sched *s;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  script *head;
+  script *tail;
+  atomic_int load;
+  bool stopping;
+} runner;
+
+struct sched {
+  int64_t fuel;
+  int threads;
+  runner *runners;
+  // Scripts spawned and not yet done, sched_free waits for none
+  pthread_mutex_t lock;
+  pthread_cond_t idle;
+  int live;
+};
+
+static void push(runner *r, script *sc) {
+  pthread_mutex_lock(&r->lock);
+  sc->next = NULL;
+  if (r->tail) {
+    r->tail->next = sc;
+  } else {
+    r->head = sc;
+  }
+  r->tail = sc;
+  pthread_cond_signal(&r->ready);
+  pthread_mutex_unlock(&r->lock);
+}
+
+// NULL once the runner is stopping with nothing left to run
+static script *pop(runner *r) {
+  pthread_mutex_lock(&r->lock);
+  while (!r->head && !r->stopping) {
+    pthread_cond_wait(&r->ready, &r->lock);
+  }
+  script *sc = r->head;
+  if (sc) {
+    r->head = sc->next;
+    if (!r->head) {
+      r->tail = NULL;
+    }
+  }
+  pthread_mutex_unlock(&r->lock);
+  return sc;
+}
+
+static int64_t cpu_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void evaluate(void *arg) {
+  script *sc = arg;
+  for (int i = 0; i < sc->forms.size; i++) {
+    sc->result = auto_ast_walk(sc->forms.child_ast[i], sc->ctx);
+  }
+}
+
+// Runs one turn of `sc`, true once it has finished
+static bool turn(sched *s, script *sc) {
+  heap *outer = heap_use(sc->heap);
+  eval_set_fuel(sc->eval, s->fuel);
+  int64_t start = cpu_ns();
+  bool finished = eval_resume(sc->eval);
+  sc->stats.cpu_ns += cpu_ns() - start;
+  int64_t left = eval_fuel_left(sc->eval);
+  sc->stats.steps += s->fuel - (left < 0 ? 0 : left);
+  sc->stats.turns++;
+  heap_use(outer);
+  return finished;
+}
+
+static void finish(sched *s, runner *r, script *sc) {
+  sc->done(sc, sc->arg);
+  eval_free(sc->eval);
+  heap_destroy(sc->heap);
+  free(sc);
+  atomic_fetch_sub(&r->load, 1);
+  pthread_mutex_lock(&s->lock);
+  if (!--s->live) {
+    pthread_cond_broadcast(&s->idle);
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void *run(void *arg) {
+  runner *r = arg;
+  script *sc;
+  while ((sc = pop(r))) {
+    if (turn(r->s, sc)) {
+      finish(r->s, r, sc);
+    } else {
+      push(r, sc);
+    }
+  }
+  return NULL;
+}
+
+sched *sched_new(int threads, int64_t fuel) {
+  if (threads <= 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  sched *s = calloc(1, sizeof(sched));
+  s->fuel = fuel > 0 ? fuel : SCHED_DEFAULT_FUEL;
+  s->threads = threads;
+  s->runners = calloc(threads, sizeof(runner));
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->idle, NULL);
+  for (int i = 0; i < threads; i++) {
+    runner *r = &s->runners[i];
+    r->s = s;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->ready, NULL);
+    atomic_init(&r->load, 0);
+    pthread_create(&r->thread, NULL, run, r);
+  }
+  return s;
+}
+
+void sched_spawn(sched *s, struct ast_arr forms, hashmap *ctx,
+                 void (*done)(script *, void *), void *arg) {
+  script *sc = calloc(1, sizeof(script));
+  sc->forms = forms;
+  sc->ctx = ctx;
+  sc->heap = heap_new();
+  sc->result = (ast_node){.type = tombstone_t};
+  sc->done = done;
+  sc->arg = arg;
+  sc->eval = eval_start(evaluate, sc);
+
+  pthread_mutex_lock(&s->lock);
+  s->live++;
+  pthread_mutex_unlock(&s->lock);
+  // The least loaded thread gets it
+  runner *r = &s->runners[0];
+  for (int i = 1; i < s->threads; i++) {
+    if (atomic_load(&s->runners[i].load) < atomic_load(&r->load)) {
+      r = &s->runners[i];
+    }
+  }
+  atomic_fetch_add(&r->load, 1);
+  push(r, sc);
+}
+
+ast_node script_result(script *sc) { return sc->result; }
+
+const char *script_error(script *sc) { return eval_failure(sc->eval); }
+
+script_stats script_stats_of(script *sc) { return sc->stats; }
+
+void sched_free(sched *s) {
+  pthread_mutex_lock(&s->lock);
+  while (s->live) {
+    pthread_cond_wait(&s->idle, &s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  for (int i = 0; i < s->threads; i++) {
+    runner *r = &s->runners[i];
+    pthread_mutex_lock(&r->lock);
+    r->stopping = true;
+    pthread_cond_signal(&r->ready);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->ready);
+  }
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->idle);
+  free(s->runners);
+  free(s);
+}
@@ -0,0 +1,40 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <stdint.h>
+
+// Green threads for scripts. Each script is evaluated on a stack of its
+// own (see eval.h) and pinned to one of the scheduler's threads, which
+// take turns running the scripts they hold. A turn ends after `fuel`
+// evaluation steps, when the script waits on a future, or when it
+// finishes, so a long script only ever holds up the others on its thread
+// for one turn at a time. Scripts never move between threads, thread
+// locals stay valid across their turns
+#define SCHED_DEFAULT_FUEL 10000
+
+typedef struct script script;
+typedef struct sched sched;
+
+typedef struct script_stats {
+  int64_t steps;
+  int64_t turns;
+  int64_t cpu_ns; // thread CPU time over all its turns
+} script_stats;
+
+// `threads` <= 0 uses one per online core
+sched *sched_new(int threads, int64_t fuel);
+// Evaluates `forms` in order in `ctx`, allocating from a heap of the
+// script's own. `done` is called on the script's thread when it finishes,
+// after which the script and everything on its heap are freed
+void sched_spawn(sched *, struct ast_arr forms, hashmap *ctx,
+                 void (*done)(script *, void *), void *arg);
+// The value of the last form
+ast_node script_result(script *);
+// NULL unless the script stopped at an error
+const char *script_error(script *);
+script_stats script_stats_of(script *);
+// Waits for every script to finish, then stops the threads
+void sched_free(sched *);
+
+#endif // SCHEDULER_H_
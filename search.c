@@ -0,0 +1,249 @@
+#include "search.h"
+#include "ast_walking.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "list.h"
+#include "parse.h"
+#include "text.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Substring search is a first and last byte filter: compare a block of
+// candidate starts against the needle's first byte and the block `m - 1`
+// further on against its last byte, and only memcmp the middle of the
+// positions where both match. Needles of one byte go straight to memchr
+
+static int64_t search_scalar(const char *s, int64_t n, const char *needle,
+                             int64_t m) {
+  for (int64_t i = 0; i + m <= n;) {
+    const char *hit = memchr(&s[i], needle[0], n - m + 1 - i);
+    if (!hit) {
+      return -1;
+    }
+    i = hit - s;
+    if (s[i + m - 1] == needle[m - 1] && !memcmp(&s[i + 1], &needle[1], m - 2)) {
+      return i;
+    }
+    i++;
+  }
+  return -1;
+}
+
+static int64_t count_byte_scalar(const char *s, int64_t n, char c) {
+  int64_t count = 0;
+  for (int64_t i = 0; i < n; i++) {
+    count += s[i] == c;
+  }
+  return count;
+}
+
+#if defined(__x86_64__)
+static int64_t search_sse2(const char *s, int64_t n, const char *needle,
+                           int64_t m) {
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i last = _mm_set1_epi8(needle[m - 1]);
+  int64_t i = 0;
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)&s[i]);
+    __m128i b = _mm_loadu_si128((const __m128i *)&s[i + m - 1]);
+    uint32_t mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    for (; mask; mask &= mask - 1) {
+      int64_t at = i + __builtin_ctz(mask);
+      if (!memcmp(&s[at + 1], &needle[1], m - 2)) {
+        return at;
+      }
+    }
+  }
+  int64_t rest = search_scalar(&s[i], n - i, needle, m);
+  return rest < 0 ? -1 : i + rest;
+}
+
+static int64_t count_byte_sse2(const char *s, int64_t n, char c) {
+  __m128i needle = _mm_set1_epi8(c);
+  int64_t count = 0;
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)&s[i]);
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(a, needle)));
+  }
+  return count + count_byte_scalar(&s[i], n - i, c);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static int64_t search_avx2(const char *s, int64_t n, const char *needle,
+                                int64_t m) {
+  __m256i first = _mm256_set1_epi8(needle[0]);
+  __m256i last = _mm256_set1_epi8(needle[m - 1]);
+  int64_t i = 0;
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)&s[i]);
+    __m256i b = _mm256_loadu_si256((const __m256i *)&s[i + m - 1]);
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+    for (; mask; mask &= mask - 1) {
+      int64_t at = i + __builtin_ctz(mask);
+      if (!memcmp(&s[at + 1], &needle[1], m - 2)) {
+        return at;
+      }
+    }
+  }
+  int64_t rest = search_scalar(&s[i], n - i, needle, m);
+  return rest < 0 ? -1 : i + rest;
+}
+
+AVX2 static int64_t count_byte_avx2(const char *s, int64_t n, char c) {
+  __m256i needle = _mm256_set1_epi8(c);
+  int64_t count = 0;
+  int64_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)&s[i]);
+    count += __builtin_popcount(
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, needle)));
+  }
+  return count + count_byte_scalar(&s[i], n - i, c);
+}
+#endif
+
+// Picked once at startup, like the vector kernels
+static int64_t (*search_kernel)(const char *, int64_t, const char *,
+                                int64_t) = search_scalar;
+static int64_t (*count_byte_kernel)(const char *, int64_t,
+                                    char) = count_byte_scalar;
+
+__attribute__((constructor)) static void pick_kernels(void) {
+#if defined(__x86_64__)
+  search_kernel = search_sse2;
+  count_byte_kernel = count_byte_sse2;
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    search_kernel = search_avx2;
+    count_byte_kernel = count_byte_avx2;
+  }
+#endif
+}
+
+int64_t search(const char *haystack, int64_t n, const char *needle,
+               int64_t m) {
+  if (!m) {
+    return 0;
+  }
+  if (m > n) {
+    return -1;
+  }
+  if (m == 1) {
+    const char *hit = memchr(haystack, needle[0], n);
+    return hit ? hit - haystack : -1;
+  }
+  return search_kernel(haystack, n, needle, m);
+}
+
+// Strings are flattened once here, the slices below share those bytes
+typedef struct view {
+  text *t;
+  const char *bytes;
+  int64_t len;
+  char small[TEXT_INLINE_MAX];
+} view;
+
+static void view_arg(view *v, struct ast_arr ast, int i, hashmap *ctx) {
+  v->t = text_of(auto_ast_walk(ast.child_ast[i], ctx));
+  if (!v->t) {
+    eval_error("%s expects a string as argument %d",
+               ast.child_ast[0].value.ident, i);
+  }
+  v->bytes = text_bytes(v->t, v->small);
+  v->len = text_len(v->t);
+}
+
+static ast_node integer(int64_t i) {
+  return (ast_node){.type = literal_t, .lit_t = integer_t, .value.integer = i};
+}
+
+ast_node string_index(struct ast_arr ast, hashmap *ctx) {
+  // (string-index s c), index of the first c in s or -1, c is one byte
+  assert(ast.child_ast[0].lit_t == ident_t);
+  view s;
+  view c;
+  view_arg(&s, ast, 1, ctx);
+  view_arg(&c, ast, 2, ctx);
+  if (c.len != 1) {
+    eval_error("string-index expects a single character to look for");
+  }
+  return integer(search(s.bytes, s.len, c.bytes, 1));
+}
+
+ast_node string_contains(struct ast_arr ast, hashmap *ctx) {
+  // (string-contains s needle), index of the first needle in s or -1
+  assert(ast.child_ast[0].lit_t == ident_t);
+  view s;
+  view needle;
+  view_arg(&s, ast, 1, ctx);
+  view_arg(&needle, ast, 2, ctx);
+  return integer(search(s.bytes, s.len, needle.bytes, needle.len));
+}
+
+static void nonempty(view *v, struct ast_arr ast) {
+  if (!v->len) {
+    eval_error("%s expects a non empty separator",
+               ast.child_ast[0].value.ident);
+  }
+}
+
+ast_node string_count(struct ast_arr ast, hashmap *ctx) {
+  // (string-count s needle), non overlapping occurrences of needle in s
+  assert(ast.child_ast[0].lit_t == ident_t);
+  view s;
+  view needle;
+  view_arg(&s, ast, 1, ctx);
+  view_arg(&needle, ast, 2, ctx);
+  nonempty(&needle, ast);
+  if (needle.len == 1) {
+    return integer(count_byte_kernel(s.bytes, s.len, needle.bytes[0]));
+  }
+  int64_t count = 0;
+  for (int64_t i = 0, at;
+       (at = search(&s.bytes[i], s.len - i, needle.bytes, needle.len)) >= 0;
+       i += at + needle.len) {
+    count++;
+  }
+  return integer(count);
+}
+
+ast_node string_split(struct ast_arr ast, hashmap *ctx) {
+  // (string-split s sep), a list of the pieces of s between each sep.
+  // The pieces are slices of s
+  assert(ast.child_ast[0].lit_t == ident_t);
+  view s;
+  view sep;
+  view_arg(&s, ast, 1, ctx);
+  view_arg(&sep, ast, 2, ctx);
+  nonempty(&sep, ast);
+
+  int cap = 16;
+  int size = 0;
+  ast_node *pieces = calloc(cap, sizeof(ast_node));
+  for (int64_t i = 0;;) {
+    int64_t at = search(&s.bytes[i], s.len - i, sep.bytes, sep.len);
+    int64_t end = at < 0 ? s.len : i + at;
+    if (size == cap) {
+      cap *= 2;
+      pieces = reallocarray(pieces, cap, sizeof(ast_node));
+    }
+    pieces[size++] = text_node(text_slice(s.t, i, end));
+    if (at < 0) {
+      break;
+    }
+    i = end + sep.len;
+  }
+  cons_chunk *l = list_from(pieces, size);
+  free(pieces);
+  return list_node(l);
+}
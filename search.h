@@ -0,0 +1,15 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <stdint.h>
+
+// Offset of the first `needle` in `haystack`, or -1
+int64_t search(const char *haystack, int64_t n, const char *needle, int64_t m);
+
+ast_node string_index(struct ast_arr ast, hashmap *ctx);
+ast_node string_contains(struct ast_arr ast, hashmap *ctx);
+ast_node string_split(struct ast_arr ast, hashmap *ctx);
+ast_node string_count(struct ast_arr ast, hashmap *ctx);
+
+#endif // SEARCH_H_
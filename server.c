@@ -0,0 +1,275 @@
+#include "server.h"
+#include "ast_walking.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "lex.h"
+#include "parse.h"
+#include "pool.h"
+#include "program.h"
+#include "scheduler.h"
+#include "utils.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_stop(int sig) { stopping = 1; }
+
+static void free_functions(hashmap *ctx) {
+  for (int i = 0; i < ctx->capacity; i++) {
+    ast_node a = ctx->array[i].value;
+    if (a.type == function_t) {
+      free(a.value.params);
+    }
+  }
+}
+
+static char *read_request(int fd, size_t *len) {
+  size_t cap = 4096;
+  size_t size = 0;
+  char *buf = malloc(cap);
+  ssize_t n;
+  while ((n = read(fd, buf + size, cap - size - 1)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      free(buf);
+      return NULL;
+    }
+    size += n;
+    if (size + 1 == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  buf[size] = 0;
+  *len = size;
+  return buf;
+}
+
+typedef struct inline_request {
+  const char *source;
+  size_t len;
+  program p;
+  hashmap env;
+} inline_request;
+
+static void run_request(void *arg) {
+  inline_request *r = arg;
+  r->p = program_parse(r->source, r->len);
+  struct ast_arr forms = r->p.root.child;
+  for (int i = 0; i < forms.size; i++) {
+    ast_node result = auto_ast_walk(forms.child_ast[i], &r->env);
+    if (i == forms.size - 1) {
+      ast_print(result);
+      puts("");
+    }
+  }
+}
+
+// Evaluates one request in a fresh layer over `global`, so definitions
+// made by the request never leak into the next one. An error is written
+// to the client and only fails its own request
+static void handle_request(int client, hashmap *global) {
+  size_t len;
+  char *source = read_request(client, &len);
+  if (!source) {
+    return;
+  }
+
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  dup2(client, STDOUT_FILENO);
+
+  void *mark = heap_mark();
+  inline_request r = {
+      .source = source, .len = len, .env = hashmap_layer(global)};
+  char *error = eval_protect(run_request, &r);
+  if (error) {
+    printf("%s\n", error);
+  }
+  // Futures the request never touched must finish before its AST goes
+  pool_drain();
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+
+  heap_release(mark);
+  free_functions(&r.env);
+  hashmap_free(&r.env);
+  program_free(&r.p);
+  free(error);
+  free(source);
+}
+
+// A request running as a script, see scheduler.h
+typedef struct request {
+  int client;
+  program p;
+  hashmap env;
+} request;
+
+static void finish_request(script *sc, void *arg) {
+  request *r = arg;
+  FILE *out = fdopen(r->client, "w");
+  const char *error = script_error(sc);
+  if (error) {
+    fprintf(out, "%s\n", error);
+  } else if (r->p.root.child.size) {
+    ast_fprint(out, script_result(sc));
+    fputc('\n', out);
+  }
+  fclose(out);
+  script_stats stats = script_stats_of(sc);
+  fprintf(stderr, "[%d] request: %ld steps, %ld turns, %.3fms cpu%s\n",
+          getpid(), stats.steps, stats.turns, stats.cpu_ns / 1e6,
+          error ? ", failed" : "");
+  free_functions(&r->env);
+  hashmap_free(&r->env);
+  program_free(&r->p);
+  free(r);
+}
+
+// Scripts take turns on the worker's scheduler threads, so a slow one
+// doesn't hold up the requests behind it, and errors only fail their own
+static void start_request(int client, hashmap *global, sched *s) {
+  size_t len;
+  char *source = read_request(client, &len);
+  if (!source) {
+    close(client);
+    return;
+  }
+  request *r = calloc(1, sizeof(request));
+  r->client = client;
+  r->p = program_parse(source, len);
+  free(source);
+  r->env = hashmap_layer(global);
+  sched_spawn(s, r->p.root.child, &r->env, finish_request, r);
+}
+
+static void worker(int listener, hashmap *global, int tasks, int64_t fuel) {
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  sched *s = tasks ? sched_new(tasks, fuel) : NULL;
+  for (;;) {
+    int client = accept(listener, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("accept failed");
+      exit(EXIT_FAILURE);
+    }
+    if (s) {
+      start_request(client, global, s);
+      continue;
+    }
+    handle_request(client, global);
+    close(client);
+  }
+}
+
+static pid_t spawn_worker(int listener, hashmap *global, int tasks,
+                          int64_t fuel) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork failed");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    worker(listener, global, tasks, fuel);
+  }
+  return pid;
+}
+
+int serve(const char *socket_path, const char *prelude, int workers,
+          int tasks, int64_t fuel) {
+  if (workers <= 0) {
+    workers = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
+  hashmap global = hashmap_init(fnv_string_hash, str_equals, 0.5, 0);
+  program pre = {0};
+  if (prelude) {
+    size_t len;
+    char *source = read_file(prelude, &len);
+    if (!source) {
+      perror("Unable to read prelude");
+      exit(EXIT_FAILURE);
+    }
+    // The prelude's ASTs back the global bindings, they live until shutdown
+    pre = program_parse(source, len);
+    free(source);
+    for (int i = 0; i < pre.root.child.size; i++) {
+      eval(pre.root.child.child_ast[i], &global);
+    }
+    // Threads don't survive fork, each worker starts its own pool
+    pool_shutdown();
+  }
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path %s is too long\n", socket_path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, socket_path);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socket_path);
+  if (listener < 0 ||
+      bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listener, SOMAXCONN) < 0) {
+    perror("Unable to listen on socket");
+    exit(EXIT_FAILURE);
+  }
+
+  // No SA_RESTART, wait() has to return so we can shut down
+  struct sigaction sa = {.sa_handler = on_stop};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  pid_t *pids = calloc(workers, sizeof(pid_t));
+  for (int i = 0; i < workers; i++) {
+    pids[i] = spawn_worker(listener, &global, tasks, fuel);
+  }
+
+  while (!stopping) {
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    // Fatal script errors exit the worker, replace it
+    for (int i = 0; i < workers; i++) {
+      if (pids[i] == pid) {
+        pids[i] = spawn_worker(listener, &global, tasks, fuel);
+      }
+    }
+  }
+
+  for (int i = 0; i < workers; i++) {
+    kill(pids[i], SIGTERM);
+  }
+  while (wait(NULL) > 0) {
+  }
+  close(listener);
+  unlink(socket_path);
+  free(pids);
+
+  free_functions(&global);
+  hashmap_free(&global);
+  program_free(&pre);
+  return 0;
+}
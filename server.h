@@ -0,0 +1,20 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+#include <stdint.h>
+
+// Loads `prelude` (may be NULL) into a global context once, then answers
+// evaluation requests on the unix socket at `socket_path` from `workers`
+// pre-forked processes, `workers` <= 0 uses one per online core.
+//
+// A request is the program text, terminated by the client shutting down
+// its write side. Everything the program prints followed by its result is
+// written back before the server closes the connection.
+//
+// With `tasks` > 0 each worker runs its requests as scripts on that many
+// scheduler threads, taking turns of `fuel` evaluation steps, see
+// scheduler.h. An error is then written back instead of ending the
+// worker, and what each request used is logged to stderr
+int serve(const char *socket_path, const char *prelude, int workers,
+          int tasks, int64_t fuel);
+
+#endif // SERVER_H_
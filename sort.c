@@ -0,0 +1,332 @@
+#include "sort.h"
+#include "ast_walking.h"
+#include "closure.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include "pool.h"
+#include "vector.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Doubles are sorted as int64 keys, flipping every bit but the sign of a
+// negative double makes the bit patterns order like the numbers do.
+// The mapping is its own inverse
+static void float_keys(int64_t *a, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    a[i] ^= (int64_t)((uint64_t)(a[i] >> 63) >> 1);
+  }
+}
+
+static void swap(int64_t *a, int64_t *b) {
+  int64_t t = *a;
+  *a = *b;
+  *b = t;
+}
+
+static void insertion_sort(int64_t *a, int64_t n) {
+  for (int64_t i = 1; i < n; i++) {
+    int64_t x = a[i];
+    int64_t j = i;
+    for (; j > 0 && a[j - 1] > x; j--) {
+      a[j] = a[j - 1];
+    }
+    a[j] = x;
+  }
+}
+
+static void sift_down(int64_t *a, int64_t root, int64_t n) {
+  for (int64_t child; (child = root * 2 + 1) < n; root = child) {
+    if (child + 1 < n && a[child + 1] > a[child]) {
+      child++;
+    }
+    if (a[root] >= a[child]) {
+      return;
+    }
+    swap(&a[root], &a[child]);
+  }
+}
+
+static void heap_sort(int64_t *a, int64_t n) {
+  for (int64_t i = n / 2 - 1; i >= 0; i--) {
+    sift_down(a, i, n);
+  }
+  for (int64_t i = n - 1; i > 0; i--) {
+    swap(&a[0], &a[i]);
+    sift_down(a, 0, i);
+  }
+}
+
+// Quicksort on a median of three pivot, falling back to heapsort once
+// `depth` runs out so adversarial inputs stay O(n log n)
+static void introsort(int64_t *a, int64_t n, int depth) {
+  while (n > 16) {
+    if (depth-- == 0) {
+      heap_sort(a, n);
+      return;
+    }
+    int64_t mid = n / 2;
+    if (a[mid] < a[0]) {
+      swap(&a[mid], &a[0]);
+    }
+    if (a[n - 1] < a[mid]) {
+      swap(&a[n - 1], &a[mid]);
+      if (a[mid] < a[0]) {
+        swap(&a[mid], &a[0]);
+      }
+    }
+
+    // Hoare partition, runs of equal keys are split down the middle
+    int64_t pivot = a[mid];
+    int64_t i = -1;
+    int64_t j = n;
+    for (;;) {
+      while (a[++i] < pivot) {
+      }
+      while (a[--j] > pivot) {
+      }
+      if (i >= j) {
+        break;
+      }
+      swap(&a[i], &a[j]);
+    }
+
+    // Recurse into the smaller side so the stack stays O(log n)
+    int64_t left = j + 1;
+    if (left < n - left) {
+      introsort(a, left, depth);
+      a += left;
+      n -= left;
+    } else {
+      introsort(&a[left], n - left, depth);
+      n = left;
+    }
+  }
+  insertion_sort(a, n);
+}
+
+static int depth_limit(int64_t n) {
+  return n > 1 ? 2 * (63 - __builtin_clzll(n)) : 0;
+}
+
+static void merge(int64_t *a, int64_t mid, int64_t n, int64_t *tmp) {
+  if (a[mid - 1] <= a[mid]) {
+    return;
+  }
+  int64_t i = 0;
+  int64_t j = mid;
+  int64_t k = 0;
+  while (i < mid && j < n) {
+    tmp[k++] = a[j] < a[i] ? a[j++] : a[i++];
+  }
+  memcpy(&tmp[k], &a[i], (mid - i) * sizeof(int64_t));
+  k += mid - i;
+  memcpy(a, tmp, k * sizeof(int64_t));
+}
+
+typedef struct sort_task {
+  int64_t *a;
+  int64_t *tmp;
+  int64_t n;
+  atomic_bool done;
+} sort_task;
+
+// Sorts the two halves in parallel and merges them, the caller helps run
+// queued tasks while it waits for its half so nested sorts can't deadlock
+static void parallel_sort(void *arg) {
+  sort_task *t = arg;
+  if (t->n <= SORT_PARALLEL_MIN) {
+    introsort(t->a, t->n, depth_limit(t->n));
+  } else {
+    int64_t half = t->n / 2;
+    sort_task left = {.a = t->a, .tmp = t->tmp, .n = half};
+    sort_task right = {.a = &t->a[half], .tmp = &t->tmp[half], .n = t->n - half};
+    pool_submit(parallel_sort, &left);
+    parallel_sort(&right);
+    while (!atomic_load_explicit(&left.done, memory_order_acquire)) {
+      if (!pool_help()) {
+        sched_yield();
+      }
+    }
+    merge(t->a, half, t->n, t->tmp);
+  }
+  atomic_store_explicit(&t->done, true, memory_order_release);
+}
+
+static void sort_keys(int64_t *a, int64_t n) {
+  if (n <= SORT_PARALLEL_MIN) {
+    introsort(a, n, depth_limit(n));
+    return;
+  }
+  sort_task t = {.a = a, .tmp = calloc(n, sizeof(int64_t)), .n = n};
+  parallel_sort(&t);
+  free(t.tmp);
+}
+
+static vector *vector_arg(struct ast_arr ast, int i, hashmap *ctx) {
+  ast_node a = auto_ast_walk(ast.child_ast[i], ctx);
+  if (a.lit_t != vector_t) {
+    eval_error("%s expects a vector as argument %d",
+               ast.child_ast[0].value.ident, i);
+  }
+  return a.value.vector;
+}
+
+ast_node sort_in_place(struct ast_arr ast, hashmap *ctx) {
+  // (sort! v), sorts ascending and returns v
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = vector_arg(ast, 1, ctx);
+  if (v->elem == floating_t) {
+    float_keys(v->integers, v->size);
+  }
+  sort_keys(v->integers, v->size);
+  if (v->elem == floating_t) {
+    float_keys(v->integers, v->size);
+  }
+  return vector_node(v);
+}
+
+// Calls back into the evaluator with a reused (cmp a b) node
+typedef struct comparator {
+  ast_node call[3];
+  hashmap *ctx;
+  literal_type elem;
+} comparator;
+
+static ast_node element(literal_type elem, int64_t bits) {
+  ast_node n = {.type = literal_t, .lit_t = elem};
+  n.value.integer = bits; // copies the bits of either type
+  return n;
+}
+
+static bool before(comparator *c, int64_t a, int64_t b) {
+  c->call[1] = element(c->elem, a);
+  c->call[2] = element(c->elem, b);
+  ast_node call = {.type = list_t,
+                   .child = {.child_ast = c->call, .size = 3, .cap = 3}};
+  ast_node result = ast_walk(call, c->ctx);
+  if (result.lit_t != bool_t) {
+    eval_error("sort-by comparator must return a bool");
+  }
+  return result.value.boolean;
+}
+
+// Stable, and serial since the comparator runs in the caller's environment
+static void merge_sort_by(comparator *c, int64_t *a, int64_t n,
+                          int64_t *tmp) {
+  if (n < 2) {
+    return;
+  }
+  int64_t mid = n / 2;
+  merge_sort_by(c, a, mid, tmp);
+  merge_sort_by(c, &a[mid], n - mid, tmp);
+  if (!before(c, a[mid], a[mid - 1])) {
+    return;
+  }
+  int64_t i = 0;
+  int64_t j = mid;
+  int64_t k = 0;
+  while (i < mid && j < n) {
+    tmp[k++] = before(c, a[j], a[i]) ? a[j++] : a[i++];
+  }
+  memcpy(&tmp[k], &a[i], (mid - i) * sizeof(int64_t));
+  k += mid - i;
+  memcpy(a, tmp, k * sizeof(int64_t));
+}
+
+ast_node sort_by(struct ast_arr ast, hashmap *ctx) {
+  // (sort-by v less), returns a sorted copy of v, (less a b) is true when
+  // a belongs before b
+  //  0       1 2
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = vector_arg(ast, 1, ctx);
+  closure_buf stack;
+  ast_node less = function_arg(ast, 2, ctx, &stack);
+  vector *sorted = vector_new(v->elem, v->size);
+  memcpy(sorted->integers, v->integers, v->size * sizeof(int64_t));
+
+  comparator c = {.call = {less}, .ctx = ctx, .elem = v->elem};
+  // On the heap, `less` may raise part way through
+  int64_t *tmp = heap_alloc((v->size + 1) * sizeof(int64_t), NULL);
+  merge_sort_by(&c, sorted->integers, sorted->size, tmp);
+  return vector_node(sorted);
+}
+
+static double as_double(vector *v, int64_t i) {
+  return v->elem == integer_t ? (double)v->integers[i] : v->floats[i];
+}
+
+ast_node binary_search(struct ast_arr ast, hashmap *ctx) {
+  // (binary-search v x), index of an element equal to x in the sorted
+  // vector v, or -1
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = vector_arg(ast, 1, ctx);
+  ast_node x = auto_ast_walk(ast.child_ast[2], ctx);
+  if (x.lit_t != integer_t && x.lit_t != floating_t) {
+    eval_error("binary-search expects a number to look for");
+  }
+
+  int64_t lo = 0;
+  int64_t hi = v->size;
+  int64_t found = -1;
+  if (v->elem == integer_t && x.lit_t == integer_t) {
+    while (lo < hi) {
+      int64_t mid = lo + (hi - lo) / 2;
+      if (v->integers[mid] < x.value.integer) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo < v->size && v->integers[lo] == x.value.integer) {
+      found = lo;
+    }
+  } else {
+    double target =
+        x.lit_t == integer_t ? (double)x.value.integer : x.value.floating;
+    while (lo < hi) {
+      int64_t mid = lo + (hi - lo) / 2;
+      if (as_double(v, mid) < target) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo < v->size && as_double(v, lo) == target) {
+      found = lo;
+    }
+  }
+  return (ast_node){.type = literal_t, .lit_t = integer_t, .value.integer = found};
+}
+
+static bool same(vector *v, int64_t i, int64_t j) {
+  return v->elem == integer_t ? v->integers[i] == v->integers[j]
+                              : v->floats[i] == v->floats[j];
+}
+
+ast_node unique(struct ast_arr ast, hashmap *ctx) {
+  // (unique v), a copy of v with runs of equal elements collapsed, sort it
+  // first to drop every duplicate
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = vector_arg(ast, 1, ctx);
+  int64_t size = 0;
+  for (int64_t i = 0; i < v->size; i++) {
+    if (!i || !same(v, i, i - 1)) {
+      size++;
+    }
+  }
+  vector *u = vector_new(v->elem, size);
+  int64_t k = 0;
+  for (int64_t i = 0; i < v->size; i++) {
+    if (!i || !same(v, i, i - 1)) {
+      u->integers[k++] = v->integers[i];
+    }
+  }
+  return vector_node(u);
+}
@@ -0,0 +1,15 @@
+#ifndef SORT_H_
+#define SORT_H_
+#include "hashmap.h"
+#include "parse.h"
+
+// Vectors longer than this are sorted by a parallel merge sort on the
+// thread pool, shorter ones by an introsort on the calling thread
+#define SORT_PARALLEL_MIN (64 * 1024)
+
+ast_node sort_in_place(struct ast_arr ast, hashmap *ctx);
+ast_node sort_by(struct ast_arr ast, hashmap *ctx);
+ast_node binary_search(struct ast_arr ast, hashmap *ctx);
+ast_node unique(struct ast_arr ast, hashmap *ctx);
+
+#endif // SORT_H_
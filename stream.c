@@ -0,0 +1,230 @@
+#include "stream.h"
+#include "ast_walking.h"
+#include "closure.h"
+#include "eval.h"
+#include "generator.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "list.h"
+#include "parse.h"
+#include <assert.h>
+#include <string.h>
+
+// Where a fold has got to in the source of its stream
+typedef struct cursor {
+  int64_t at;
+  bool done;
+  struct cons_chunk *list;
+} cursor;
+
+static stream *stream_new(int size) {
+  return heap_alloc(sizeof(stream) + size * sizeof(stage), NULL);
+}
+
+static ast_node stream_node(stream *s) {
+  return (ast_node){.type = literal_t, .lit_t = stream_t, .value.stream = s};
+}
+
+static ast_node integer(int64_t i) {
+  return (ast_node){.type = literal_t, .lit_t = integer_t, .value.integer = i};
+}
+
+// Elements are passed to calls as they are, so only values will do
+static ast_node element(ast_node a) {
+  if (a.type != literal_t) {
+    eval_error("Streams can only hold values");
+  }
+  return (ast_node){.type = literal_t, .lit_t = a.lit_t, .value = a.value};
+}
+
+static ast_node call(ast_node *nodes, int size, hashmap *ctx) {
+  ast_node c = {.type = list_t,
+                .child = {.child_ast = nodes, .size = size, .cap = size}};
+  return ast_walk(c, ctx);
+}
+
+// Argument `i` as a stream, a list or generator becomes the source of one
+static stream *stream_arg(struct ast_arr ast, int i, hashmap *ctx) {
+  ast_node a = i < ast.size ? auto_ast_walk(ast.child_ast[i], ctx)
+                            : (ast_node){.type = tombstone_t};
+  if (a.type == literal_t && a.lit_t == stream_t) {
+    return a.value.stream;
+  }
+  if (a.type == literal_t && (a.lit_t == cons_t || a.lit_t == generator_t)) {
+    stream *s = stream_new(0);
+    s->size = 0;
+    if (a.lit_t == cons_t) {
+      s->source = SOURCE_LIST;
+      s->list = a.value.cons;
+    } else {
+      s->source = SOURCE_GENERATOR;
+      s->generator = a.value.generator;
+    }
+    return s;
+  }
+  eval_error("%s expects a stream as argument %d", ast.child_ast[0].value.ident,
+             i);
+}
+
+static int64_t integer_arg(struct ast_arr ast, int i, hashmap *ctx) {
+  ast_node a = auto_ast_walk(ast.child_ast[i], ctx);
+  if (a.type != literal_t || a.lit_t != integer_t) {
+    eval_error("%s expects an integer as argument %d",
+               ast.child_ast[0].value.ident, i);
+  }
+  return a.value.integer;
+}
+
+// A copy of `s` with `last` as its final stage
+static ast_node extend(stream *s, stage last) {
+  stream *t = stream_new(s->size + 1);
+  memcpy(t, s, sizeof(stream) + s->size * sizeof(stage));
+  t->stages[t->size++] = last;
+  return stream_node(t);
+}
+
+// The next element of the source, false once there are no more
+static bool pull(stream *s, cursor *c, ast_node *x) {
+  switch (s->source) {
+  case SOURCE_RANGE:
+    if (c->done || (s->range.bounded && (s->range.step > 0
+                                             ? c->at >= s->range.end
+                                             : c->at <= s->range.end))) {
+      return false;
+    }
+    *x = integer(c->at);
+    c->done = __builtin_add_overflow(c->at, s->range.step, &c->at);
+    return true;
+  case SOURCE_LIST:
+    if (!c->list) {
+      return false;
+    }
+    *x = list_first(c->list);
+    c->list = list_rest(c->list);
+    return true;
+  case SOURCE_GENERATOR:
+    if (!generator_take(s->generator, x)) {
+      return false;
+    }
+    *x = element(*x);
+    return true;
+  }
+  return false;
+}
+
+// Runs `x` through every stage, false if a filter drops it. `last` is set
+// once a take stage has let through all it ever will
+static bool pass(stream *s, int64_t *taken, ast_node *x, bool *last,
+                 hashmap *ctx) {
+  ast_node nodes[2];
+  for (int i = 0; i < s->size; i++) {
+    stage *st = &s->stages[i];
+    switch (st->kind) {
+    case STAGE_MAP:
+      nodes[0] = st->fn;
+      nodes[1] = *x;
+      *x = element(call(nodes, 2, ctx));
+      break;
+    case STAGE_FILTER: {
+      nodes[0] = st->fn;
+      nodes[1] = *x;
+      ast_node keep = call(nodes, 2, ctx);
+      if (keep.lit_t != bool_t) {
+        eval_error("stream-filter predicate must return a bool");
+      }
+      if (!keep.value.boolean) {
+        return false;
+      }
+      break;
+    }
+    case STAGE_TAKE:
+      if (++taken[i] >= st->count) {
+        *last = true;
+      }
+      break;
+    }
+  }
+  return true;
+}
+
+ast_node stream_range(struct ast_arr ast, hashmap *ctx) {
+  // (stream-range start end step), from start up to but not including end.
+  //  0            1     2   3
+  // The step defaults to 1, without an end the stream never finishes
+  assert(ast.child_ast[0].lit_t == ident_t);
+  if (ast.size < 2 || ast.size > 4) {
+    eval_error("stream-range expects a start, and optionally an end and a "
+               "step");
+  }
+  stream *s = stream_new(0);
+  s->source = SOURCE_RANGE;
+  s->size = 0;
+  s->range.start = integer_arg(ast, 1, ctx);
+  s->range.bounded = ast.size > 2;
+  s->range.end = s->range.bounded ? integer_arg(ast, 2, ctx) : 0;
+  s->range.step = ast.size > 3 ? integer_arg(ast, 3, ctx) : 1;
+  if (!s->range.step) {
+    eval_error("stream-range step can't be 0");
+  }
+  return stream_node(s);
+}
+
+ast_node stream_map(struct ast_arr ast, hashmap *ctx) {
+  // (stream-map f s)
+  //  0          1 2
+  assert(ast.child_ast[0].lit_t == ident_t);
+  ast_node f = function_value(ast, 1, ctx);
+  return extend(stream_arg(ast, 2, ctx), (stage){.kind = STAGE_MAP, .fn = f});
+}
+
+ast_node stream_filter(struct ast_arr ast, hashmap *ctx) {
+  // (stream-filter pred s), keeps the elements pred returns true for
+  //  0             1    2
+  assert(ast.child_ast[0].lit_t == ident_t);
+  ast_node f = function_value(ast, 1, ctx);
+  return extend(stream_arg(ast, 2, ctx),
+                (stage){.kind = STAGE_FILTER, .fn = f});
+}
+
+ast_node stream_take(struct ast_arr ast, hashmap *ctx) {
+  // (stream-take n s), the first n elements of s
+  //  0           1 2
+  assert(ast.child_ast[0].lit_t == ident_t);
+  int64_t n = integer_arg(ast, 1, ctx);
+  return extend(stream_arg(ast, 2, ctx),
+                (stage){.kind = STAGE_TAKE, .count = n});
+}
+
+ast_node stream_fold(struct ast_arr ast, hashmap *ctx) {
+  // (stream-fold f init s) is (f (f (f init a) b) c) for s of a, b and c
+  //  0           1 2    3
+  assert(ast.child_ast[0].lit_t == ident_t);
+  closure_buf stack;
+  ast_node nodes[3] = {function_arg(ast, 1, ctx, &stack)};
+  ast_node acc = auto_ast_walk(ast.child_ast[2], ctx);
+  stream *s = stream_arg(ast, 3, ctx);
+  int64_t taken[s->size + 1];
+  for (int i = 0; i < s->size; i++) {
+    taken[i] = 0;
+    if (s->stages[i].kind == STAGE_TAKE && s->stages[i].count <= 0) {
+      return acc;
+    }
+  }
+
+  cursor c = {0};
+  if (s->source == SOURCE_RANGE) {
+    c.at = s->range.start;
+  } else if (s->source == SOURCE_LIST) {
+    c.list = s->list;
+  }
+  ast_node x;
+  bool last = false;
+  while (!last && pull(s, &c, &x)) {
+    if (pass(s, taken, &x, &last, ctx)) {
+      nodes[1] = element(acc);
+      nodes[2] = x;
+      acc = call(nodes, 3, ctx);
+    }
+  }
+  return acc;
+}
@@ -0,0 +1,56 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A lazy sequence: where its elements come from, and the stages they go
+// through on the way out. Mapping, filtering or taking from a stream
+// doesn't run anything, it makes a new stream with one more stage. Only
+// stream-fold pulls elements, and each goes through every stage before
+// the next is made, so a pipeline holds one element at a time however
+// long its source is, and stops pulling once a take stage is full.
+// A list or a generator can be given anywhere a stream is expected.
+// Folding a stream over a generator uses up the generator's values
+typedef enum stream_source {
+  SOURCE_RANGE,
+  SOURCE_LIST,
+  SOURCE_GENERATOR,
+} stream_source;
+
+typedef enum stage_kind {
+  STAGE_MAP,
+  STAGE_FILTER,
+  STAGE_TAKE,
+} stage_kind;
+
+typedef struct stage {
+  stage_kind kind;
+  ast_node fn;   // map and filter
+  int64_t count; // take
+} stage;
+
+typedef struct stream {
+  stream_source source;
+  union {
+    struct {
+      int64_t start;
+      int64_t end;
+      int64_t step;
+      bool bounded; // without an end it runs until int64_t overflows
+    } range;
+    struct cons_chunk *list;
+    struct generator *generator;
+  };
+  int size;
+  stage stages[];
+} stream;
+
+ast_node stream_range(struct ast_arr ast, hashmap *ctx);
+ast_node stream_map(struct ast_arr ast, hashmap *ctx);
+ast_node stream_filter(struct ast_arr ast, hashmap *ctx);
+ast_node stream_take(struct ast_arr ast, hashmap *ctx);
+ast_node stream_fold(struct ast_arr ast, hashmap *ctx);
+
+#endif // STREAM_H_
@@ -0,0 +1,14 @@
+(var x 7)
+(const limit 100)
+(+ x 1 2)
+(- x 10)
+(* 2.5 4)
+(/ 7 2)
+(/ 7.0 2)
+(< x limit)
+(if (< limit x) 1 2)
+(begin (var x (* x 6)) x)
+(average 1 2 3 4)
+(abs (- 0 8))
+(func fact (n) (if (< n 1) 1 (* n (fact (- n 1)))))
+(fact 20)
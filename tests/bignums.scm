@@ -0,0 +1,9 @@
+(var big 9223372036854775807)
+(+ big 1)
+(* big big)
+(- (- 0 big) 2)
+(abs (- (- 0 big) 1))
+(* 5000000001 3)
+(func fact (n) (if (< n 1) 1 (* n (fact (- n 1)))))
+(fact 25)
+(- (+ big 1) 1)
@@ -0,0 +1,8 @@
+(func adder (n) (lambda (x) (+ x n)))
+(var add5 (adder 5))
+(add5 10)
+(fold (lambda (a b) (+ a (* b b))) 0 (list 1 2 3))
+(func counter-sum (n) (begin (var k 100) (map (lambda (x) (+ x k)) (list n n))))
+(counter-sum 1)
+(func outer (n) (begin (func a (x) (if (< x 1) 0 (b (- x 1)))) (func b (x) (a x)) (a n)))
+(outer 3)
@@ -0,0 +1,13 @@
+(var i 0)
+(var total 0)
+(while (< i 5) (var total (+ total i)) (var i (+ i 1)))
+(begin total)
+(do ((j 0 (+ j 1)) (acc 1 (* acc 2))) ((< 9 j) acc))
+(func grade (n) (cond ((< n 50) "fail") ((< n 80) "pass") (else "merit")))
+(grade 30)
+(grade 65)
+(grade 95)
+(func kind (n) (case n ((1 2 3) "small") (10 "ten") (else "other")))
+(kind 2)
+(kind 10)
+(kind 7)
@@ -0,0 +1,12 @@
+(func fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(var f (future (fib 20)))
+(touch f)
+(touch 5)
+(func sq (x) (* x x))
+(pmap sq 1 2 3 4)
+(var base 10)
+(func add-base (n) (+ n base))
+(var g (future (add-base 1)))
+(var later 1)
+(touch g)
+(+ (fib 22) (fib 21))
@@ -0,0 +1,8 @@
+(func count-up () (do ((i 0 (+ i 1))) ((< 2 i) false) (yield i)))
+(var g (make-generator count-up))
+(next g false)
+(next g false)
+(generator-done? g)
+(next g false)
+(generator-done? g)
+(next g "done")
@@ -0,0 +1,11 @@
+(var l (list 1 2 3 4))
+(cons 0 l)
+(car l)
+(cdr l)
+(length l)
+(null? (list))
+(null? l)
+(func double (x) (* 2 x))
+(map double l)
+(func add (a b) (+ a b))
+(fold add 0 l)
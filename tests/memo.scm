@@ -0,0 +1,11 @@
+(defmemo fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(fib 90)
+(memo-stats fib)
+(func sq (x) (* x x))
+(var m (memoize sq 3))
+(m 1)
+(m 2)
+(m 3)
+(m 4)
+(m 4)
+(memo-stats m)
@@ -0,0 +1,37 @@
+#!/bin/sh
+# usage: tests/run.sh [interpreter]
+# Runs every program in tests/ with --stream, which must print its .out
+# file exactly, errors included. Then runs it as a file twice, parsing it
+# and then loading the cached image. File mode only prints the result of
+# the last form, or the error that stopped it, which must match the last
+# line of the .out file
+bin=${1:-./schemelike}
+dir=$(dirname "$0")
+err=$(mktemp)
+failed=0
+
+for f in "$dir"/*.scm; do
+  expected="${f%.scm}.out"
+  if ! "$bin" --stream "$f" 2>&1 | diff -u "$expected" -; then
+    echo "FAIL $f --stream"
+    failed=1
+  fi
+  last=$(tail -n 1 "$expected")
+  for run in parsed cached; do
+    got=$("$bin" "$f" 2>"$err" | tail -n 1)
+    if [ -s "$err" ]; then
+      got=$(tail -n 1 "$err")
+    fi
+    if [ "$got" != "$last" ]; then
+      echo "FAIL $f ($run): expected $last, got $got"
+      failed=1
+    fi
+  done
+  rm -f "$f.slc"
+done
+rm -f "$err"
+
+if [ "$failed" = 0 ]; then
+  echo "all tests passed"
+fi
+exit $failed
@@ -0,0 +1,5 @@
+(func sq (x) (* x x))
+(func even (x) (< (- x (* 2 (/ x 2))) 1))
+(func add (a b) (+ a b))
+(stream-fold add 0 (stream-take 5 (stream-filter even (stream-map sq (stream-range 0 1000000 1)))))
+(stream-fold add 0 (stream-range 0 10 3))
@@ -0,0 +1,12 @@
+(var s (string-append "hello" ", " "world, and more"))
+(string-length s)
+(substring s 7 12)
+(substring s 7)
+(string->number "42")
+(string->number "4.5")
+(string->number "nope")
+(string-index s ",")
+(string-contains s "world")
+(string-contains s "moon")
+(string-split s ", ")
+(string-count s "o")
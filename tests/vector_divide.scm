@@ -0,0 +1,3 @@
+(var min (vector (- (- 0 9223372036854775807) 1)))
+(vector/ min (vector 1))
+(vector/ min (vector (- 0 1)))
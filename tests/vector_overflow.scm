@@ -0,0 +1,3 @@
+(var big (vector 9223372036854775807 1))
+(vector+ big (vector 0 1))
+(vector+ big (vector 1 1))
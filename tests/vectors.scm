@@ -0,0 +1,23 @@
+(var v (vector 5 3 9 1 3))
+(vector-length v)
+(vector-ref v 2)
+(vector-set! v 0 4)
+(begin v)
+(make-vector 3 1.5)
+(vector 1 2.5 3)
+(vector+ (vector 1 2 3) (vector 10 20 30))
+(vector- (vector 1 2 3) (vector 10 20 30))
+(vector* (vector 1 2 3) (vector 10 20 30))
+(vector/ (vector 10 20 30) (vector 2 4 5))
+(vector-sum v)
+(vector-dot (vector 1 2 3) (vector 4 5 6))
+(vector-min v)
+(vector-max v)
+(vector-scale (vector 1 2 3) 2)
+(vector-scale (vector 1 2 3) 0.5)
+(sort! v)
+(binary-search v 9)
+(binary-search v 2)
+(unique v)
+(func greater (a b) (< b a))
+(sort-by v greater)
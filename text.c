@@ -0,0 +1,220 @@
+#include "text.h"
+#include "ast_walking.h"
+#include "bignum.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool is_inline(text *t) { return (uint64_t)t & 1; }
+
+static text *text_inline(const char *s, int64_t len) {
+  uint64_t bits = (uint64_t)len << 1 | 1;
+  memcpy((char *)&bits + 1, s, len);
+  return (text *)bits;
+}
+
+// Flat string with its bytes copied in after the header
+text *text_new(const char *s, int64_t len) {
+  if (len <= TEXT_INLINE_MAX) {
+    return text_inline(s, len);
+  }
+  text *t = heap_alloc(sizeof(text) + len + 1, NULL);
+  char *bytes = (char *)(t + 1);
+  memcpy(bytes, s, len);
+  bytes[len] = '\0';
+  *t = (text){.len = len};
+  atomic_init(&t->bytes, bytes);
+  return t;
+}
+
+// Flat string sharing `s`, which must outlive it
+text *text_view(const char *s, int64_t len) {
+  if (len <= TEXT_INLINE_MAX) {
+    return text_inline(s, len);
+  }
+  text *t = heap_alloc(sizeof(text), NULL);
+  *t = (text){.len = len};
+  atomic_init(&t->bytes, s);
+  return t;
+}
+
+int64_t text_len(text *t) {
+  if (is_inline(t)) {
+    return ((uint64_t)t & 0xFF) >> 1;
+  }
+  return t->len;
+}
+
+// Walks the tree with an explicit stack, strings built by appending in a
+// loop are as deep as the loop is long
+static const char *flatten(text *t) {
+  const char *done = atomic_load_explicit(&t->bytes, memory_order_acquire);
+  if (done) {
+    return done;
+  }
+  char *buf = heap_alloc(t->len + 1, NULL);
+  int64_t pos = 0;
+  int cap = 16;
+  int size = 0;
+  text **stack = calloc(cap, sizeof(text *));
+  stack[size++] = t;
+  while (size) {
+    text *n = stack[--size];
+    if (is_inline(n) || atomic_load_explicit(&n->bytes, memory_order_acquire)) {
+      char small[TEXT_INLINE_MAX];
+      memcpy(&buf[pos], text_bytes(n, small), text_len(n));
+      pos += text_len(n);
+      continue;
+    }
+    if (size + 2 > cap) {
+      cap *= 2;
+      stack = reallocarray(stack, cap, sizeof(text *));
+    }
+    stack[size++] = n->right;
+    stack[size++] = n->left;
+  }
+  free(stack);
+  buf[t->len] = '\0';
+  // Another thread may have flattened it too, either copy will do
+  atomic_store_explicit(&t->bytes, buf, memory_order_release);
+  return buf;
+}
+
+const char *text_bytes(text *t, char *buf) {
+  if (is_inline(t)) {
+    uint64_t bits = (uint64_t)t;
+    memcpy(buf, (char *)&bits + 1, text_len(t));
+    return buf;
+  }
+  return flatten(t);
+}
+
+text *text_concat(text *a, text *b) {
+  int64_t len = text_len(a) + text_len(b);
+  if (!text_len(a)) {
+    return b;
+  }
+  if (!text_len(b)) {
+    return a;
+  }
+  if (len <= TEXT_COPY_MAX) {
+    char buf[TEXT_COPY_MAX];
+    char small[TEXT_INLINE_MAX];
+    memcpy(buf, text_bytes(a, small), text_len(a));
+    memcpy(&buf[text_len(a)], text_bytes(b, small), text_len(b));
+    return text_new(buf, len);
+  }
+  text *t = heap_alloc(sizeof(text), NULL);
+  *t = (text){.len = len, .left = a, .right = b};
+  atomic_init(&t->bytes, NULL);
+  return t;
+}
+
+// Shares the bytes of `t`, flattening it first if needed
+text *text_slice(text *t, int64_t start, int64_t end) {
+  char small[TEXT_INLINE_MAX];
+  const char *bytes = text_bytes(t, small);
+  if (!start && end == text_len(t)) {
+    return t;
+  }
+  if (end - start <= TEXT_INLINE_MAX) {
+    return text_inline(&bytes[start], end - start);
+  }
+  return text_view(&bytes[start], end - start);
+}
+
+text *text_of(ast_node a) {
+  if (a.lit_t == text_t) {
+    return a.value.text;
+  }
+  if (a.lit_t == string_t) {
+    return text_view(a.value.string, strlen(a.value.string));
+  }
+  return NULL;
+}
+
+ast_node text_node(text *t) {
+  return (ast_node){.type = literal_t, .lit_t = text_t, .value.text = t};
+}
+
+void text_print(FILE *out, text *t) {
+  char small[TEXT_INLINE_MAX];
+  fprintf(out, "\"%.*s\"", (int)text_len(t), text_bytes(t, small));
+}
+
+static text *text_arg(struct ast_arr ast, int i, hashmap *ctx) {
+  text *t = text_of(auto_ast_walk(ast.child_ast[i], ctx));
+  if (!t) {
+    eval_error("%s expects a string as argument %d",
+               ast.child_ast[0].value.ident, i);
+  }
+  return t;
+}
+
+ast_node string_append(struct ast_arr ast, hashmap *ctx) {
+  // (string-append a b ...)
+  assert(ast.child_ast[0].lit_t == ident_t);
+  text *t = text_inline("", 0);
+  for (int i = 1; i < ast.size; i++) {
+    t = text_concat(t, text_arg(ast, i, ctx));
+  }
+  return text_node(t);
+}
+
+ast_node substring(struct ast_arr ast, hashmap *ctx) {
+  // (substring s start [end]), shares the bytes of s
+  assert(ast.child_ast[0].lit_t == ident_t);
+  text *t = text_arg(ast, 1, ctx);
+  ast_node start = auto_ast_walk(ast.child_ast[2], ctx);
+  ast_node end = {.lit_t = integer_t, .value.integer = text_len(t)};
+  if (ast.size > 3) {
+    end = auto_ast_walk(ast.child_ast[3], ctx);
+  }
+  if (start.lit_t != integer_t || end.lit_t != integer_t ||
+      start.value.integer < 0 || end.value.integer > text_len(t) ||
+      start.value.integer > end.value.integer) {
+    eval_error("substring range out of bounds for string of length %ld",
+               text_len(t));
+  }
+  return text_node(text_slice(t, start.value.integer, end.value.integer));
+}
+
+ast_node string_length(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  return (ast_node){.type = literal_t,
+                    .lit_t = integer_t,
+                    .value.integer = text_len(text_arg(ast, 1, ctx))};
+}
+
+ast_node string_to_number(struct ast_arr ast, hashmap *ctx) {
+  // (string->number s), false when s isn't a number
+  assert(ast.child_ast[0].lit_t == ident_t);
+  text *t = text_arg(ast, 1, ctx);
+  char small[TEXT_INLINE_MAX];
+  char *s = strndup(text_bytes(t, small), text_len(t));
+  ast_node n = {.type = literal_t, .lit_t = bool_t, .value.boolean = false};
+  char *end;
+  errno = 0;
+  int64_t integer = strtoll(s, &end, 10);
+  if (*s && !*end && !errno) {
+    n.lit_t = integer_t;
+    n.value.integer = integer;
+  } else if (*s && !*end && errno == ERANGE) {
+    n = bignum_parse(s, true);
+  } else {
+    double floating = strtod(s, &end);
+    if (*s && !*end) {
+      n.lit_t = floating_t;
+      n.value.floating = floating;
+    }
+  }
+  free(s);
+  return n;
+}
@@ -0,0 +1,45 @@
+#ifndef TEXT_H_
+#define TEXT_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Runtime strings, immutable once made.
+// Strings of up to TEXT_INLINE_MAX bytes live in the pointer itself: the
+// low bit is set, the rest of the low byte is the length and the bytes
+// follow, so they need no allocation at all.
+// Longer strings are either flat, `bytes` pointing at `len` bytes that may
+// be shared with another string or a literal, or a concatenation of `left`
+// and `right` that is flattened the first time its bytes are needed
+typedef struct text {
+  int64_t len;
+  _Atomic(const char *) bytes; // NULL until a concatenation is flattened
+  struct text *left;
+  struct text *right;
+} text;
+
+#define TEXT_INLINE_MAX 7
+// Concatenations up to this long are copied rather than linked
+#define TEXT_COPY_MAX 64
+
+text *text_new(const char *, int64_t);
+text *text_view(const char *, int64_t);
+text *text_concat(text *, text *);
+text *text_slice(text *, int64_t start, int64_t end);
+int64_t text_len(text *);
+// The bytes of `t`, not NUL terminated. Inline strings are copied into
+// `buf` which must hold TEXT_INLINE_MAX bytes
+const char *text_bytes(text *t, char *buf);
+// The string in `a`, literals are viewed in place. NULL when not a string
+text *text_of(ast_node a);
+ast_node text_node(text *);
+void text_print(FILE *, text *);
+
+ast_node string_append(struct ast_arr ast, hashmap *ctx);
+ast_node substring(struct ast_arr ast, hashmap *ctx);
+ast_node string_length(struct ast_arr ast, hashmap *ctx);
+ast_node string_to_number(struct ast_arr ast, hashmap *ctx);
+
+#endif // TEXT_H_
@@ -44,6 +44,32 @@ bool str_whitespace(string *s, uint16_t pos) {
   }
 }
 
+// Returns a null terminated heap copy of the whole file, or NULL
+// `len` is set to the number of bytes read when not NULL
+char *read_file(const char *path, size_t *len) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return NULL;
+  }
+  size_t cap = 4096;
+  size_t size = 0;
+  char *buf = malloc(cap);
+  size_t n;
+  while ((n = fread(buf + size, sizeof(char), cap - size - 1, fp)) > 0) {
+    size += n;
+    if (size + 1 == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  fclose(fp);
+  buf[size] = 0;
+  if (len) {
+    *len = size;
+  }
+  return buf;
+}
+
 /* int main() { */
 /*   char *str = malloc(30); */
 /*   strcpy(str, "hi mom"); */
@@ -2,6 +2,7 @@
 #define UTILS_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 typedef struct string {
   char *str;
@@ -15,5 +16,6 @@ string str_new(char *, int16_t);
 string str_auto(const char *);
 
 bool str_whitespace(string *, uint16_t);
+char *read_file(const char *, size_t *);
 
 #endif // UTILS_H_
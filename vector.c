@@ -0,0 +1,831 @@
+#include "vector.h"
+#include "ast_walking.h"
+#include "bignum.h"
+#include "eval.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "parse.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef enum vector_op { VEC_ADD, VEC_SUB, VEC_MUL, VEC_DIV } vector_op;
+
+// Scalar kernels, used on their own when there is no SIMD and for the
+// tails that don't fill a whole register otherwise
+
+static void f64_binop_scalar(vector_op op, double *dst, const double *a,
+                             const double *b, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    switch (op) {
+    case VEC_ADD:
+      dst[i] = a[i] + b[i];
+      break;
+    case VEC_SUB:
+      dst[i] = a[i] - b[i];
+      break;
+    case VEC_MUL:
+      dst[i] = a[i] * b[i];
+      break;
+    case VEC_DIV:
+      dst[i] = a[i] / b[i];
+      break;
+    }
+  }
+}
+
+static double f64_sum_scalar(const double *a, int64_t n) {
+  double sum = 0;
+  for (int64_t i = 0; i < n; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+static double f64_dot_scalar(const double *a, const double *b, int64_t n) {
+  double sum = 0;
+  for (int64_t i = 0; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+static double f64_min_scalar(const double *a, int64_t n) {
+  double min = a[0];
+  for (int64_t i = 1; i < n; i++) {
+    min = a[i] < min ? a[i] : min;
+  }
+  return min;
+}
+
+static double f64_max_scalar(const double *a, int64_t n) {
+  double max = a[0];
+  for (int64_t i = 1; i < n; i++) {
+    max = a[i] > max ? a[i] : max;
+  }
+  return max;
+}
+
+static void f64_scale_scalar(double *dst, const double *a, double k,
+                             int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    dst[i] = a[i] * k;
+  }
+}
+
+// An integer vector can't hold the bignum an element would promote to
+static void overflow(vector_op op) {
+  static const char *names[] = {"vector+", "vector-", "vector*", "vector/"};
+  eval_error("Integer overflow in %s", names[op]);
+}
+
+static void i64_binop_scalar(vector_op op, int64_t *dst, const int64_t *a,
+                             const int64_t *b, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    bool overflowed = false;
+    switch (op) {
+    case VEC_ADD:
+      overflowed = __builtin_add_overflow(a[i], b[i], &dst[i]);
+      break;
+    case VEC_SUB:
+      overflowed = __builtin_sub_overflow(a[i], b[i], &dst[i]);
+      break;
+    case VEC_MUL:
+      overflowed = __builtin_mul_overflow(a[i], b[i], &dst[i]);
+      break;
+    case VEC_DIV:
+      if (!b[i]) {
+        eval_error("Division by zero in vector/");
+      }
+      // The one quotient that doesn't fit, and traps instead of wrapping
+      overflowed = a[i] == INT64_MIN && b[i] == -1;
+      if (!overflowed) {
+        dst[i] = a[i] / b[i];
+      }
+      break;
+    }
+    if (overflowed) {
+      overflow(op);
+    }
+  }
+}
+
+// An exact sum of int64s in three parts that can't overflow for fewer than
+// 2^31 elements: the sums of each element's top and bottom 32 bits taken
+// as unsigned, and the number of negative elements, each of which the
+// unsigned view made 2^64 too large
+typedef struct i64_total {
+  uint64_t high;
+  uint64_t low;
+  uint64_t negative;
+} i64_total;
+
+static void i64_sum_scalar(i64_total *t, const int64_t *a, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    uint64_t u = a[i];
+    t->high += u >> 32;
+    t->low += u & UINT32_MAX;
+    t->negative += u >> 63;
+  }
+}
+
+static int64_t i64_min_scalar(const int64_t *a, int64_t n) {
+  int64_t min = a[0];
+  for (int64_t i = 1; i < n; i++) {
+    min = a[i] < min ? a[i] : min;
+  }
+  return min;
+}
+
+static int64_t i64_max_scalar(const int64_t *a, int64_t n) {
+  int64_t max = a[0];
+  for (int64_t i = 1; i < n; i++) {
+    max = a[i] > max ? a[i] : max;
+  }
+  return max;
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of x86-64, so these are the baseline
+
+static void f64_binop_sse2(vector_op op, double *dst, const double *a,
+                           const double *b, int64_t n) {
+  int64_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d x = _mm_loadu_pd(&a[i]);
+    __m128d y = _mm_loadu_pd(&b[i]);
+    switch (op) {
+    case VEC_ADD:
+      x = _mm_add_pd(x, y);
+      break;
+    case VEC_SUB:
+      x = _mm_sub_pd(x, y);
+      break;
+    case VEC_MUL:
+      x = _mm_mul_pd(x, y);
+      break;
+    case VEC_DIV:
+      x = _mm_div_pd(x, y);
+      break;
+    }
+    _mm_storeu_pd(&dst[i], x);
+  }
+  f64_binop_scalar(op, &dst[i], &a[i], &b[i], n - i);
+}
+
+static double f64_sum_sse2(const double *a, int64_t n) {
+  __m128d acc = _mm_setzero_pd();
+  int64_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_loadu_pd(&a[i]));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  return lanes[0] + lanes[1] + f64_sum_scalar(&a[i], n - i);
+}
+
+static double f64_dot_sse2(const double *a, const double *b, int64_t n) {
+  __m128d acc = _mm_setzero_pd();
+  int64_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc,
+                     _mm_mul_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i])));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  return lanes[0] + lanes[1] + f64_dot_scalar(&a[i], &b[i], n - i);
+}
+
+static double f64_min_sse2(const double *a, int64_t n) {
+  if (n < 2) {
+    return f64_min_scalar(a, n);
+  }
+  __m128d acc = _mm_loadu_pd(a);
+  int64_t i = 2;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_min_pd(acc, _mm_loadu_pd(&a[i]));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  double min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+  for (; i < n; i++) {
+    min = a[i] < min ? a[i] : min;
+  }
+  return min;
+}
+
+static double f64_max_sse2(const double *a, int64_t n) {
+  if (n < 2) {
+    return f64_max_scalar(a, n);
+  }
+  __m128d acc = _mm_loadu_pd(a);
+  int64_t i = 2;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_max_pd(acc, _mm_loadu_pd(&a[i]));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  double max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+  for (; i < n; i++) {
+    max = a[i] > max ? a[i] : max;
+  }
+  return max;
+}
+
+static void f64_scale_sse2(double *dst, const double *a, double k,
+                           int64_t n) {
+  __m128d factor = _mm_set1_pd(k);
+  int64_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(&dst[i], _mm_mul_pd(_mm_loadu_pd(&a[i]), factor));
+  }
+  f64_scale_scalar(&dst[i], &a[i], k, n - i);
+}
+
+// There is no packed 64 bit multiply or divide below AVX-512, so only
+// addition and subtraction are vectorised for integers. The lanes wrap,
+// a lane overflowed when its result's sign differs from both operands'
+// for addition, from the first's and not the second's for subtraction.
+// The sign bits of every lane are or'ed together and checked at the end
+static void i64_binop_sse2(vector_op op, int64_t *dst, const int64_t *a,
+                           const int64_t *b, int64_t n) {
+  if (op != VEC_ADD && op != VEC_SUB) {
+    i64_binop_scalar(op, dst, a, b, n);
+    return;
+  }
+  __m128i wrapped = _mm_setzero_si128();
+  int64_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i *)&a[i]);
+    __m128i y = _mm_loadu_si128((const __m128i *)&b[i]);
+    __m128i r = op == VEC_ADD ? _mm_add_epi64(x, y) : _mm_sub_epi64(x, y);
+    __m128i other = op == VEC_ADD ? _mm_xor_si128(y, r) : _mm_xor_si128(x, y);
+    wrapped = _mm_or_si128(wrapped,
+                           _mm_and_si128(_mm_xor_si128(x, r), other));
+    _mm_storeu_si128((__m128i *)&dst[i], r);
+  }
+  if (_mm_movemask_pd(_mm_castsi128_pd(wrapped))) {
+    overflow(op);
+  }
+  i64_binop_scalar(op, &dst[i], &a[i], &b[i], n - i);
+}
+
+static void i64_sum_sse2(i64_total *t, const int64_t *a, int64_t n) {
+  __m128i high = _mm_setzero_si128();
+  __m128i low = _mm_setzero_si128();
+  __m128i negative = _mm_setzero_si128();
+  __m128i mask = _mm_set1_epi64x(UINT32_MAX);
+  int64_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i *)&a[i]);
+    high = _mm_add_epi64(high, _mm_srli_epi64(x, 32));
+    low = _mm_add_epi64(low, _mm_and_si128(x, mask));
+    negative = _mm_add_epi64(negative, _mm_srli_epi64(x, 63));
+  }
+  uint64_t lanes[3][2];
+  _mm_storeu_si128((__m128i *)lanes[0], high);
+  _mm_storeu_si128((__m128i *)lanes[1], low);
+  _mm_storeu_si128((__m128i *)lanes[2], negative);
+  t->high = lanes[0][0] + lanes[0][1];
+  t->low = lanes[1][0] + lanes[1][1];
+  t->negative = lanes[2][0] + lanes[2][1];
+  i64_sum_scalar(t, &a[i], n - i);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void f64_binop_avx2(vector_op op, double *dst, const double *a,
+                                const double *b, int64_t n) {
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(&a[i]);
+    __m256d y = _mm256_loadu_pd(&b[i]);
+    switch (op) {
+    case VEC_ADD:
+      x = _mm256_add_pd(x, y);
+      break;
+    case VEC_SUB:
+      x = _mm256_sub_pd(x, y);
+      break;
+    case VEC_MUL:
+      x = _mm256_mul_pd(x, y);
+      break;
+    case VEC_DIV:
+      x = _mm256_div_pd(x, y);
+      break;
+    }
+    _mm256_storeu_pd(&dst[i], x);
+  }
+  f64_binop_scalar(op, &dst[i], &a[i], &b[i], n - i);
+}
+
+AVX2 static double f64_sum_avx2(const double *a, int64_t n) {
+  __m256d acc = _mm256_setzero_pd();
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_add_pd(acc, _mm256_loadu_pd(&a[i]));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         f64_sum_scalar(&a[i], n - i);
+}
+
+AVX2 static double f64_dot_avx2(const double *a, const double *b,
+                                int64_t n) {
+  __m256d acc = _mm256_setzero_pd();
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_add_pd(
+        acc, _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         f64_dot_scalar(&a[i], &b[i], n - i);
+}
+
+AVX2 static double f64_min_avx2(const double *a, int64_t n) {
+  if (n < 4) {
+    return f64_min_scalar(a, n);
+  }
+  __m256d acc = _mm256_loadu_pd(a);
+  int64_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_min_pd(acc, _mm256_loadu_pd(&a[i]));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  double min = f64_min_scalar(lanes, 4);
+  for (; i < n; i++) {
+    min = a[i] < min ? a[i] : min;
+  }
+  return min;
+}
+
+AVX2 static double f64_max_avx2(const double *a, int64_t n) {
+  if (n < 4) {
+    return f64_max_scalar(a, n);
+  }
+  __m256d acc = _mm256_loadu_pd(a);
+  int64_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_max_pd(acc, _mm256_loadu_pd(&a[i]));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  double max = f64_max_scalar(lanes, 4);
+  for (; i < n; i++) {
+    max = a[i] > max ? a[i] : max;
+  }
+  return max;
+}
+
+AVX2 static void f64_scale_avx2(double *dst, const double *a, double k,
+                                int64_t n) {
+  __m256d factor = _mm256_set1_pd(k);
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(&dst[i], _mm256_mul_pd(_mm256_loadu_pd(&a[i]), factor));
+  }
+  f64_scale_scalar(&dst[i], &a[i], k, n - i);
+}
+
+AVX2 static void i64_binop_avx2(vector_op op, int64_t *dst, const int64_t *a,
+                                const int64_t *b, int64_t n) {
+  if (op != VEC_ADD && op != VEC_SUB) {
+    i64_binop_scalar(op, dst, a, b, n);
+    return;
+  }
+  // Overflow is found as in i64_binop_sse2
+  __m256i wrapped = _mm256_setzero_si256();
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)&a[i]);
+    __m256i y = _mm256_loadu_si256((const __m256i *)&b[i]);
+    __m256i r =
+        op == VEC_ADD ? _mm256_add_epi64(x, y) : _mm256_sub_epi64(x, y);
+    __m256i other =
+        op == VEC_ADD ? _mm256_xor_si256(y, r) : _mm256_xor_si256(x, y);
+    wrapped = _mm256_or_si256(
+        wrapped, _mm256_and_si256(_mm256_xor_si256(x, r), other));
+    _mm256_storeu_si256((__m256i *)&dst[i], r);
+  }
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(wrapped))) {
+    overflow(op);
+  }
+  i64_binop_scalar(op, &dst[i], &a[i], &b[i], n - i);
+}
+
+AVX2 static void i64_sum_avx2(i64_total *t, const int64_t *a, int64_t n) {
+  __m256i high = _mm256_setzero_si256();
+  __m256i low = _mm256_setzero_si256();
+  __m256i negative = _mm256_setzero_si256();
+  __m256i mask = _mm256_set1_epi64x(UINT32_MAX);
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)&a[i]);
+    high = _mm256_add_epi64(high, _mm256_srli_epi64(x, 32));
+    low = _mm256_add_epi64(low, _mm256_and_si256(x, mask));
+    negative = _mm256_add_epi64(negative, _mm256_srli_epi64(x, 63));
+  }
+  uint64_t lanes[3][4];
+  _mm256_storeu_si256((__m256i *)lanes[0], high);
+  _mm256_storeu_si256((__m256i *)lanes[1], low);
+  _mm256_storeu_si256((__m256i *)lanes[2], negative);
+  for (int j = 0; j < 4; j++) {
+    t->high += lanes[0][j];
+    t->low += lanes[1][j];
+    t->negative += lanes[2][j];
+  }
+  i64_sum_scalar(t, &a[i], n - i);
+}
+
+// SSE2 has no 64 bit compare, AVX2 does
+AVX2 static int64_t i64_min_avx2(const int64_t *a, int64_t n) {
+  if (n < 4) {
+    return i64_min_scalar(a, n);
+  }
+  __m256i acc = _mm256_loadu_si256((const __m256i *)a);
+  int64_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)&a[i]);
+    acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+  }
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  int64_t min = i64_min_scalar(lanes, 4);
+  for (; i < n; i++) {
+    min = a[i] < min ? a[i] : min;
+  }
+  return min;
+}
+
+AVX2 static int64_t i64_max_avx2(const int64_t *a, int64_t n) {
+  if (n < 4) {
+    return i64_max_scalar(a, n);
+  }
+  __m256i acc = _mm256_loadu_si256((const __m256i *)a);
+  int64_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)&a[i]);
+    acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+  }
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  int64_t max = i64_max_scalar(lanes, 4);
+  for (; i < n; i++) {
+    max = a[i] > max ? a[i] : max;
+  }
+  return max;
+}
+#endif
+
+// Picked once at startup for the CPU we are running on
+static struct {
+  void (*f64_binop)(vector_op, double *, const double *, const double *,
+                    int64_t);
+  double (*f64_sum)(const double *, int64_t);
+  double (*f64_dot)(const double *, const double *, int64_t);
+  double (*f64_min)(const double *, int64_t);
+  double (*f64_max)(const double *, int64_t);
+  void (*f64_scale)(double *, const double *, double, int64_t);
+  void (*i64_binop)(vector_op, int64_t *, const int64_t *, const int64_t *,
+                    int64_t);
+  void (*i64_sum)(i64_total *, const int64_t *, int64_t);
+  int64_t (*i64_min)(const int64_t *, int64_t);
+  int64_t (*i64_max)(const int64_t *, int64_t);
+} kernels = {f64_binop_scalar, f64_sum_scalar, f64_dot_scalar,
+             f64_min_scalar,   f64_max_scalar, f64_scale_scalar,
+             i64_binop_scalar, i64_sum_scalar, i64_min_scalar,
+             i64_max_scalar};
+
+__attribute__((constructor)) static void pick_kernels(void) {
+#if defined(__x86_64__)
+  kernels.f64_binop = f64_binop_sse2;
+  kernels.f64_sum = f64_sum_sse2;
+  kernels.f64_dot = f64_dot_sse2;
+  kernels.f64_min = f64_min_sse2;
+  kernels.f64_max = f64_max_sse2;
+  kernels.f64_scale = f64_scale_sse2;
+  kernels.i64_binop = i64_binop_sse2;
+  kernels.i64_sum = i64_sum_sse2;
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.f64_binop = f64_binop_avx2;
+    kernels.f64_sum = f64_sum_avx2;
+    kernels.f64_dot = f64_dot_avx2;
+    kernels.f64_min = f64_min_avx2;
+    kernels.f64_max = f64_max_avx2;
+    kernels.f64_scale = f64_scale_avx2;
+    kernels.i64_binop = i64_binop_avx2;
+    kernels.i64_sum = i64_sum_avx2;
+    kernels.i64_min = i64_min_avx2;
+    kernels.i64_max = i64_max_avx2;
+  }
+#endif
+}
+
+vector *vector_new(literal_type elem, int64_t size) {
+  size_t bytes;
+  if (size < 0) {
+    eval_error("Vector size must not be negative");
+  }
+  if (__builtin_mul_overflow(sizeof(int64_t), (uint64_t)size, &bytes) ||
+      __builtin_add_overflow(bytes, sizeof(vector), &bytes)) {
+    eval_error("Vector size %ld is too large", size);
+  }
+  vector *v = heap_alloc(bytes, NULL);
+  v->elem = elem;
+  v->size = size;
+  v->integers = (int64_t *)(v + 1);
+  return v;
+}
+
+ast_node vector_node(vector *v) {
+  return (ast_node){.type = literal_t, .lit_t = vector_t, .value.vector = v};
+}
+
+void vector_print(FILE *out, vector *v) {
+  fprintf(out, "#(");
+  for (int64_t i = 0; i < v->size; i++) {
+    if (v->elem == integer_t) {
+      fprintf(out, "%ld", v->integers[i]);
+    } else {
+      fprintf(out, "%f", v->floats[i]);
+    }
+    if (i != v->size - 1) {
+      fputc(' ', out);
+    }
+  }
+  fputc(')', out);
+}
+
+static vector *vector_arg(struct ast_arr ast, int i, hashmap *ctx) {
+  ast_node a = auto_ast_walk(ast.child_ast[i], ctx);
+  if (a.lit_t != vector_t) {
+    eval_error("%s expects a vector as argument %d",
+               ast.child_ast[0].value.ident, i);
+  }
+  return a.value.vector;
+}
+
+static ast_node number_arg(struct ast_arr ast, int i, hashmap *ctx) {
+  ast_node a = auto_ast_walk(ast.child_ast[i], ctx);
+  if (a.lit_t != integer_t && a.lit_t != floating_t) {
+    eval_error("%s expects a number as argument %d",
+               ast.child_ast[0].value.ident, i);
+  }
+  return a;
+}
+
+static int64_t index_arg(struct ast_arr ast, int i, vector *v,
+                         hashmap *ctx) {
+  ast_node index = number_arg(ast, i, ctx);
+  if (index.lit_t != integer_t || index.value.integer < 0 ||
+      index.value.integer >= v->size) {
+    eval_error("Vector index out of range for vector of size %ld", v->size);
+  }
+  return index.value.integer;
+}
+
+static ast_node element(vector *v, int64_t i) {
+  if (v->elem == integer_t) {
+    return (ast_node){
+        .type = literal_t, .lit_t = integer_t, .value.integer = v->integers[i]};
+  }
+  return (ast_node){
+      .type = literal_t, .lit_t = floating_t, .value.floating = v->floats[i]};
+}
+
+ast_node make_vector(struct ast_arr ast, hashmap *ctx) {
+  // (make-vector size [fill]), the fill decides the element type
+  assert(ast.child_ast[0].lit_t == ident_t);
+  ast_node size = number_arg(ast, 1, ctx);
+  if (size.lit_t != integer_t) {
+    eval_error("make-vector expects an integer size");
+  }
+  ast_node fill = {.lit_t = integer_t, .value.integer = 0};
+  if (ast.size > 2) {
+    fill = number_arg(ast, 2, ctx);
+  }
+  vector *v = vector_new(fill.lit_t, size.value.integer);
+  for (int64_t i = 0; i < v->size; i++) {
+    v->integers[i] = fill.value.integer; // copies the bits of either type
+  }
+  return vector_node(v);
+}
+
+ast_node vector_literal(struct ast_arr ast, hashmap *ctx) {
+  // (vector 1 2 3), any float makes it a vector of floats
+  assert(ast.child_ast[0].lit_t == ident_t);
+  // Filled as integers until a float converts the ones before it
+  int64_t size = ast.size - 1;
+  vector *v = vector_new(integer_t, size);
+  for (int64_t i = 0; i < size; i++) {
+    ast_node value = number_arg(ast, i + 1, ctx);
+    if (value.lit_t == floating_t && v->elem == integer_t) {
+      for (int64_t j = 0; j < i; j++) {
+        v->floats[j] = (double)v->integers[j];
+      }
+      v->elem = floating_t;
+    }
+    if (v->elem == integer_t) {
+      v->integers[i] = value.value.integer;
+    } else {
+      v->floats[i] = value.lit_t == integer_t ? (double)value.value.integer
+                                              : value.value.floating;
+    }
+  }
+  return vector_node(v);
+}
+
+ast_node vector_length(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = vector_arg(ast, 1, ctx);
+  return (ast_node){
+      .type = literal_t, .lit_t = integer_t, .value.integer = v->size};
+}
+
+ast_node vector_ref(struct ast_arr ast, hashmap *ctx) {
+  // (vector-ref v i)
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = vector_arg(ast, 1, ctx);
+  return element(v, index_arg(ast, 2, v, ctx));
+}
+
+ast_node vector_set(struct ast_arr ast, hashmap *ctx) {
+  // (vector-set! v i value), returns value
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = vector_arg(ast, 1, ctx);
+  int64_t i = index_arg(ast, 2, v, ctx);
+  ast_node value = number_arg(ast, 3, ctx);
+  if (v->elem == integer_t) {
+    if (value.lit_t != integer_t) {
+      eval_error("Cannot store a float in an integer vector");
+    }
+    v->integers[i] = value.value.integer;
+  } else {
+    v->floats[i] = value.lit_t == integer_t ? (double)value.value.integer
+                                            : value.value.floating;
+  }
+  return value;
+}
+
+static ast_node binop(vector_op op, struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *a = vector_arg(ast, 1, ctx);
+  vector *b = vector_arg(ast, 2, ctx);
+  if (a->elem != b->elem || a->size != b->size) {
+    eval_error("%s needs two vectors of the same type and size",
+               ast.child_ast[0].value.ident);
+  }
+  vector *dst = vector_new(a->elem, a->size);
+  if (a->elem == integer_t) {
+    kernels.i64_binop(op, dst->integers, a->integers, b->integers, a->size);
+  } else {
+    kernels.f64_binop(op, dst->floats, a->floats, b->floats, a->size);
+  }
+  return vector_node(dst);
+}
+
+ast_node vector_add(struct ast_arr ast, hashmap *ctx) {
+  return binop(VEC_ADD, ast, ctx);
+}
+
+ast_node vector_sub(struct ast_arr ast, hashmap *ctx) {
+  return binop(VEC_SUB, ast, ctx);
+}
+
+ast_node vector_mul(struct ast_arr ast, hashmap *ctx) {
+  return binop(VEC_MUL, ast, ctx);
+}
+
+ast_node vector_div(struct ast_arr ast, hashmap *ctx) {
+  return binop(VEC_DIV, ast, ctx);
+}
+
+static ast_node integer(int64_t i) {
+  return (ast_node){.type = literal_t, .lit_t = integer_t, .value.integer = i};
+}
+
+// The sum `t` stands for, a bignum when it doesn't fit
+static ast_node total(i64_total t) {
+  __int128 sum = ((__int128)t.high << 32) + t.low - ((__int128)t.negative << 64);
+  if (sum >= INT64_MIN && sum <= INT64_MAX) {
+    return integer(sum);
+  }
+  ast_node word = integer((int64_t)1 << 32);
+  ast_node big = bignum_add(bignum_mul(integer(t.high), word), integer(t.low));
+  return bignum_sub(big, bignum_mul(bignum_mul(integer(t.negative), word), word));
+}
+
+ast_node vector_sum(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = vector_arg(ast, 1, ctx);
+  if (v->elem == integer_t) {
+    i64_total t = {0};
+    kernels.i64_sum(&t, v->integers, v->size);
+    return total(t);
+  }
+  return (ast_node){.type = literal_t,
+                    .lit_t = floating_t,
+                    .value.floating = kernels.f64_sum(v->floats, v->size)};
+}
+
+ast_node vector_dot(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *a = vector_arg(ast, 1, ctx);
+  vector *b = vector_arg(ast, 2, ctx);
+  if (a->elem != b->elem || a->size != b->size) {
+    eval_error("vector-dot needs two vectors of the same type and size");
+  }
+  if (a->elem == integer_t) {
+    int64_t sum = 0;
+    int64_t i = 0;
+    for (int64_t p, next; i < a->size; i++, sum = next) {
+      if (__builtin_mul_overflow(a->integers[i], b->integers[i], &p) ||
+          __builtin_add_overflow(sum, p, &next)) {
+        break;
+      }
+    }
+    // From the first overflow on it's bignum arithmetic
+    ast_node acc = integer(sum);
+    for (; i < a->size; i++) {
+      acc = bignum_add(
+          acc, bignum_mul(integer(a->integers[i]), integer(b->integers[i])));
+    }
+    return acc;
+  }
+  return (ast_node){
+      .type = literal_t,
+      .lit_t = floating_t,
+      .value.floating = kernels.f64_dot(a->floats, b->floats, a->size)};
+}
+
+static vector *nonempty_arg(struct ast_arr ast, hashmap *ctx) {
+  vector *v = vector_arg(ast, 1, ctx);
+  if (!v->size) {
+    eval_error("%s of an empty vector", ast.child_ast[0].value.ident);
+  }
+  return v;
+}
+
+ast_node vector_min(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = nonempty_arg(ast, ctx);
+  if (v->elem == integer_t) {
+    return (ast_node){.type = literal_t,
+                      .lit_t = integer_t,
+                      .value.integer = kernels.i64_min(v->integers, v->size)};
+  }
+  return (ast_node){.type = literal_t,
+                    .lit_t = floating_t,
+                    .value.floating = kernels.f64_min(v->floats, v->size)};
+}
+
+ast_node vector_max(struct ast_arr ast, hashmap *ctx) {
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = nonempty_arg(ast, ctx);
+  if (v->elem == integer_t) {
+    return (ast_node){.type = literal_t,
+                      .lit_t = integer_t,
+                      .value.integer = kernels.i64_max(v->integers, v->size)};
+  }
+  return (ast_node){.type = literal_t,
+                    .lit_t = floating_t,
+                    .value.floating = kernels.f64_max(v->floats, v->size)};
+}
+
+ast_node vector_scale(struct ast_arr ast, hashmap *ctx) {
+  // (vector-scale v k), an integer vector scaled by a float becomes floats
+  assert(ast.child_ast[0].lit_t == ident_t);
+  vector *v = vector_arg(ast, 1, ctx);
+  ast_node k = number_arg(ast, 2, ctx);
+  if (v->elem == integer_t && k.lit_t == integer_t) {
+    vector *dst = vector_new(integer_t, v->size);
+    for (int64_t i = 0; i < v->size; i++) {
+      if (__builtin_mul_overflow(v->integers[i], k.value.integer,
+                                 &dst->integers[i])) {
+        eval_error("Integer overflow in vector-scale");
+      }
+    }
+    return vector_node(dst);
+  }
+
+  double factor =
+      k.lit_t == integer_t ? (double)k.value.integer : k.value.floating;
+  vector *dst = vector_new(floating_t, v->size);
+  if (v->elem == integer_t) {
+    for (int64_t i = 0; i < v->size; i++) {
+      dst->floats[i] = v->integers[i] * factor;
+    }
+  } else {
+    kernels.f64_scale(dst->floats, v->floats, factor, v->size);
+  }
+  return vector_node(dst);
+}
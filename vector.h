@@ -0,0 +1,40 @@
+#ifndef VECTOR_H_
+#define VECTOR_H_
+#include "hashmap.h"
+#include "parse.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Contiguous, unboxed run of int64s or doubles, `elem` is integer_t or
+// floating_t. The elements are stored inline after the header
+typedef struct vector {
+  literal_type elem;
+  int64_t size;
+  union {
+    int64_t *integers;
+    double *floats;
+  };
+} vector;
+
+vector *vector_new(literal_type, int64_t);
+ast_node vector_node(vector *);
+void vector_print(FILE *, vector *);
+
+ast_node make_vector(struct ast_arr ast, hashmap *ctx);
+ast_node vector_literal(struct ast_arr ast, hashmap *ctx);
+ast_node vector_length(struct ast_arr ast, hashmap *ctx);
+ast_node vector_ref(struct ast_arr ast, hashmap *ctx);
+ast_node vector_set(struct ast_arr ast, hashmap *ctx);
+// Element wise, an integer element that overflows is an error: unlike
+// vector-sum and vector-dot, the result can't hold a bignum
+ast_node vector_add(struct ast_arr ast, hashmap *ctx);
+ast_node vector_sub(struct ast_arr ast, hashmap *ctx);
+ast_node vector_mul(struct ast_arr ast, hashmap *ctx);
+ast_node vector_div(struct ast_arr ast, hashmap *ctx);
+ast_node vector_sum(struct ast_arr ast, hashmap *ctx);
+ast_node vector_dot(struct ast_arr ast, hashmap *ctx);
+ast_node vector_min(struct ast_arr ast, hashmap *ctx);
+ast_node vector_max(struct ast_arr ast, hashmap *ctx);
+ast_node vector_scale(struct ast_arr ast, hashmap *ctx);
+
+#endif // VECTOR_H_
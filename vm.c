@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -36,11 +37,378 @@ uint64_t RA = 0;
 int64_t X = 0;
 int64_t Y = 0;
 
-int main() {
-  int64_t program[] = {LDYI, 12, LDX,   STY,  STX, BEQ,  16,  STX, PRINT, STX,
-                       PUSH, 1,  ADD,   LDX,  J,   3,    STX, RET, PUSH,  1,
-                       CALL, 0,  PRINT, PUSH, 1,   PUSH, 2,   SWAP};
-  while (IP < sizeof(program) / sizeof(int64_t)) {
+// Baseline template JIT for this standalone VM, built and run by `make vm`.
+// The interpreter walks its AST and never compiles to this bytecode, so
+// schemelike programs don't run under it.
+// Taken branch, jump and call targets are counted, and once one
+// has been reached JIT_HOT times the whole program is translated by
+// copying a fixed machine code template per opcode and patching in its
+// immediates and branch targets. Execution then continues in native code
+// until it runs off the end or reaches something it can't translate,
+// and the interpreter picks up from there.
+// Without x86-64 or an executable mapping everything stays interpreted
+#define JIT_HOT 8
+
+#if defined(__x86_64__)
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Native register use:
+//   r12 = &STACK[SP], r14 = X, r15 = Y, rbx = RA
+//   r13 = native address of each bytecode index (NULL if not an opcode)
+//   rbp = jit_state, rax = IP when leaving native code
+typedef struct jit_state {
+  int64_t *sp;
+  int64_t x;
+  int64_t y;
+  uint64_t ra;
+  uint64_t ip;
+} jit_state;
+
+typedef struct jit_buf {
+  uint8_t *code;
+  size_t size;
+  size_t cap;
+} jit_buf;
+
+typedef struct jit_fixup {
+  size_t at;       // offset of a rel32 in the code
+  uint64_t target; // bytecode index it jumps to
+} jit_fixup;
+
+static bool jit_failed;
+static uint8_t *jit_code;
+static void **jit_table;
+static uint16_t *jit_counts;
+
+static void emit(jit_buf *b, const uint8_t *bytes, size_t n) {
+  if (b->size + n > b->cap) {
+    b->cap = (b->cap + n) * 2;
+    b->code = realloc(b->code, b->cap);
+  }
+  memcpy(&b->code[b->size], bytes, n);
+  b->size += n;
+}
+
+#define EMIT(b, ...)                                                           \
+  emit(b, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void emit_imm32(jit_buf *b, uint32_t v) { emit(b, (uint8_t *)&v, 4); }
+static void emit_imm64(jit_buf *b, uint64_t v) { emit(b, (uint8_t *)&v, 8); }
+
+static void emit_pop_rax(jit_buf *b) {
+  EMIT(b, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+  EMIT(b, 0x49, 0x8B, 0x04, 0x24); // mov rax, [r12]
+}
+
+static void emit_pop_rcx(jit_buf *b) {
+  EMIT(b, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+  EMIT(b, 0x49, 0x8B, 0x0C, 0x24); // mov rcx, [r12]
+}
+
+static void emit_push_rax(jit_buf *b) {
+  EMIT(b, 0x49, 0x89, 0x04, 0x24); // mov [r12], rax
+  EMIT(b, 0x49, 0x83, 0xC4, 0x08); // add r12, 8
+}
+
+static void emit_push_rcx(jit_buf *b) {
+  EMIT(b, 0x49, 0x89, 0x0C, 0x24); // mov [r12], rcx
+  EMIT(b, 0x49, 0x83, 0xC4, 0x08); // add r12, 8
+}
+
+// Leaves native code with IP = `ip`
+static void emit_exit_to(jit_buf *b, uint64_t ip, size_t exit) {
+  EMIT(b, 0x48, 0xB8); // movabs rax, ip
+  emit_imm64(b, ip);
+  EMIT(b, 0xE9); // jmp exit
+  emit_imm32(b, exit - (b->size + 4));
+}
+
+static void emit_branch(jit_buf *b, uint8_t cc, uint64_t target,
+                        jit_fixup **fixups, int *n, int *cap) {
+  emit_pop_rax(b);
+  emit_pop_rcx(b);
+  EMIT(b, 0x48, 0x39, 0xC8); // cmp rax, rcx
+  EMIT(b, 0x0F, cc);         // jcc rel32
+  if (*n == *cap) {
+    *cap *= 2;
+    *fixups = realloc(*fixups, sizeof(jit_fixup) * *cap);
+  }
+  (*fixups)[(*n)++] = (jit_fixup){b->size, target};
+  emit_imm32(b, 0);
+}
+
+static int operands(int64_t op) {
+  switch (op) {
+  case PUSH:
+  case BEQ:
+  case BNE:
+  case BLT:
+  case BGT:
+  case BLE:
+  case BGE:
+  case J:
+  case CALL:
+  case LDXI:
+  case LDYI:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static void jit_compile(int64_t *program, uint64_t len) {
+  jit_buf b = {0};
+  size_t *offsets = calloc(len + 1, sizeof(size_t));
+  bool *starts = calloc(len + 1, sizeof(bool));
+  int cap = 16;
+  int n = 0;
+  jit_fixup *fixups = calloc(cap, sizeof(jit_fixup));
+
+  // Entry, called as entry(jit_state *, void *target)
+  EMIT(&b, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+  EMIT(&b, 0x48, 0x83, 0xEC, 0x08); // sub rsp, 8 to keep calls aligned
+  EMIT(&b, 0x48, 0x89, 0xFD);       // mov rbp, rdi
+  EMIT(&b, 0x4C, 0x8B, 0x65, 0x00); // mov r12, [rbp]
+  EMIT(&b, 0x4C, 0x8B, 0x75, 0x08); // mov r14, [rbp + 8]
+  EMIT(&b, 0x4C, 0x8B, 0x7D, 0x10); // mov r15, [rbp + 16]
+  EMIT(&b, 0x48, 0x8B, 0x5D, 0x18); // mov rbx, [rbp + 24]
+  EMIT(&b, 0x49, 0xBD);             // movabs r13, table
+  size_t table_at = b.size;
+  emit_imm64(&b, 0);
+  EMIT(&b, 0xFF, 0xE6); // jmp rsi
+
+  // Exit, IP in rax
+  size_t exit = b.size;
+  EMIT(&b, 0x4C, 0x89, 0x65, 0x00); // mov [rbp], r12
+  EMIT(&b, 0x4C, 0x89, 0x75, 0x08); // mov [rbp + 8], r14
+  EMIT(&b, 0x4C, 0x89, 0x7D, 0x10); // mov [rbp + 16], r15
+  EMIT(&b, 0x48, 0x89, 0x5D, 0x18); // mov [rbp + 24], rbx
+  EMIT(&b, 0x48, 0x89, 0x45, 0x20); // mov [rbp + 32], rax
+  EMIT(&b, 0x48, 0x83, 0xC4, 0x08); // add rsp, 8
+  EMIT(&b, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3);
+
+  uint64_t ip = 0;
+  while (ip < len) {
+    int64_t op = program[ip];
+    int64_t imm = ip + 1 < len ? program[ip + 1] : 0;
+    if (ip + operands(op) >= len) {
+      break; // truncated instruction, let the interpreter deal with it
+    }
+    offsets[ip] = b.size;
+    starts[ip] = true;
+    switch (op) {
+    case ADD:
+      emit_pop_rax(&b);
+      emit_pop_rcx(&b);
+      EMIT(&b, 0x48, 0x01, 0xC8); // add rax, rcx
+      emit_push_rax(&b);
+      break;
+    case SUB:
+      emit_pop_rax(&b);
+      emit_pop_rcx(&b);
+      EMIT(&b, 0x48, 0x29, 0xC8); // sub rax, rcx
+      emit_push_rax(&b);
+      break;
+    case MUL:
+      emit_pop_rax(&b);
+      emit_pop_rcx(&b);
+      EMIT(&b, 0x48, 0x0F, 0xAF, 0xC1); // imul rax, rcx
+      emit_push_rax(&b);
+      break;
+    case DIV:
+    case MOD:
+      emit_pop_rax(&b);
+      emit_pop_rcx(&b);
+      EMIT(&b, 0x48, 0x99);       // cqo
+      EMIT(&b, 0x48, 0xF7, 0xF9); // idiv rcx
+      if (op == MOD) {
+        EMIT(&b, 0x48, 0x89, 0xD0); // mov rax, rdx
+      }
+      emit_push_rax(&b);
+      break;
+    case PUSH:
+      EMIT(&b, 0x48, 0xB8); // movabs rax, imm
+      emit_imm64(&b, imm);
+      emit_push_rax(&b);
+      break;
+    case POP:
+      EMIT(&b, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+      break;
+    case SWAP:
+      emit_pop_rax(&b);
+      emit_pop_rcx(&b);
+      emit_push_rax(&b);
+      emit_push_rcx(&b);
+      break;
+    case BEQ:
+      emit_branch(&b, 0x84, imm, &fixups, &n, &cap);
+      break;
+    case BNE:
+      emit_branch(&b, 0x85, imm, &fixups, &n, &cap);
+      break;
+    case BLT:
+      emit_branch(&b, 0x8C, imm, &fixups, &n, &cap);
+      break;
+    case BGT:
+      emit_branch(&b, 0x8F, imm, &fixups, &n, &cap);
+      break;
+    case BLE:
+      emit_branch(&b, 0x8E, imm, &fixups, &n, &cap);
+      break;
+    case BGE:
+      emit_branch(&b, 0x8D, imm, &fixups, &n, &cap);
+      break;
+    case CALL:
+      EMIT(&b, 0x48, 0xC7, 0xC3); // mov rbx, return address
+      emit_imm32(&b, ip + 2);
+      // fallthrough
+    case J:
+      EMIT(&b, 0xE9); // jmp rel32
+      if (n == cap) {
+        cap *= 2;
+        fixups = realloc(fixups, sizeof(jit_fixup) * cap);
+      }
+      fixups[n++] = (jit_fixup){b.size, imm};
+      emit_imm32(&b, 0);
+      break;
+    case RET:
+      EMIT(&b, 0x48, 0x89, 0xD8); // mov rax, rbx
+      EMIT(&b, 0x48, 0x3D);       // cmp rax, len
+      emit_imm32(&b, len);
+      EMIT(&b, 0x0F, 0x83); // jae exit
+      emit_imm32(&b, exit - (b.size + 4));
+      EMIT(&b, 0x49, 0x8B, 0x4C, 0xC5, 0x00); // mov rcx, [r13 + rax * 8]
+      EMIT(&b, 0x48, 0x85, 0xC9);             // test rcx, rcx
+      EMIT(&b, 0x0F, 0x84);                   // jz exit
+      emit_imm32(&b, exit - (b.size + 4));
+      EMIT(&b, 0xFF, 0xE1); // jmp rcx
+      break;
+    case LDX:
+      emit_pop_rax(&b);
+      EMIT(&b, 0x49, 0x89, 0xC6); // mov r14, rax
+      break;
+    case LDXI:
+      EMIT(&b, 0x49, 0xBE); // movabs r14, imm
+      emit_imm64(&b, imm);
+      break;
+    case LDY:
+      emit_pop_rax(&b);
+      EMIT(&b, 0x49, 0x89, 0xC7); // mov r15, rax
+      break;
+    case LDYI:
+      EMIT(&b, 0x49, 0xBF); // movabs r15, imm
+      emit_imm64(&b, imm);
+      break;
+    case STX:
+      EMIT(&b, 0x4C, 0x89, 0xF0); // mov rax, r14
+      emit_push_rax(&b);
+      break;
+    case STY:
+      EMIT(&b, 0x4C, 0x89, 0xF8); // mov rax, r15
+      emit_push_rax(&b);
+      break;
+    case PRINT:
+      emit_pop_rax(&b);
+      EMIT(&b, 0x48, 0x89, 0xC6); // mov rsi, rax
+      EMIT(&b, 0x48, 0xBF);       // movabs rdi, format
+      emit_imm64(&b, (uint64_t) "%ld\n");
+      EMIT(&b, 0x49, 0xBB); // movabs r11, printf
+      emit_imm64(&b, (uint64_t)printf);
+      EMIT(&b, 0x31, 0xC0);       // xor eax, eax
+      EMIT(&b, 0x41, 0xFF, 0xD3); // call r11
+      break;
+    default:
+      // Unknown opcode, hand it back to the interpreter
+      emit_exit_to(&b, ip, exit);
+      break;
+    }
+    ip += 1 + operands(op);
+  }
+  // Running off the end, or into a truncated instruction
+  offsets[ip] = b.size;
+  starts[ip] = true;
+  emit_exit_to(&b, ip, exit);
+
+  // Branches to the middle of an instruction or out of the program leave
+  // native code with that IP, like the interpreter would
+  for (int i = 0; i < n; i++) {
+    uint64_t target = fixups[i].target;
+    size_t to;
+    if (target <= len && starts[target]) {
+      to = offsets[target];
+    } else {
+      to = b.size;
+      emit_exit_to(&b, target, exit);
+    }
+    uint32_t rel = to - (fixups[i].at + 4);
+    memcpy(&b.code[fixups[i].at], &rel, 4);
+  }
+
+  uint8_t *code = mmap(NULL, b.size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    jit_failed = true;
+  } else {
+    jit_table = calloc(len + 1, sizeof(void *));
+    for (uint64_t i = 0; i <= len; i++) {
+      jit_table[i] = starts[i] ? code + offsets[i] : NULL;
+    }
+    uint64_t table = (uint64_t)jit_table;
+    memcpy(&b.code[table_at], &table, 8);
+    memcpy(code, b.code, b.size);
+    if (mprotect(code, b.size, PROT_READ | PROT_EXEC)) {
+      munmap(code, b.size);
+      free(jit_table);
+      jit_failed = true;
+    } else {
+      jit_code = code;
+    }
+  }
+  free(b.code);
+  free(offsets);
+  free(starts);
+  free(fixups);
+}
+
+// Returns the IP to continue interpreting from
+static uint64_t jit_maybe(int64_t *program, uint64_t len, uint64_t target) {
+  if (jit_failed || target >= len) {
+    return target;
+  }
+  if (!jit_code) {
+    if (!jit_counts) {
+      jit_counts = calloc(len, sizeof(uint16_t));
+    }
+    if (++jit_counts[target] < JIT_HOT) {
+      return target;
+    }
+    jit_compile(program, len);
+    if (jit_failed) {
+      return target;
+    }
+  }
+  if (!jit_table[target]) {
+    return target;
+  }
+
+  jit_state s = {.sp = &STACK[SP], .x = X, .y = Y, .ra = RA};
+  ((void (*)(jit_state *, void *))jit_code)(&s, jit_table[target]);
+  SP = s.sp - STACK;
+  X = s.x;
+  Y = s.y;
+  RA = s.ra;
+  return s.ip;
+}
+#else
+static uint64_t jit_maybe(int64_t *program, uint64_t len, uint64_t target) {
+  return target;
+}
+#endif
+
+static void run(int64_t *program, uint64_t len) {
+  while (IP < len) {
     int64_t op_code = program[IP];
     switch (op_code) {
     case ADD: {
@@ -100,7 +468,7 @@ int main() {
       int64_t reg_a = STACK[--SP];
       int64_t reg_b = STACK[--SP];
       if (reg_a == reg_b) {
-        IP = program[IP + 1];
+        IP = jit_maybe(program, len, program[IP + 1]);
       } else {
         IP += 2;
       }
@@ -110,7 +478,7 @@ int main() {
       int64_t reg_a = STACK[--SP];
       int64_t reg_b = STACK[--SP];
       if (reg_a != reg_b) {
-        IP = program[IP + 1];
+        IP = jit_maybe(program, len, program[IP + 1]);
       } else {
         IP += 2;
       }
@@ -120,7 +488,7 @@ int main() {
       int64_t reg_a = STACK[--SP];
       int64_t reg_b = STACK[--SP];
       if (reg_a < reg_b) {
-        IP = program[IP + 1];
+        IP = jit_maybe(program, len, program[IP + 1]);
       } else {
         IP += 2;
       }
@@ -130,7 +498,7 @@ int main() {
       int64_t reg_a = STACK[--SP];
       int64_t reg_b = STACK[--SP];
       if (reg_a > reg_b) {
-        IP = program[IP + 1];
+        IP = jit_maybe(program, len, program[IP + 1]);
       } else {
         IP += 2;
       }
@@ -140,7 +508,7 @@ int main() {
       int64_t reg_a = STACK[--SP];
       int64_t reg_b = STACK[--SP];
       if (reg_a <= reg_b) {
-        IP = program[IP + 1];
+        IP = jit_maybe(program, len, program[IP + 1]);
       } else {
         IP += 2;
       }
@@ -150,19 +518,19 @@ int main() {
       int64_t reg_a = STACK[--SP];
       int64_t reg_b = STACK[--SP];
       if (reg_a >= reg_b) {
-        IP = program[IP + 1];
+        IP = jit_maybe(program, len, program[IP + 1]);
       } else {
         IP += 2;
       }
       break;
     }
     case J: {
-      IP = program[IP + 1];
+      IP = jit_maybe(program, len, program[IP + 1]);
       break;
     }
     case CALL: {
       RA = IP + 2;
-      IP = program[IP + 1];
+      IP = jit_maybe(program, len, program[IP + 1]);
       break;
     }
     case RET: {
@@ -207,6 +575,13 @@ int main() {
     }
     }
   }
+}
+
+int main() {
+  int64_t program[] = {LDYI, 12, LDX,   STY,  STX, BEQ,  16,  STX, PRINT, STX,
+                       PUSH, 1,  ADD,   LDX,  J,   3,    STX, RET, PUSH,  1,
+                       CALL, 0,  PRINT, PUSH, 1,   PUSH, 2,   SWAP};
+  run(program, sizeof(program) / sizeof(int64_t));
   for (uint64_t i = 0; i < SP; i++) {
     printf("%ld ", STACK[i]);
   }